@@ -10,7 +10,18 @@ LOCAL_SRC_FILES := 	\
 	../../pslr_enum.c \
 	../../pslr_lens.c \
 	../../pslr_model.c \
-	../../pslr_scsi.c
+	../../pslr_scsi.c \
+	../../pslr_trace.c \
+	../../pslr_metrics.c \
+	../../pslr_sched.c \
+	../../pslr_histogram.c \
+	../../pslr_raw.c \
+	../../pslr_ramp.c \
+	../../pslr_bracket.c \
+	../../pslr_fusion.c \
+	../../pslr_sharpness.c \
+	../../pslr_pool.c \
+	../../pslr_watch.c
 GIT_HASH := `git log --pretty=format:'%h' -n 1`
 DEFINES := -DANDROID -DVERSION=\"$(VERSION)\" -DSUB_VERSION=\"$(GIT_HASH)\"
 LOCAL_CPPFLAGS  := $(DEFINES) -frtti -I.. -Istlport -g 
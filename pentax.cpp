@@ -2,6 +2,7 @@ extern "C"
 {
     #include "pslr.h"
     #include "pslr_enum.h"
+    #include "pslr_watch.h"
     bool debug = 1;
 }
 
@@ -13,32 +14,51 @@ extern "C"
 #include <sstream>
 #include <ctime>
 #include <cstdlib>
+#include <cstdio>
 #include <pwd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <errno.h>
 
 const static int MIN_UPDATE_INTERVAL = 2; // seconds
+const static long COALESCE_MS = 30; // wait this long for more edits after one arrived
+const static long COALESCE_MAX_MS = 150;
+const static int PROGRAM_DOWNLOAD_TRIES = 3000; // 10 ms apart
+const static size_t MAX_JOB_RESULTS = 64; // kept for waitFor(), oldest dropped first
 
 static char *theDevice = NULL;
 pthread_t theUpdateThread;
 bool theUpdateThreadRunning, theUpdateThreadExitFlag;
 static pslr_handle_t theHandle;
 static pslr_status theStatus;
+static pslr_watch_t * theWatch; // adaptive status polling, theUsbMutex
+static bool theStatusChanged; // theStatus changed since the last snapshot, theUsbMutex
 bool apertureIsAuto, isoIsAuto, shutterIsAuto;
 static Camera * theCamera = NULL;
 
+/* theUsbMutex serialises camera I/O and guards theStatus, it may be
+ * held for a whole download. theRequestMutex guards the requested
+ * changes, the path and the update thread flags, and is never held
+ * during camera I/O; theUpdateCondition wakes the update thread.
+ * Getters use neither, see StatusSnapshot. */
+static unsigned long theChangeCount = 0; // requested changes and kicks so far, theRequestMutex
+
 #ifdef ANDROID
-    pthread_mutex_t theMutex = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER;
-    #define LOCK_MUTEX 	if (pthread_mutex_lock(&theMutex) == EDEADLK) DPRINT("Deadlock");
-    #define UNLOCK_MUTEX \
-	if (pthread_mutex_unlock(&theMutex) == EPERM) DPRINT("Do not own Mutex lock");
+    pthread_mutex_t theUsbMutex = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER;
+    pthread_mutex_t theRequestMutex = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER;
+    pthread_cond_t theUpdateCondition = PTHREAD_COND_INITIALIZER;
+    #define LOCK_MUTEX(m) 	if (pthread_mutex_lock(&m) == EDEADLK) DPRINT("Deadlock");
+    #define UNLOCK_MUTEX(m) \
+	if (pthread_mutex_unlock(&m) == EPERM) DPRINT("Do not own Mutex lock");
 
     const std::string Camera::API_VERSION = std::string(VERSION) + "-" + SUB_VERSION;
 #else
-    pthread_mutex_t theMutex = PTHREAD_MUTEX_INITIALIZER;
-    #define LOCK_MUTEX 	pthread_mutex_lock(&theMutex);
-    #define UNLOCK_MUTEX pthread_mutex_unlock(&theMutex);
+    pthread_mutex_t theUsbMutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t theRequestMutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t theUpdateCondition = PTHREAD_COND_INITIALIZER;
+    #define LOCK_MUTEX(m) 	pthread_mutex_lock(&m);
+    #define UNLOCK_MUTEX(m) pthread_mutex_unlock(&m);
 
     const std::string Camera::API_VERSION = std::string(VERSION) + "-test";
 #endif
@@ -64,6 +84,126 @@ float rationalAsFloat(pslr_rational_t r)
     return float(r.nom) / float(r.denom);
 }
 
+/* Nominal values of the cameras in 1/3 and 1/2 stop steps. A Stop
+ * counts sixth stops, so every entry has an exact Stop, and the
+ * conversions between Stops and camera values are table lookups. */
+static const pslr_rational_t SHUTTER_THIRDS[] = {
+    {1, 8000}, {1, 6400}, {1, 5000}, {1, 4000}, {1, 3200}, {1, 2500}, {1, 2000}, {1, 1600},
+    {1, 1250}, {1, 1000}, {1, 800}, {1, 640}, {1, 500}, {1, 400}, {1, 320}, {1, 250},
+    {1, 200}, {1, 160}, {1, 125}, {1, 100}, {1, 80}, {1, 60}, {1, 50}, {1, 40},
+    {1, 30}, {1, 25}, {1, 20}, {1, 15}, {1, 13}, {1, 10}, {1, 8}, {1, 6},
+    {1, 5}, {1, 4}, {3, 10}, {4, 10}, {5, 10}, {6, 10}, {8, 10}, {1, 1},
+    {13, 10}, {16, 10}, {2, 1}, {25, 10}, {32, 10}, {4, 1}, {5, 1}, {6, 1},
+    {8, 1}, {10, 1}, {13, 1}, {15, 1}, {20, 1}, {25, 1}, {30, 1}
+};
+
+static const pslr_rational_t SHUTTER_HALVES[] = {
+    {1, 8000}, {1, 6000}, {1, 4000}, {1, 3000}, {1, 2000}, {1, 1500}, {1, 1000}, {1, 750},
+    {1, 500}, {1, 350}, {1, 250}, {1, 180}, {1, 125}, {1, 90}, {1, 60}, {1, 45},
+    {1, 30}, {1, 20}, {1, 15}, {1, 10}, {1, 8}, {1, 6}, {1, 4}, {3, 10},
+    {5, 10}, {7, 10}, {1, 1}, {15, 10}, {2, 1}, {3, 1}, {4, 1}, {6, 1},
+    {8, 1}, {10, 1}, {15, 1}, {20, 1}, {30, 1}
+};
+
+static const pslr_rational_t APERTURE_THIRDS[] = {
+    {10, 10}, {11, 10}, {12, 10}, {14, 10}, {16, 10}, {18, 10}, {20, 10}, {22, 10},
+    {25, 10}, {28, 10}, {32, 10}, {35, 10}, {40, 10}, {45, 10}, {50, 10}, {56, 10},
+    {63, 10}, {71, 10}, {80, 10}, {90, 10}, {10, 1}, {11, 1}, {13, 1}, {14, 1},
+    {16, 1}, {18, 1}, {20, 1}, {22, 1}, {25, 1}, {29, 1}, {32, 1}, {36, 1},
+    {40, 1}, {45, 1}
+};
+
+static const pslr_rational_t APERTURE_HALVES[] = {
+    {10, 10}, {12, 10}, {14, 10}, {17, 10}, {20, 10}, {24, 10}, {28, 10}, {33, 10},
+    {40, 10}, {48, 10}, {56, 10}, {67, 10}, {80, 10}, {95, 10}, {11, 1}, {13, 1},
+    {16, 1}, {19, 1}, {22, 1}, {27, 1}, {32, 1}, {38, 1}, {45, 1}
+};
+
+static const pslr_rational_t ISO_THIRDS[] = {
+    {50, 1}, {64, 1}, {80, 1}, {100, 1}, {125, 1}, {160, 1}, {200, 1}, {250, 1},
+    {320, 1}, {400, 1}, {500, 1}, {640, 1}, {800, 1}, {1000, 1}, {1250, 1}, {1600, 1},
+    {2000, 1}, {2500, 1}, {3200, 1}, {4000, 1}, {5000, 1}, {6400, 1}, {8000, 1}, {10000, 1},
+    {12800, 1}, {16000, 1}, {20000, 1}, {25600, 1}, {32000, 1}, {40000, 1}, {51200, 1}, {64000, 1},
+    {80000, 1}, {102400, 1}
+};
+
+static const pslr_rational_t ISO_HALVES[] = {
+    {50, 1}, {70, 1}, {100, 1}, {140, 1}, {200, 1}, {280, 1}, {400, 1}, {560, 1},
+    {800, 1}, {1100, 1}, {1600, 1}, {2200, 1}, {3200, 1}, {4500, 1}, {6400, 1}, {9000, 1},
+    {12800, 1}, {18000, 1}, {25600, 1}, {36000, 1}, {51200, 1}, {72000, 1}, {102400, 1}
+};
+
+#define STOP_TABLE(first, step, values) {first, step, sizeof(values) / sizeof(pslr_rational_t), values}
+
+struct StopTable
+{
+    int first;          // sixth stops of the first entry
+    int step;           // sixth stops between the entries
+    int count;
+    const pslr_rational_t * values;
+
+    bool find(int sixths, pslr_rational_t & r) const
+    {
+	int i = sixths - first;
+	if (i < 0 || i % step != 0 || i / step >= count)
+	    return false;
+	r = values[i / step];
+	return true;
+    }
+
+    bool find(const pslr_rational_t & r, int & sixths) const
+    {
+	for (int i = 0; i < count; i++)
+	{
+	    if ((int64_t)r.nom * values[i].denom == (int64_t)values[i].nom * r.denom)
+	    {
+		sixths = first + i * step;
+		return true;
+	    }
+	}
+	return false;
+    }
+
+    static int sixthsOf(const Stop & s)
+    {
+	return s.sixthStops;
+    }
+
+    static Stop fromSixths(int ss)
+    {
+	return Stop::fromSixthStops(ss);
+    }
+};
+
+// {thirds, halves}; the sixth stops are 6 * log2(seconds), 12 * log2(f-number) and 6 * log2(ISO / 100)
+static const StopTable SHUTTER_TABLES[] = {
+    STOP_TABLE(-78, 2, SHUTTER_THIRDS), STOP_TABLE(-78, 3, SHUTTER_HALVES)
+};
+static const StopTable APERTURE_TABLES[] = {
+    STOP_TABLE(0, 2, APERTURE_THIRDS), STOP_TABLE(0, 3, APERTURE_HALVES)
+};
+static const StopTable ISO_TABLES[] = {
+    STOP_TABLE(-6, 2, ISO_THIRDS), STOP_TABLE(-6, 3, ISO_HALVES)
+};
+
+static bool nominalValue(const StopTable * tables, int sixths, pslr_rational_t & r)
+{
+    return tables[0].find(sixths, r) || tables[1].find(sixths, r);
+}
+
+/* Camera value to Stop. Some nominal values are in both series (1/6 s,
+ * 0.3 s), the current EV step setting of the camera decides. */
+static bool stopFromNominal(const StopTable * tables, const pslr_rational_t & r, bool halves, Stop & s)
+{
+    int sixths;
+    if (tables[halves ? 1 : 0].find(r, sixths) || tables[halves ? 0 : 1].find(r, sixths))
+    {
+	s = StopTable::fromSixths(sixths);
+	return true;
+    }
+    return false;
+}
+
 const Stop Stop::UNKNOWN = Stop(-10);
 const Stop Stop::AUTO = Stop(-20);
 const Stop Stop::HALF = Stop::fromHalfStops(1);
@@ -178,16 +318,25 @@ const Stop Stop::times(int x) const
 
 float Stop::asAperture() const
 {
+    pslr_rational_t r;
+    if (nominalValue(APERTURE_TABLES, sixthStops, r))
+	return float(r.nom) / float(r.denom);
     return roundToSignificantDigits(powf(2., (float)sixthStops / 12.), 2);
 }
 
 float Stop::asShuttertime() const
 {
+    pslr_rational_t r;
+    if (nominalValue(SHUTTER_TABLES, sixthStops, r))
+	return float(r.nom) / float(r.denom);
     return roundToSignificantDigits(powf(2., (float)sixthStops / 6.), 2);
 }
 
 float Stop::asShutterspeed() const
 {
+    pslr_rational_t r;
+    if (nominalValue(SHUTTER_TABLES, sixthStops, r))
+	return float(r.denom) / float(r.nom);
     return roundToSignificantDigits(powf(2., (float)sixthStops / -6.), 2);
 }
 
@@ -195,6 +344,9 @@ int Stop::asISO() const
 {
     if (*this == AUTO)
 	return 0;
+    pslr_rational_t r;
+    if (nominalValue(ISO_TABLES, sixthStops, r))
+	return r.nom;
     return (int)roundToSignificantDigits(100. * powf(2., (float)sixthStops / 6.), 2);
 }
 
@@ -268,6 +420,8 @@ std::string Stop::getISOString() const
 pslr_rational_t stopAsRationalAperture(const Stop & stop)
 {
     pslr_rational_t r;
+    if (nominalValue(APERTURE_TABLES, StopTable::sixthsOf(stop), r))
+	return r;
     float a = stop.asAperture();
     if (a > 10.)
     {
@@ -285,6 +439,8 @@ pslr_rational_t stopAsRationalAperture(const Stop & stop)
 pslr_rational_t stopAsRationalShuttertime(const Stop & stop)
 {
     pslr_rational_t r;
+    if (nominalValue(SHUTTER_TABLES, StopTable::sixthsOf(stop), r))
+	return r;
     float s = stop.asShuttertime();
     if (s < .3)
     {
@@ -317,111 +473,46 @@ float asFloat(const pslr_rational_t & r)
     return float(r.nom) / float(r.denom);
 }
 
-void Camera::setStop(const Parameter & p, const Stop & s)
-{
-    if (getStop(p) != s)
-    {
-	LOCK_MUTEX;
-	requestedStopChanges[p] = s;
-	UNLOCK_MUTEX;
-    }
-}
-
-void Camera::setString(const Parameter & p, const String & s)
-{
-    if (p == "File Destination")
-    {
-	setFileDestination(s);
-	return;
-    }
-    
-    if (getString(p) != s)
-    {
-	LOCK_MUTEX;
-	requestedStringChanges[p] = s;
-	UNLOCK_MUTEX;
-    }
-}
-
-void Camera::setStopByIndex(const Parameter & p, int i)
-{
-    setStop(p, getStopOption(p, i));
-}
-
-void Camera::setStringByIndex(const Parameter & p, int i)
-{
-    setString(p, getStringOption(p, i));
-}
-
-Stop Camera::getStop(const Parameter & p) const
-{
-    std::map<Parameter, Stop>::const_iterator it;
-    LOCK_MUTEX;
-    it = requestedStopChanges.find(p);
-    UNLOCK_MUTEX;
-    if (it != requestedStopChanges.end())
-	return it->second;
-    
-    LOCK_MUTEX;
-    it = currentStopValues.find(p);
-    UNLOCK_MUTEX;
-    if (it != currentStopValues.end())
-	return it->second;
-    return Stop::UNKNOWN;
-}
-
-std::string Camera::getString(const Parameter & p) const
-{
-    LOCK_MUTEX;
-    std::map<Parameter, std::string>::const_iterator it = currentStringValues.find(p);
-    if (it == currentStringValues.end())
-    {
-	UNLOCK_MUTEX;
-	return "?";
-    }
-    UNLOCK_MUTEX;
-    return it->second;
-}
-
-Stop Camera::getMinimum(const Parameter & p) const
-{
-    if (p == "Shutterspeed")
-	return Stop::fromShutterspeed(pslr_get_model_fastest_shutter_speed(theHandle));
-    if (p == "Aperture")
-	return Stop::fromAperture(rationalAsFloat(theStatus.lens_min_aperture));
-    if (p == "ISO")
-	return Stop::fromISO(pslr_get_model_extended_iso_min(theHandle));
-    if (p == "Exposure Compensation")
-	return Stop::fromExposureCompensation(-5);
-    if (p == "Flash Exposure Compensation")
-	return 0;
-    if (p == "JPEG Sharpness" || p == "JPEG Contrast" ||p == "JPEG Saturation" || p == "JPEG Hue")
-	return 0;
-    return Stop();
-}
+typedef int (*Setter)(pslr_handle_t, int);
 
-Stop Camera::getMaximum(const Parameter & p) const
-{
-    if (p == "Shutterspeed")
-	return Stop::fromShuttertime(30);
-    if (p == "Aperture")
-	return Stop::fromAperture(rationalAsFloat(theStatus.lens_max_aperture));
-    if (p == "ISO")
-	return Stop::fromISO(pslr_get_model_extended_iso_max(theHandle));
-    if (p == "Exposure Compensation")
-	return Stop::fromExposureCompensation(5);
-    if (p == "Flash Exposure Compensation")
-	return 5;
-    if (p == "JPEG Sharpness" || p == "JPEG Contrast" ||p == "JPEG Saturation" || p == "JPEG Hue")
-	return pslr_get_model_jpeg_property_levels(theHandle);
-    return Stop();
-}
+/* Parameters have dense ids, their names are only looked up where the
+ * strings of the public API come in */
+enum StopParameterId
+{
+    PARAM_SHUTTERSPEED,
+    PARAM_APERTURE,
+    PARAM_ISO,
+    PARAM_EXPOSURE_COMPENSATION,
+    PARAM_FLASH_EXPOSURE_COMPENSATION,
+    PARAM_JPEG_SHARPNESS,
+    PARAM_JPEG_CONTRAST,
+    PARAM_JPEG_SATURATION,
+    PARAM_JPEG_HUE,
+    STOP_PARAMETER_COUNT
+};
 
-typedef int (*Setter)(pslr_handle_t, int);
+enum StringParameterId
+{
+    PARAM_DRIVE_MODE,
+    PARAM_AUTOFOCUS_POINTS,
+    PARAM_METERING_MODE,
+    PARAM_COLOR_SPACE,
+    PARAM_JPEG_IMAGE_TONE,
+    PARAM_WHITEBALANCE_MODE,
+    PARAM_EXPOSURE_MODE,
+    PARAM_FLASH_MODE,
+    PARAM_AUTOFOCUS_MODE,
+    PARAM_FILE_DESTINATION,
+    PARAM_FILE_FORMAT,
+    PARAM_EV_STEPS,
+    PARAM_CAMERA_MODEL,
+    PARAM_LENS_MODEL,
+    STRING_PARAMETER_COUNT
+};
 
 struct StringParameter
 {
-    std::string name;
+    const char * name;
     uint32_t * statusField;
     Setter setter;
     const char ** options;
@@ -468,6 +559,7 @@ int setAFMode(pslr_handle_t, int)
     return 0;
 }
 
+// in StringParameterId order
 const StringParameter STRING_PARAMETERS[] =
 {
     {"Drive Mode", &theStatus.drive_mode, (Setter)&pslr_set_drive_mode,
@@ -493,9 +585,22 @@ const StringParameter STRING_PARAMETERS[] =
     {"Lens Model", NULL, NULL, NULL, -1},
 };
 
+// in StopParameterId order
+const char * STOP_PARAMETER_NAMES[] =
+{
+    "Shutterspeed", "Aperture", "ISO", "Exposure Compensation", "Flash Exposure Compensation",
+    "JPEG Sharpness", "JPEG Contrast", "JPEG Saturation", "JPEG Hue"
+};
+
+// compile time checks that the tables match the ids
+typedef char STRING_PARAMETERS_MATCH_IDS[
+    sizeof(STRING_PARAMETERS) / sizeof(StringParameter) == STRING_PARAMETER_COUNT ? 1 : -1];
+typedef char STOP_PARAMETER_NAMES_MATCH_IDS[
+    sizeof(STOP_PARAMETER_NAMES) / sizeof(char *) == STOP_PARAMETER_COUNT ? 1 : -1];
+
 int findStringParameter(const std::string & name)
 {
-    for (unsigned int i = 0; i < sizeof(STRING_PARAMETERS) / sizeof(StringParameter); i++)
+    for (int i = 0; i < STRING_PARAMETER_COUNT; i++)
     {
 	if (name == STRING_PARAMETERS[i].name)
 	    return i;
@@ -503,27 +608,232 @@ int findStringParameter(const std::string & name)
     return -1;
 }
 
-int getIndexOfOption(StringParameter p, const std::string & str)
+int findStopParameter(const std::string & name)
+{
+    for (int i = 0; i < STOP_PARAMETER_COUNT; i++)
+    {
+	if (name == STOP_PARAMETER_NAMES[i])
+	    return i;
+    }
+    return -1;
+}
+
+int getIndexOfOption(const StringParameter & p, const std::string & str)
 {
     for (int i = 0; i < p.numOptions; i++)
-	if (std::string(p.options[i]) == str)
+	if (str == p.options[i])
 	    return i;
     return -1;
 }
 
-std::string getOptionByIndex(StringParameter p, int idx)
+std::string getOptionByIndex(const StringParameter & p, int idx)
 {
-    if (idx > p.numOptions)
+    if (idx < 0 || idx >= p.numOptions)
 	return "?";
     return p.options[idx];
 }
 
-const std::string STOP_VALUE_PARAMETERS[] =
+/* Parsed camera state as plain data, published with a seqlock: the
+ * writer makes theSnapshotSequence odd while copying, readers retry
+ * until the sequence was even and unchanged around their copy. Readers
+ * never wait for camera I/O. Writers hold theUsbMutex, so there is
+ * only one. */
+struct StatusSnapshot
 {
-    "Shutterspeed", "Aperture", "ISO", "Exposure Compensation", "Flash Exposure Compensation",
-    "JPEG Sharpness", "JPEG Contrast", "JPEG Saturation", "JPEG Hue"
+    pslr_status status;
+    Stop stops[STOP_PARAMETER_COUNT];
+    const char * strings[STRING_PARAMETER_COUNT]; // static option names, NULL if unknown
 };
 
+static StatusSnapshot theSnapshot;
+static volatile unsigned long theSnapshotSequence = 0; // 0: nothing published yet
+
+static void publishSnapshot(const StatusSnapshot & s)
+{
+    theSnapshotSequence++;
+    __sync_synchronize();
+    theSnapshot = s;
+    __sync_synchronize();
+    theSnapshotSequence++;
+}
+
+static StatusSnapshot readSnapshot(unsigned long * version = NULL)
+{
+    StatusSnapshot s;
+    unsigned long seq;
+    do
+    {
+	seq = theSnapshotSequence;
+	__sync_synchronize();
+	s = theSnapshot;
+	__sync_synchronize();
+    } while ((seq & 1) || seq != theSnapshotSequence);
+    if (version)
+	*version = seq / 2;
+    return s;
+}
+
+/* Requested changes not sent yet, guarded by theRequestMutex. A bit
+ * of a pending mask is set for every id with a requested value. */
+static Stop theRequestedStops[STOP_PARAMETER_COUNT];
+static int theRequestedStrings[STRING_PARAMETER_COUNT]; // option index
+static uint32_t thePendingStops = 0;
+static uint32_t thePendingStrings = 0;
+
+Stop getStopById(int i)
+{
+    LOCK_MUTEX(theRequestMutex);
+    bool requested = thePendingStops & (1u << i);
+    Stop s = theRequestedStops[i];
+    UNLOCK_MUTEX(theRequestMutex);
+    if (requested)
+	return s;
+
+    unsigned long version;
+    StatusSnapshot snapshot = readSnapshot(&version);
+    if (version == 0)
+	return Stop::UNKNOWN;
+    return snapshot.stops[i];
+}
+
+Stop Camera::getStop(const Parameter & p) const
+{
+    int i = findStopParameter(p);
+    if (i < 0)
+	return Stop::UNKNOWN;
+    return getStopById(i);
+}
+
+std::string Camera::getString(const Parameter & p) const
+{
+    int i = findStringParameter(p);
+    if (i < 0)
+	return "?";
+    const char * s = readSnapshot().strings[i];
+    return s ? s : "?";
+}
+
+void Camera::setStop(const Parameter & p, const Stop & s)
+{
+    int i = findStopParameter(p);
+    if (i < 0 || getStopById(i) == s)
+	return;
+    LOCK_MUTEX(theRequestMutex);
+    theRequestedStops[i] = s;
+    thePendingStops |= 1u << i;
+    theChangeCount++;
+    pthread_cond_signal(&theUpdateCondition);
+    UNLOCK_MUTEX(theRequestMutex);
+}
+
+void Camera::setString(const Parameter & p, const String & s)
+{
+    if (p == "File Destination")
+    {
+	setFileDestination(s);
+	return;
+    }
+    
+    int i = findStringParameter(p);
+    if (i < 0 || !STRING_PARAMETERS[i].setter || getString(p) == s)
+	return;
+    int j = getIndexOfOption(STRING_PARAMETERS[i], s);
+    if (j < 0)
+	return;
+    LOCK_MUTEX(theRequestMutex);
+    theRequestedStrings[i] = j;
+    thePendingStrings |= 1u << i;
+    theChangeCount++;
+    pthread_cond_signal(&theUpdateCondition);
+    UNLOCK_MUTEX(theRequestMutex);
+}
+
+void Camera::setStopByIndex(const Parameter & p, int i)
+{
+    setStop(p, getStopOption(p, i));
+}
+
+void Camera::setStringByIndex(const Parameter & p, int i)
+{
+    setString(p, getStringOption(p, i));
+}
+
+/* Limits of the model, computed once at connect. The aperture limits
+ * come from the lens and are read from the status instead. */
+static Stop theMinimums[STOP_PARAMETER_COUNT];
+static Stop theMaximums[STOP_PARAMETER_COUNT];
+
+void computeLimits()
+{
+    for (int i = 0; i < STOP_PARAMETER_COUNT; i++)
+    {
+	theMinimums[i] = Stop();
+	theMaximums[i] = Stop();
+    }
+    theMinimums[PARAM_SHUTTERSPEED] = Stop::fromShutterspeed(pslr_get_model_fastest_shutter_speed(theHandle));
+    theMaximums[PARAM_SHUTTERSPEED] = Stop::fromShuttertime(30);
+    theMinimums[PARAM_ISO] = Stop::fromISO(pslr_get_model_extended_iso_min(theHandle));
+    theMaximums[PARAM_ISO] = Stop::fromISO(pslr_get_model_extended_iso_max(theHandle));
+    theMinimums[PARAM_EXPOSURE_COMPENSATION] = Stop::fromExposureCompensation(-5);
+    theMaximums[PARAM_EXPOSURE_COMPENSATION] = Stop::fromExposureCompensation(5);
+    theMinimums[PARAM_FLASH_EXPOSURE_COMPENSATION] = 0;
+    theMaximums[PARAM_FLASH_EXPOSURE_COMPENSATION] = 5;
+    int levels = pslr_get_model_jpeg_property_levels(theHandle);
+    for (int i = PARAM_JPEG_SHARPNESS; i <= PARAM_JPEG_HUE; i++)
+    {
+	theMinimums[i] = 0;
+	theMaximums[i] = levels;
+    }
+}
+
+Stop getMinimumById(int i)
+{
+    if (i == PARAM_APERTURE)
+	return Stop::fromAperture(rationalAsFloat(readSnapshot().status.lens_min_aperture));
+    if (i < 0 || i >= STOP_PARAMETER_COUNT)
+	return Stop();
+    return theMinimums[i];
+}
+
+Stop getMaximumById(int i)
+{
+    if (i == PARAM_APERTURE)
+	return Stop::fromAperture(rationalAsFloat(readSnapshot().status.lens_max_aperture));
+    if (i < 0 || i >= STOP_PARAMETER_COUNT)
+	return Stop();
+    return theMaximums[i];
+}
+
+// exposure options follow the EV step setting of the camera
+bool hasExposureOptions(int i)
+{
+    return i == PARAM_SHUTTERSPEED || i == PARAM_APERTURE || i == PARAM_ISO;
+}
+
+Stop exposureOptionStep()
+{
+    if (readSnapshot().status.custom_ev_steps == PSLR_CUSTOM_EV_STEPS_1_3)
+	return Stop::THIRD;
+    return Stop::HALF;
+}
+
+Stop getStopOptionById(int i, int option)
+{
+    if (hasExposureOptions(i))
+	return (option == 0? Stop::AUTO : getMinimumById(i) + exposureOptionStep() * (option - 1));
+    return getMinimumById(i) + Stop(option);
+}
+
+Stop Camera::getMinimum(const Parameter & p) const
+{
+    return getMinimumById(findStopParameter(p));
+}
+
+Stop Camera::getMaximum(const Parameter & p) const
+{
+    return getMaximumById(findStopParameter(p));
+}
+
 std::string Camera::getStringOption(const Parameter & p, int i) const
 {
     int j = findStringParameter(p);
@@ -534,9 +844,7 @@ std::string Camera::getStringOption(const Parameter & p, int i) const
 
 Stop Camera::getStopOption(const Parameter & p, int i) const
 {
-    if (p == "Shutterspeed" || p == "Aperture" || p == "ISO")
-	return (i == 0? Stop::AUTO : getMinimum(p) + Stop::fromExposureSteps(i - 1));
-    return getMinimum(p) + Stop(i);
+    return getStopOptionById(findStopParameter(p), i);
 }
 
 int Camera::getStringCount(const Parameter & p) const
@@ -549,16 +857,21 @@ int Camera::getStringCount(const Parameter & p) const
 
 int Camera::getStopCount(const Parameter & p) const
 {
-    return (getMaximum(p) - getMinimum(p)).asExposureSteps();
+    int i = findStopParameter(p);
+    Stop range = getMaximumById(i) - getMinimumById(i);
+    if (hasExposureOptions(i))
+	return StopTable::sixthsOf(range) / StopTable::sixthsOf(exposureOptionStep());
+    return range.asExposureSteps();
 }
 
 std::string Camera::getStopOptionAsString(const Parameter & p, int i) const
 {
-    Stop s = getStopOption(p, i);
+    int id = findStopParameter(p);
+    Stop s = getStopOptionById(id, i);
     if (s == Stop::AUTO)
 	return "AUTO";
 
-    if (p == "Shutterspeed")
+    if (id == PARAM_SHUTTERSPEED)
     {
 	if  (s.asShuttertime() < .3)
 	    return s.getOneOverString(true);
@@ -567,72 +880,89 @@ std::string Camera::getStopOptionAsString(const Parameter & p, int i) const
 
     }
 
-    if (p == "Aperture")
+    if (id == PARAM_APERTURE)
 	return s.getApertureString();
 
-    if (p == "ISO")
+    if (id == PARAM_ISO)
 	return s.getISOString();
 
     return s.getPrettyString();
 }
 
-std::string retrieveStringValue(const Camera::Parameter & p)
+const char * retrieveStringValue(int i)
 {
-    int i = findStringParameter(p);
-    if (i < 0 || (!STRING_PARAMETERS[i].options) || (!STRING_PARAMETERS[i].statusField))
-	return "?";
-    int idx = *STRING_PARAMETERS[i].statusField;
-    return getOptionByIndex(STRING_PARAMETERS[i], idx);
+    if ((!STRING_PARAMETERS[i].options) || (!STRING_PARAMETERS[i].statusField))
+	return NULL;
+    uint32_t idx = *STRING_PARAMETERS[i].statusField;
+    if (idx >= (uint32_t)STRING_PARAMETERS[i].numOptions)
+	return NULL;
+    return STRING_PARAMETERS[i].options[idx];
 }
 
-Stop retrieveStopValue(const Camera::Parameter & p)
+Stop retrieveStopValue(int i)
 {
-    if (p == "Shutterspeed") return Stop::fromShuttertime(asFloat(theStatus.current_shutter_speed));
-    if (p == "Aperture")     return Stop::fromAperture(asFloat(theStatus.current_aperture));
-    if (p == "ISO")          return Stop::fromISO(theStatus.fixed_iso);
-    if (p == "Exposure Compensation") return Stop::fromExposureCompensation(asFloat(theStatus.ec));
-    if (p == "Flash Exposure Compensation")
+    bool halves = theStatus.custom_ev_steps == PSLR_CUSTOM_EV_STEPS_1_2;
+    pslr_rational_t iso = {(int32_t)theStatus.fixed_iso, 1};
+    Stop s;
+    switch (i)
+    {
+    case PARAM_SHUTTERSPEED:
+	if (stopFromNominal(SHUTTER_TABLES, theStatus.current_shutter_speed, halves, s))
+	    return s;
+	return Stop::fromShuttertime(asFloat(theStatus.current_shutter_speed));
+    case PARAM_APERTURE:
+	if (stopFromNominal(APERTURE_TABLES, theStatus.current_aperture, halves, s))
+	    return s;
+	return Stop::fromAperture(asFloat(theStatus.current_aperture));
+    case PARAM_ISO:
+	if (stopFromNominal(ISO_TABLES, iso, halves, s))
+	    return s;
+	return Stop::fromISO(theStatus.fixed_iso);
+    case PARAM_EXPOSURE_COMPENSATION: return Stop::fromExposureCompensation(asFloat(theStatus.ec));
+    case PARAM_FLASH_EXPOSURE_COMPENSATION:
 	return Stop::fromExposureCompensation(theStatus.flash_exposure_compensation);
-    if (p == "JPEG Sharpness")  return Stop(theStatus.jpeg_sharpness);
-    if (p == "JPEG Contrast")   return theStatus.jpeg_contrast;
-    if (p == "JPEG Saturation") return theStatus.jpeg_saturation;
-    if (p == "JPEG Hue")        return theStatus.jpeg_hue;
-    //~ if (p == "Whitebalance Adjustment Magenta/Green") return 
-    //~ if (p == "Whitebalance Adjustment Blue/Amber")    return
+    case PARAM_JPEG_SHARPNESS:  return Stop(theStatus.jpeg_sharpness);
+    case PARAM_JPEG_CONTRAST:   return theStatus.jpeg_contrast;
+    case PARAM_JPEG_SATURATION: return theStatus.jpeg_saturation;
+    case PARAM_JPEG_HUE:        return theStatus.jpeg_hue;
+    //~ case PARAM_WHITEBALANCE_ADJUSTMENT_MG: return 
+    //~ case PARAM_WHITEBALANCE_ADJUSTMENT_BA: return
+    }
     return Stop::UNKNOWN;
 }
 
-void Camera::updateValues()
+/* Called by pslr_watch_poll() with theUsbMutex held, only when the
+ * status changed */
+static void statusChanged(const pslr_status * status, uint32_t changed, void * user_data)
 {
-    LOCK_MUTEX;
-    pslr_get_status(theHandle, &theStatus);
-    for (unsigned int i = 0; i < sizeof(STRING_PARAMETERS) / sizeof(StringParameter); i++)
-    {
-	const std::string & param = STRING_PARAMETERS[i].name;
-	currentStringValues[param] = retrieveStringValue(param);
-    }
-    UNLOCK_MUTEX;
+    theStatus = *status;
+    theStatusChanged = true;
+}
 
-    LOCK_MUTEX;
-    for (unsigned int i = 0; i < sizeof(STOP_VALUE_PARAMETERS) / sizeof(std::string); i++)
+void Camera::updateValues()
+{
+    StatusSnapshot s;
+    LOCK_MUTEX(theUsbMutex);
+    pslr_watch_poll(theWatch);
+    if (!theStatusChanged)
     {
-	const std::string & param = STOP_VALUE_PARAMETERS[i];
-	currentStopValues[param] = retrieveStopValue(param);
+	UNLOCK_MUTEX(theUsbMutex);
+	return;
     }
-    UNLOCK_MUTEX;
+    theStatusChanged = false;
+    s.status = theStatus;
+    for (int i = 0; i < STRING_PARAMETER_COUNT; i++)
+	s.strings[i] = retrieveStringValue(i);
+    for (int i = 0; i < STOP_PARAMETER_COUNT; i++)
+	s.stops[i] = retrieveStopValue(i);
+    publishSnapshot(s);
+    UNLOCK_MUTEX(theUsbMutex);
 }
 
-int sendChange(const Camera::Parameter & p, const std::string & s)
+int sendStringChange(int i, int option)
 {
-    DPRINT("Sending string change %s: %s\n", p.c_str(), s.c_str());
-    int i = findStringParameter(p);
-    if (i < 0 || (!STRING_PARAMETERS[i].options) || !(STRING_PARAMETERS[i].setter))
-	return -1;
-    int j = getIndexOfOption(STRING_PARAMETERS[i], s);
-    if (j < 0)
-	return -1;
-    return STRING_PARAMETERS[i].setter(theHandle, j);
-    return 0;
+    DPRINT("Sending string change %s: %s\n", STRING_PARAMETERS[i].name, STRING_PARAMETERS[i].options[option]);
+    return STRING_PARAMETERS[i].setter(theHandle, option);
 }
 
 bool updateExposureIfNecessary(bool & b, const Stop & s)
@@ -642,81 +972,150 @@ bool updateExposureIfNecessary(bool & b, const Stop & s)
 	b = (s == Stop::AUTO);
 	pslr_exposure_mode_t m = getExposureMode(apertureIsAuto, shutterIsAuto, isoIsAuto);
 	pslr_set_exposure_mode(theHandle, m);
-	pslr_get_status(theHandle, &theStatus);
+	pslr_watch_poll(theWatch);
     }
     return b;
 }
 
-int sendChange(const Camera::Parameter & p, const Stop & s)
+int sendStopChange(int i, const Stop & s)
 {
-    DPRINT("Sending stop change %s: %s\n", p.c_str(), s.getPrettyString().c_str());
-    if (p == "Shutterspeed")
+    DPRINT("Sending stop change %s: %s\n", STOP_PARAMETER_NAMES[i], s.getPrettyString().c_str());
+    switch (i)
     {
+    case PARAM_SHUTTERSPEED:
 	if (s != Stop::AUTO)
 	    pslr_set_shutter(theHandle, stopAsRationalShuttertime(s));
 	updateExposureIfNecessary(shutterIsAuto, s);
-    }
-    if (p == "Aperture")
-    {
+	return 0;
+    case PARAM_APERTURE:
 	if(updateExposureIfNecessary(apertureIsAuto, s))
 	    return 0;
 	return pslr_set_aperture(theHandle, stopAsRationalAperture(s));
-    }
-    if (p == "ISO")
-    {
+    case PARAM_ISO:
 	updateExposureIfNecessary(isoIsAuto, s);
 	return pslr_set_iso(theHandle, s.asISO(),
 	    pslr_get_model_extended_iso_min(theHandle),
 	    pslr_get_model_extended_iso_max(theHandle));
-    }
-    if (p == "Exposure Compensation")
+    case PARAM_EXPOSURE_COMPENSATION:
 	return pslr_set_ec(theHandle, stopAsRationalExposureCompensation(s));
-    if (p == "Flash Exposure Compensation")
+    case PARAM_FLASH_EXPOSURE_COMPENSATION:
 	return pslr_set_flash_exposure_compensation(theHandle,
 	    stopAsRationalExposureCompensation(s));
-    if (p == "JPEG Sharpness")  return pslr_set_jpeg_sharpness(theHandle, s.asInt());
-    if (p == "JPEG Contrast")   return pslr_set_jpeg_contrast(theHandle, s.asInt());
-    if (p == "JPEG Saturation") return pslr_set_jpeg_saturation(theHandle, s.asInt());
-    if (p == "JPEG Hue")        return pslr_set_jpeg_hue(theHandle, s.asInt());
+    case PARAM_JPEG_SHARPNESS:  return pslr_set_jpeg_sharpness(theHandle, s.asInt());
+    case PARAM_JPEG_CONTRAST:   return pslr_set_jpeg_contrast(theHandle, s.asInt());
+    case PARAM_JPEG_SATURATION: return pslr_set_jpeg_saturation(theHandle, s.asInt());
+    case PARAM_JPEG_HUE:        return pslr_set_jpeg_hue(theHandle, s.asInt());
+    }
     return -1;
 }
 
 void Camera::applyChanges()
 {
-    LOCK_MUTEX;
-    for (std::map<Parameter, String>::const_iterator it = requestedStringChanges.begin();
-	it != requestedStringChanges.end();
-	++it)
-	sendChange(it->first, it->second);
-    requestedStringChanges.clear();
-    UNLOCK_MUTEX;
+    Stop stops[STOP_PARAMETER_COUNT];
+    int strings[STRING_PARAMETER_COUNT];
+    uint32_t pendingStops, pendingStrings;
+
+    // take the requests first, so setters do not wait for the camera
+    LOCK_MUTEX(theRequestMutex);
+    pendingStops = thePendingStops;
+    pendingStrings = thePendingStrings;
+    for (int i = 0; i < STOP_PARAMETER_COUNT; i++)
+	stops[i] = theRequestedStops[i];
+    for (int i = 0; i < STRING_PARAMETER_COUNT; i++)
+	strings[i] = theRequestedStrings[i];
+    thePendingStops = 0;
+    thePendingStrings = 0;
+    UNLOCK_MUTEX(theRequestMutex);
+
+    LOCK_MUTEX(theUsbMutex);
+    if (pendingStops || pendingStrings)
+	pslr_watch_kick(theWatch);
+    for (int i = 0; i < STRING_PARAMETER_COUNT; i++)
+	if (pendingStrings & (1u << i))
+	    sendStringChange(i, strings[i]);
+    for (int i = 0; i < STOP_PARAMETER_COUNT; i++)
+	if (pendingStops & (1u << i))
+	    sendStopChange(i, stops[i]);
+    UNLOCK_MUTEX(theUsbMutex);
+}
+
+struct timespec timeAfter(long ms)
+{
+    struct timeval now;
+    struct timespec ts;
+    gettimeofday(&now, NULL);
+    long long ns = (now.tv_usec + 1000LL * ms) * 1000LL;
+    ts.tv_sec = now.tv_sec + ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    return ts;
+}
+
+/* Waits with theRequestMutex held until changes newer than 'seen' are
+ * requested, or 'ms' passed. Edits following each other within
+ * COALESCE_MS (a turning dial) are collected into one batch. */
+void waitForChanges(unsigned long seen, long ms)
+{
+    struct timespec deadline = timeAfter(ms);
+    while (!theUpdateThreadExitFlag && theChangeCount == seen)
+    {
+	if (pthread_cond_timedwait(&theUpdateCondition, &theRequestMutex, &deadline) == ETIMEDOUT)
+	    return;
+    }
+    struct timespec last = timeAfter(COALESCE_MAX_MS);
+    while (!theUpdateThreadExitFlag)
+    {
+	seen = theChangeCount;
+	deadline = timeAfter(COALESCE_MS);
+	if (deadline.tv_sec > last.tv_sec || (deadline.tv_sec == last.tv_sec && deadline.tv_nsec > last.tv_nsec))
+	    deadline = last;
+	while (!theUpdateThreadExitFlag && theChangeCount == seen)
+	{
+	    if (pthread_cond_timedwait(&theUpdateCondition, &theRequestMutex, &deadline) == ETIMEDOUT)
+		return;
+	}
+    }
+}
 
-    LOCK_MUTEX;
-    for (std::map<Parameter, Stop>::const_iterator it = requestedStopChanges.begin();
-	it != requestedStopChanges.end();
-	++it)
-	sendChange(it->first, it->second);
-    requestedStopChanges.clear();
-    UNLOCK_MUTEX;
+/* Time until the next status refresh: short after user actions and
+ * changes, longer when idle, at most 't' ms */
+static long nextUpdateMs(long t)
+{
+    LOCK_MUTEX(theUsbMutex);
+    long ms = pslr_watch_next_ms(theWatch);
+    UNLOCK_MUTEX(theUsbMutex);
+    return ms < t ? ms : t;
+}
+
+/* A shot or focus: refresh the status fast for a while, starting now */
+static void kickUpdates()
+{
+    LOCK_MUTEX(theUsbMutex);
+    pslr_watch_kick(theWatch);
+    UNLOCK_MUTEX(theUsbMutex);
+    LOCK_MUTEX(theRequestMutex);
+    theChangeCount++;
+    pthread_cond_signal(&theUpdateCondition);
+    UNLOCK_MUTEX(theRequestMutex);
 }
 
+/* Applies requested changes as soon as they arrive, and refreshes the
+ * status when the watch wants it, at least every 't' ms */
 void * updateLoop(void * ms)
 {
     long t = (long)ms;
-    while (true)
+    LOCK_MUTEX(theRequestMutex);
+    while (!theUpdateThreadExitFlag)
     {
+	unsigned long seen = theChangeCount;
+	UNLOCK_MUTEX(theRequestMutex);
 	theCamera->applyChanges();
 	theCamera->updateValues();
-	LOCK_MUTEX;
-	if (theUpdateThreadExitFlag)
-	{
-	    theUpdateThreadRunning = false;
-	    UNLOCK_MUTEX;
-	    break;
-	}
-	UNLOCK_MUTEX;
-	usleep(1000 * t);
+	long wait = nextUpdateMs(t);
+	LOCK_MUTEX(theRequestMutex);
+	waitForChanges(seen, wait);
     }
+    theUpdateThreadRunning = false;
+    UNLOCK_MUTEX(theRequestMutex);
     pthread_exit(NULL);
 }
 
@@ -732,9 +1131,10 @@ void Camera::startUpdating(long ms)
 
 void Camera::stopUpdating()
 {
-    LOCK_MUTEX;
+    LOCK_MUTEX(theRequestMutex);
     theUpdateThreadExitFlag = true;
-    UNLOCK_MUTEX;
+    pthread_cond_signal(&theUpdateCondition);
+    UNLOCK_MUTEX(theRequestMutex);
 }
 
 bool Camera::setFileDestination(std::string path)
@@ -745,9 +1145,9 @@ bool Camera::setFileDestination(std::string path)
     stat(path.c_str(), &status);
     if (!S_ISDIR(status.st_mode))
 	return false;
-    LOCK_MUTEX;
+    LOCK_MUTEX(theRequestMutex);
     this->path = path;
-    UNLOCK_MUTEX;
+    UNLOCK_MUTEX(theRequestMutex);
     return true;
 }
 
@@ -776,92 +1176,673 @@ std::string Camera::getFilename()
     return filename.str();
 }
 
-bool Camera::saveBuffer(const std::string & filename)
+// with theUsbMutex held
+pslr_buffer_type imageBufferType()
+{
+    if (theCamera->getString("Image Format") == "RAW")
+	return PSLR_BUF_DNG;
+    return pslr_get_jpeg_buffer_type(theHandle, theStatus.jpeg_quality);
+}
+
+/* Downloads buffer 0 into filename, with theUsbMutex held. Returns a
+ * PSLR error code, the file is removed if the download failed. */
+int downloadBuffer(const std::string & filename, CameraListener * listener, int job)
 {
     std::ofstream output;
     unsigned char buf[65536];
     int bytes;
 
-    std::string imgFormat = getString("Image Format");
-
-    LOCK_MUTEX;
     DPRINT("Writing to %s.", filename.c_str());
-    if (pslr_buffer_open(
-	theHandle, 0,
-	imgFormat == "RAW" ?
-	PSLR_BUF_DNG : pslr_get_jpeg_buffer_type(theHandle, theStatus.jpeg_quality),
-	theStatus.jpeg_resolution)
-	!= PSLR_OK)
+    int result = pslr_buffer_open(theHandle, 0, imageBufferType(), theStatus.jpeg_resolution);
+    if (result != PSLR_OK)
     {
 	DPRINT("Failed to open camera buffer.");
-	UNLOCK_MUTEX;
-	return false;
+	pslr_buffer_close(theHandle);
+	return result;
     }
-    DPRINT("Buffer length: %d.", pslr_buffer_get_size(theHandle));
+    uint32_t size = pslr_buffer_get_size(theHandle);
+    DPRINT("Buffer length: %d.", size);
     
     output.open(filename.c_str());
     
     do {
         bytes = pslr_buffer_read(theHandle, buf, sizeof (buf));
         output.write((char *)buf, bytes);
+        if (listener && bytes)
+            listener->onProgress(job, pslr_buffer_get_offset(theHandle), size);
     } while (bytes);
+    result = pslr_buffer_get_result(theHandle);
     pslr_buffer_close(theHandle);
 
     output.close();
-    UNLOCK_MUTEX;
 
+    if (result != PSLR_OK)
+    {
+	DPRINT("Download stopped: %d.", result);
+	std::remove(filename.c_str());
+    }
+    return result;
+}
+
+bool Camera::saveBuffer(const std::string & filename, CameraListener * listener, int job)
+{
+    LOCK_MUTEX(theUsbMutex);
+    int result = downloadBuffer(filename, listener, job);
+    UNLOCK_MUTEX(theUsbMutex);
+
+    if (result != PSLR_OK)
+	return false;
     lastFilename = filename;
     return true;
 }
 
+/* Released ImageBuffers, given back to the pool the next time the USB
+ * lock is taken; guarded by theRequestMutex so release() never waits
+ * for a running download */
+static std::vector<unsigned char *> theReleasedImages;
+
+ImageBuffer::ImageBuffer() : data(NULL), size(0)
+{
+}
+
+bool ImageBuffer::isValid() const
+{
+    return data != NULL;
+}
+
+int ImageBuffer::getSize() const
+{
+    return size;
+}
+
+DirectBytes ImageBuffer::getBytes() const
+{
+    DirectBytes bytes;
+    bytes.data = data;
+    bytes.size = size;
+    return bytes;
+}
+
+void ImageBuffer::release()
+{
+    if (!data)
+	return;
+    LOCK_MUTEX(theRequestMutex);
+    theReleasedImages.push_back(data);
+    UNLOCK_MUTEX(theRequestMutex);
+    data = NULL;
+    size = 0;
+}
+
+// with theUsbMutex held
+void recycleReleasedImages()
+{
+    std::vector<unsigned char *> released;
+    LOCK_MUTEX(theRequestMutex);
+    released.swap(theReleasedImages);
+    UNLOCK_MUTEX(theRequestMutex);
+    for (size_t i = 0; i < released.size(); i++)
+	pslr_buffer_release(theHandle, released[i]);
+}
+
+// with theUsbMutex held
+int downloadImage(int buffer, pslr_buffer_type type, int resolution, ImageBuffer & image)
+{
+    uint8_t * data;
+    uint32_t size;
+    recycleReleasedImages();
+    int ret = pslr_get_buffer_pooled(theHandle, buffer, type, resolution, &data, &size);
+    if (ret != PSLR_OK)
+    {
+	DPRINT("Failed to download buffer %d: %d.", buffer, ret);
+	return ret;
+    }
+    image.data = data;
+    image.size = size;
+    return PSLR_OK;
+}
+
+ImageBuffer Camera::getThumbnail(int buffer)
+{
+    ImageBuffer image;
+    LOCK_MUTEX(theUsbMutex);
+    downloadImage(buffer, PSLR_BUF_THUMBNAIL, 4, image);
+    UNLOCK_MUTEX(theUsbMutex);
+    return image;
+}
+
+ImageBuffer Camera::getPreview(int buffer)
+{
+    ImageBuffer image;
+    LOCK_MUTEX(theUsbMutex);
+    downloadImage(buffer, PSLR_BUF_PREVIEW, 4, image);
+    UNLOCK_MUTEX(theUsbMutex);
+    return image;
+}
+
+ImageBuffer Camera::getImage(int buffer)
+{
+    ImageBuffer image;
+    LOCK_MUTEX(theUsbMutex);
+    downloadImage(buffer, imageBufferType(), theStatus.jpeg_resolution, image);
+    UNLOCK_MUTEX(theUsbMutex);
+    return image;
+}
+
+ImageBuffer Camera::shootToMemory()
+{
+    ImageBuffer image;
+    cancelRequested = false;
+    LOCK_MUTEX(theUsbMutex);
+    int ret = pslr_shutter(theHandle);
+    // the camera needs some time to process a new picture
+    while (ret == PSLR_OK
+	&& downloadImage(0, imageBufferType(), theStatus.jpeg_resolution, image) != PSLR_OK)
+    {
+	if (cancelRequested)
+	{
+	    DPRINT("Download cancelled.");
+	    break;
+	}
+	UNLOCK_MUTEX(theUsbMutex);
+	usleep(10000);
+	LOCK_MUTEX(theUsbMutex);
+    }
+    if (image.isValid())
+	pslr_delete_buffer(theHandle, 0);
+    UNLOCK_MUTEX(theUsbMutex);
+    if (ret == PSLR_OK)
+	kickUpdates();
+    return image;
+}
+
 void Camera::deleteBuffer()
 {
-    LOCK_MUTEX;
+    LOCK_MUTEX(theUsbMutex);
     pslr_delete_buffer(theHandle, 0);
-    UNLOCK_MUTEX;
+    UNLOCK_MUTEX(theUsbMutex);
 }
 
 void Camera::focus()
 {
-    LOCK_MUTEX;
+    LOCK_MUTEX(theUsbMutex);
     pslr_focus(theHandle);
-    UNLOCK_MUTEX;
+    UNLOCK_MUTEX(theUsbMutex);
+    kickUpdates();
     DPRINT("Focused.");
 }
 
+void Camera::cancelDownload()
+{
+    // no locking, saveBuffer() holds theUsbMutex for the whole download
+    cancelRequested = true;
+    pslr_buffer_cancel(theHandle);
+}
+
 std::string Camera::shoot()
 {
-    if (pslr_shutter(theHandle) != PSLR_OK)
+    return shoot(NULL, 0);
+}
+
+std::string Camera::shoot(CameraListener * listener, int job)
+{
+    cancelRequested = false;
+    LOCK_MUTEX(theUsbMutex);
+    int ret = pslr_shutter(theHandle);
+    UNLOCK_MUTEX(theUsbMutex);
+    if (ret != PSLR_OK)
     {
 	DPRINT("Did not shoot.");
 	return "";
     };
+    kickUpdates();
     std::string fn = getFilename();
-    while (!saveBuffer(fn))
+    while (!saveBuffer(fn, listener, job))
+    {
+	if (cancelRequested)
+	{
+	    DPRINT("Download cancelled.");
+	    return "";
+	}
 	usleep(10000);
+    }
     deleteBuffer();
     DPRINT("Shot.");
     return lastFilename;
 }
 
+void CaptureProgram::setStop(const std::string & parameter, const Stop & value)
+{
+    ProgramStep step;
+    step.type = ProgramStep::SET_STOP;
+    step.parameter = parameter;
+    step.stop = value;
+    steps.push_back(step);
+}
+
+void CaptureProgram::setString(const std::string & parameter, const std::string & value)
+{
+    ProgramStep step;
+    step.type = ProgramStep::SET_STRING;
+    step.parameter = parameter;
+    step.text = value;
+    steps.push_back(step);
+}
+
+void CaptureProgram::focus()
+{
+    ProgramStep step;
+    step.type = ProgramStep::FOCUS;
+    steps.push_back(step);
+}
+
+void CaptureProgram::shoot()
+{
+    ProgramStep step;
+    step.type = ProgramStep::SHOOT;
+    steps.push_back(step);
+}
+
+void CaptureProgram::delay(long ms)
+{
+    ProgramStep step;
+    step.type = ProgramStep::DELAY;
+    step.ms = ms;
+    steps.push_back(step);
+}
+
+void CaptureProgram::download(const std::string & filename)
+{
+    ProgramStep step;
+    step.type = ProgramStep::DOWNLOAD;
+    step.text = filename;
+    steps.push_back(step);
+}
+
+void CaptureProgram::deleteBuffer()
+{
+    ProgramStep step;
+    step.type = ProgramStep::DELETE_BUFFER;
+    steps.push_back(step);
+}
+
+int CaptureProgram::getStepCount() const
+{
+    return steps.size();
+}
+
+void CaptureProgram::clear()
+{
+    steps.clear();
+}
+
+ProgramResult::ProgramResult() : programSteps(0)
+{
+}
+
+std::string ProgramResult::getError() const
+{
+    return error;
+}
+
+int ProgramResult::getStepCount() const
+{
+    return status.size();
+}
+
+int ProgramResult::getStatus(int step) const
+{
+    return step >= 0 && step < (int)status.size() ? status[step] : -1;
+}
+
+long ProgramResult::getMicroseconds(int step) const
+{
+    return step >= 0 && step < (int)microseconds.size() ? microseconds[step] : 0;
+}
+
+std::string ProgramResult::getFilename(int step) const
+{
+    return step >= 0 && step < (int)filenames.size() ? filenames[step] : "";
+}
+
+bool ProgramResult::succeeded() const
+{
+    return error.empty() && (int)status.size() == programSteps
+	&& (status.empty() || status.back() == PSLR_OK);
+}
+
+std::string Camera::validateProgram(const CaptureProgram & program) const
+{
+    for (size_t n = 0; n < program.steps.size(); n++)
+    {
+	const ProgramStep & step = program.steps[n];
+	std::stringstream error;
+	error << "step " << n + 1 << ": ";
+	if (step.type == ProgramStep::SET_STOP)
+	{
+	    int i = findStopParameter(step.parameter);
+	    if (i < 0)
+		return error.str() + "unknown parameter " + step.parameter;
+	    if (step.stop == Stop::AUTO && hasExposureOptions(i))
+		continue;
+	    int min = StopTable::sixthsOf(getMinimumById(i));
+	    int max = StopTable::sixthsOf(getMaximumById(i));
+	    int v = StopTable::sixthsOf(step.stop);
+	    if (min < max && (v < min || v > max))
+		return error.str() + step.parameter + " is out of range";
+	}
+	else if (step.type == ProgramStep::SET_STRING)
+	{
+	    int i = findStringParameter(step.parameter);
+	    if (i < 0 || !STRING_PARAMETERS[i].setter)
+		return error.str() + "cannot set " + step.parameter;
+	    if (getIndexOfOption(STRING_PARAMETERS[i], step.text) < 0)
+		return error.str() + step.text + " is not an option of " + step.parameter;
+	}
+	else if (step.type == ProgramStep::DELAY && step.ms < 0)
+	    return error.str() + "negative delay";
+    }
+    return "";
+}
+
+enum JobType
+{
+    JOB_SHOOT,
+    JOB_FOCUS,
+    JOB_APPLY_CHANGES,
+    JOB_PROGRAM
+};
+
+struct Job
+{
+    int id;
+    JobType type;
+    CameraListener * listener;
+    const CaptureProgram * program;     // JOB_PROGRAM, owned by the job unless result is set
+    ProgramResult * result;             // of a blocking runProgram()
+};
+
+/* Asynchronous calls, run by one I/O thread in queue order. The queue
+ * and the results are guarded by theRequestMutex; the jobs themselves
+ * take theUsbMutex like the blocking calls do. */
+static pthread_t theJobThread;
+static bool theJobThreadRunning = false, theJobThreadExitFlag = false;
+static pthread_cond_t theJobCondition = PTHREAD_COND_INITIALIZER;
+static std::list<Job> theJobs;
+static int theLastJob = 0;
+static int theLastFinishedJob = 0;
+static std::map<int, std::string> theJobResults; // of jobs without listener, not waited for yet
+
+struct CameraJobs
+{
+    static std::string run(const Job & job)
+    {
+	switch (job.type)
+	{
+	case JOB_SHOOT:
+	    return theCamera->shoot(job.listener, job.id);
+	case JOB_FOCUS:
+	    theCamera->focus();
+	    break;
+	case JOB_APPLY_CHANGES:
+	    theCamera->applyChanges();
+	    theCamera->updateValues();
+	    break;
+	case JOB_PROGRAM:
+	    return runProgram(job);
+	}
+	return "";
+    }
+
+    // with theUsbMutex held
+    static int runStep(const ProgramStep & step, const Job & job, std::string & filename)
+    {
+	int ret;
+	switch (step.type)
+	{
+	case ProgramStep::SET_STOP:
+	    return sendStopChange(findStopParameter(step.parameter), step.stop);
+	case ProgramStep::SET_STRING:
+	{
+	    int i = findStringParameter(step.parameter);
+	    return sendStringChange(i, getIndexOfOption(STRING_PARAMETERS[i], step.text));
+	}
+	case ProgramStep::FOCUS:
+	    return pslr_focus(theHandle);
+	case ProgramStep::SHOOT:
+	    return pslr_shutter(theHandle);
+	case ProgramStep::DELAY:
+	    usleep(1000 * step.ms);
+	    return PSLR_OK;
+	case ProgramStep::DOWNLOAD:
+	    filename = step.text.empty() ? theCamera->getFilename() : step.text;
+	    // the camera needs some time to process a new picture
+	    for (int tries = 0; (ret = downloadBuffer(filename, job.listener, job.id)) != PSLR_OK; tries++)
+	    {
+		if (theCamera->cancelRequested)
+		    return PSLR_CANCELLED;
+		if (tries == PROGRAM_DOWNLOAD_TRIES)
+		    return ret;
+		usleep(10000);
+	    }
+	    theCamera->lastFilename = filename;
+	    return PSLR_OK;
+	case ProgramStep::DELETE_BUFFER:
+	    return pslr_delete_buffer(theHandle, 0);
+	}
+	return -1;
+    }
+
+    static std::string runProgram(const Job & job)
+    {
+	ProgramResult & r = *job.result;
+	const std::vector<ProgramStep> & steps = job.program->steps;
+	std::string last;
+
+	r.programSteps = steps.size();
+	r.error = theCamera->validateProgram(*job.program);
+	if (!r.error.empty())
+	{
+	    DPRINT("Program rejected: %s.", r.error.c_str());
+	    return "";
+	}
+	theCamera->cancelRequested = false;
+	LOCK_MUTEX(theUsbMutex);
+	for (size_t i = 0; i < steps.size(); i++)
+	{
+	    struct timeval t1, t2;
+	    std::string filename;
+	    gettimeofday(&t1, NULL);
+	    int ret = runStep(steps[i], job, filename);
+	    gettimeofday(&t2, NULL);
+	    r.status.push_back(ret);
+	    r.microseconds.push_back((t2.tv_sec - t1.tv_sec) * 1000000L + (t2.tv_usec - t1.tv_usec));
+	    r.filenames.push_back(filename);
+	    if (ret != PSLR_OK)
+	    {
+		DPRINT("Program step %d failed: %d.", (int)i + 1, ret);
+		break;
+	    }
+	    if (!filename.empty())
+		last = filename;
+	}
+	UNLOCK_MUTEX(theUsbMutex);
+	theCamera->updateValues();
+	return last;
+    }
+
+    static void * loop(void *)
+    {
+	LOCK_MUTEX(theRequestMutex);
+	while (true)
+	{
+	    while (theJobs.empty() && !theJobThreadExitFlag)
+		pthread_cond_wait(&theJobCondition, &theRequestMutex);
+	    if (theJobs.empty())
+		break;
+	    Job job = theJobs.front();
+	    theJobs.pop_front();
+	    UNLOCK_MUTEX(theRequestMutex);
+
+	    bool ownsResult = job.type == JOB_PROGRAM && !job.result;
+	    if (ownsResult)
+		job.result = new ProgramResult();
+	    std::string result = run(job);
+	    if (job.listener && job.type == JOB_PROGRAM)
+		job.listener->onProgramDone(job.id, *job.result);
+	    if (job.listener)
+		job.listener->onDone(job.id, result);
+	    if (ownsResult)
+	    {
+		delete job.result;
+		delete job.program;
+	    }
+
+	    LOCK_MUTEX(theRequestMutex);
+	    // a listener got its result already; results nobody waits
+	    // for are dropped once there are too many
+	    if (!job.listener)
+	    {
+		theJobResults[job.id] = result;
+		while (theJobResults.size() > MAX_JOB_RESULTS)
+		    theJobResults.erase(theJobResults.begin());
+	    }
+	    theLastFinishedJob = job.id;
+	    pthread_cond_broadcast(&theJobCondition);
+	}
+	UNLOCK_MUTEX(theRequestMutex);
+	return NULL;
+    }
+
+    static int queue(JobType type, CameraListener * listener,
+	const CaptureProgram * program = NULL, ProgramResult * result = NULL)
+    {
+	LOCK_MUTEX(theRequestMutex);
+	if (!theJobThreadRunning)
+	{
+	    theJobThreadExitFlag = false;
+	    theJobThreadRunning = pthread_create(&theJobThread, NULL, loop, NULL) == 0;
+	    if (!theJobThreadRunning)
+	    {
+		UNLOCK_MUTEX(theRequestMutex);
+		return -1;
+	    }
+	}
+	Job job;
+	job.id = ++theLastJob;
+	job.type = type;
+	job.listener = listener;
+	job.program = program;
+	job.result = result;
+	theJobs.push_back(job);
+	pthread_cond_broadcast(&theJobCondition);
+	UNLOCK_MUTEX(theRequestMutex);
+	return job.id;
+    }
+
+    static void stop()
+    {
+	LOCK_MUTEX(theRequestMutex);
+	bool running = theJobThreadRunning;
+	theJobThreadExitFlag = true;
+	pthread_cond_broadcast(&theJobCondition);
+	UNLOCK_MUTEX(theRequestMutex);
+	if (running)
+	    pthread_join(theJobThread, NULL);
+	theJobThreadRunning = false;
+	LOCK_MUTEX(theRequestMutex);
+	theJobResults.clear();
+	UNLOCK_MUTEX(theRequestMutex);
+    }
+};
+
+int Camera::shootAsync(CameraListener * listener)
+{
+    return CameraJobs::queue(JOB_SHOOT, listener);
+}
+
+int Camera::focusAsync(CameraListener * listener)
+{
+    return CameraJobs::queue(JOB_FOCUS, listener);
+}
+
+int Camera::applyChangesAsync(CameraListener * listener)
+{
+    return CameraJobs::queue(JOB_APPLY_CHANGES, listener);
+}
+
+ProgramResult Camera::runProgram(const CaptureProgram & program)
+{
+    ProgramResult result;
+    int job = CameraJobs::queue(JOB_PROGRAM, NULL, &program, &result);
+    if (job < 0)
+	result.error = "cannot start the camera thread";
+    else
+	waitFor(job);
+    return result;
+}
+
+int Camera::runProgramAsync(const CaptureProgram & program, CameraListener * listener)
+{
+    CaptureProgram * copy = new CaptureProgram(program);
+    int job = CameraJobs::queue(JOB_PROGRAM, listener, copy);
+    if (job < 0)
+	delete copy;
+    return job;
+}
+
+bool Camera::isDone(int job) const
+{
+    LOCK_MUTEX(theRequestMutex);
+    bool done = job <= theLastFinishedJob;
+    UNLOCK_MUTEX(theRequestMutex);
+    return done;
+}
+
+std::string Camera::waitFor(int job)
+{
+    LOCK_MUTEX(theRequestMutex);
+    while (job > theLastFinishedJob && job <= theLastJob)
+	pthread_cond_wait(&theJobCondition, &theRequestMutex);
+    std::string result;
+    std::map<int, std::string>::iterator it = theJobResults.find(job);
+    if (it != theJobResults.end())
+    {
+	result = it->second;
+	theJobResults.erase(it);
+    }
+    UNLOCK_MUTEX(theRequestMutex);
+    return result;
+}
+
 std::string Camera::getStatusInformation() const
 {
-    return collect_status_info(theHandle, theStatus);
+    return collect_status_info(theHandle, readSnapshot().status);
 }
 
 Camera::Camera()
 {
-    pslr_connect(theHandle);
+    pslr_connect_fast(theHandle);
     path = getpwuid(getuid())->pw_dir;
     imageNumber = 0;
+    cancelRequested = false;
+    theWatch = pslr_get_watch(theHandle);
+    pslr_watch_subscribe(theWatch, PSLR_WATCH_ALL, 0, statusChanged, NULL);
+    computeLimits();
     updateValues();
 }
 
 Camera::~Camera()
 {
+    CameraJobs::stop();
     pthread_join(theUpdateThread, NULL);
+    // give the released images back before the pool is freed
+    LOCK_MUTEX(theUsbMutex);
+    recycleReleasedImages();
+    UNLOCK_MUTEX(theUsbMutex);
     pslr_disconnect(theHandle);
     pslr_shutdown(theHandle);
+    theWatch = NULL;
     theCamera = NULL;
     pthread_exit(NULL);
 }
@@ -4,12 +4,22 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
 
 #ifdef SWIG
-    %module pentax
+    %module(directors="1") pentax
     %include "std_string.i"
+    %feature("director") CameraListener;
     #ifdef SWIGJAVA
         %javaconst(1);
+        // ImageBuffer memory as a direct java.nio.ByteBuffer, no copy
+        %typemap(jni) DirectBytes "jobject"
+        %typemap(jtype) DirectBytes "java.nio.ByteBuffer"
+        %typemap(jstype) DirectBytes "java.nio.ByteBuffer"
+        %typemap(javaout) DirectBytes { return $jnicall; }
+        %typemap(out) DirectBytes {
+            $result = $1.data ? jenv->NewDirectByteBuffer($1.data, $1.size) : NULL;
+        }
     #endif
     %header %{
         #include "pentax.h"
@@ -66,10 +76,112 @@ public:
     static const Stop HALF;
     static const Stop THIRD;
 protected:
+    friend struct StopTable;
     static Stop fromSixthStops(int);
     int sixthStops;
 };
 
+#ifndef SWIG
+struct ProgramStep
+{
+    enum Type { SET_STOP, SET_STRING, FOCUS, SHOOT, DELAY, DOWNLOAD, DELETE_BUFFER };
+    Type type;
+    std::string parameter;
+    Stop stop;
+    std::string text;   // value of SET_STRING, file name of DOWNLOAD
+    long ms;
+};
+#endif
+
+/** A capture recipe: settings, focus, shots, delays and downloads that
+ * Camera::runProgram() runs in one go.
+ */
+class CaptureProgram
+{
+public:
+    void setStop(const std::string & parameter, const Stop & value);
+    void setString(const std::string & parameter, const std::string & value);
+    void focus();
+    void shoot();
+    void delay(long ms);
+    /** Downloads the last picture, to an automatic file name if empty. */
+    void download(const std::string & filename = "");
+    void deleteBuffer();
+    int getStepCount() const;
+    void clear();
+#ifndef SWIG
+    std::vector<ProgramStep> steps;
+#endif
+};
+
+/** What a CaptureProgram did, step by step. A failing step ends the
+ * program, so there can be fewer steps than in the program.
+ */
+class ProgramResult
+{
+public:
+    ProgramResult();
+    /** Why the program was rejected before running, empty if valid. */
+    std::string getError() const;
+    int getStepCount() const;
+    /** 0 on success, a PSLR error code otherwise. */
+    int getStatus(int step) const;
+    long getMicroseconds(int step) const;
+    /** File written by a download step. */
+    std::string getFilename(int step) const;
+    bool succeeded() const;
+#ifndef SWIG
+    std::string error;
+    int programSteps;
+    std::vector<int> status;
+    std::vector<long> microseconds;
+    std::vector<std::string> filenames;
+#endif
+};
+
+struct DirectBytes
+{
+    void * data;
+    long long size;
+};
+
+/** Picture data downloaded into memory from the buffer pool of the
+ * camera handle. The memory stays valid until release() is called;
+ * copies share it, so release only one of them.
+ */
+class ImageBuffer
+{
+public:
+    ImageBuffer();
+    bool isValid() const;
+    int getSize() const;
+    /** The data without copying it; a direct ByteBuffer in Java. */
+    DirectBytes getBytes() const;
+    /** Gives the memory back to the pool, may be called from any thread. */
+    void release();
+#ifndef SWIG
+    unsigned char * data;
+    unsigned int size;
+#endif
+};
+
+/** Receives the results of the asynchronous Camera calls. Subclass it
+ * and override what is needed; the methods are called on the camera
+ * I/O thread.
+ */
+class CameraListener
+{
+public:
+    virtual ~CameraListener() {}
+    /** Download progress of a shootAsync() job. */
+    virtual void onProgress(int job, int bytes, int total) {}
+    /** The job finished. The result is the file name of a shot, and
+     * empty if the shot failed or for the other jobs. */
+    virtual void onDone(int job, const std::string & result) {}
+    /** A runProgramAsync() job finished, called before onDone(). */
+    virtual void onProgramDone(int job, const ProgramResult & result) {}
+};
+
 /** Singleton class representing the camera connected.
  * Get the only instance of this class calling the camera() method.
  */
@@ -106,15 +218,47 @@ public:
 
     void focus();
     std::string shoot();
-protected:
-    std::map<Parameter, Stop> requestedStopChanges;
-    std::map<Parameter, String> requestedStringChanges;
-    std::map<Parameter, Stop> currentStopValues;
-    std::map<Parameter, String> currentStringValues;
+    /** Stops the download of a running shoot() at the next block, may be
+     * called from any thread. The picture is kept in the camera. */
+    void cancelDownload();
+
+    /** These queue the call on the camera I/O thread and return a job
+     * number at once. Jobs run one after the other in the order they
+     * were queued, so the next shot can be queued while the previous
+     * one downloads. A listener has to stay valid until its onDone()
+     * was called.
+     */
+    int shootAsync(CameraListener * listener = NULL);
+    int focusAsync(CameraListener * listener = NULL);
+    int applyChangesAsync(CameraListener * listener = NULL);
+    bool isDone(int job) const;
+    /** Blocks until the job finished and returns its result. Only jobs
+     * queued without a listener keep their result for waitFor(), and
+     * only the last 64 of those not waited for yet. */
+    std::string waitFor(int job);
 
+    /** Checks a program against the limits of the camera and the lens.
+     * Returns an error message, or an empty string if it can run. */
+    std::string validateProgram(const CaptureProgram & program) const;
+    /** Runs a valid program on the camera I/O thread, without other
+     * camera I/O between its steps, and waits for the result. */
+    ProgramResult runProgram(const CaptureProgram & program);
+    /** Queues a program like the other jobs; waitFor() returns the file
+     * of its last download. */
+    int runProgramAsync(const CaptureProgram & program, CameraListener * listener = NULL);
+
+    /** Download a picture kept in the camera into memory instead of a
+     * file. The result is invalid if the download failed. */
+    ImageBuffer getThumbnail(int buffer = 0);
+    ImageBuffer getPreview(int buffer = 0);
+    ImageBuffer getImage(int buffer = 0);
+    /** Like shoot(), but returns the picture in memory. */
+    ImageBuffer shootToMemory();
+protected:
     std::string path;
     std::string lastFilename;
     int imageNumber;
+    volatile bool cancelRequested;
 
 public:
     static const std::string API_VERSION;
@@ -125,7 +269,9 @@ public:
 protected:
     Camera();
     friend const Camera * camera();
-    bool saveBuffer(const std::string & filename);
+    friend struct CameraJobs;
+    std::string shoot(CameraListener * listener, int job);
+    bool saveBuffer(const std::string & filename, CameraListener * listener = NULL, int job = 0);
     void deleteBuffer();
     std::string getFileExtension();
 };
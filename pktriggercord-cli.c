@@ -38,8 +38,20 @@
 #include <stdarg.h>
 #include <math.h>
 #include <sys/time.h>
+#include <signal.h>
 
 #include "pslr.h"
+#include "pslr_raw.h"
+#include "pslr_ramp.h"
+#include "pslr_bracket.h"
+#include "pslr_fusion.h"
+#include "pslr_sharpness.h"
+#include "pslr_histogram.h"
+
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
 
 #ifdef WIN32
 #define FILE_ACCESS O_WRONLY | O_CREAT | O_TRUNC | O_BINARY
@@ -90,10 +102,27 @@ static struct option const longopts[] ={
     {"device", required_argument, NULL, 18},
     {"reconnect", no_argument, NULL, 19},
     {"timeout", required_argument, NULL, 20},
+    {"trace", required_argument, NULL, 21},
+    {"metrics", no_argument, NULL, 22},
+    {"metrics_file", required_argument, NULL, 23},
+    {"raw_stats", no_argument, NULL, 24},
+    {"exposure_ramp", required_argument, NULL, 25},
+    {"exposure_ramp_step", required_argument, NULL, 26},
+    {"bracket", required_argument, NULL, 27},
+    {"fusion", no_argument, NULL, 28},
+    {"sharpness", no_argument, NULL, 29},
     { NULL, 0, NULL, 0}
 };
 
+/* returns 0 on success, 1 if the buffer is not ready yet, -1 if the download failed */
 int save_buffer(pslr_handle_t, int, int, pslr_status*, user_file_format, int);
+int save_file(pslr_handle_t, int, char*, int, pslr_status*, user_file_format, int);
+void init_ramp(pslr_handle_t, pslr_ramp_t*, pslr_status*, int, uint32_t, uint32_t);
+void update_ramp(pslr_handle_t, pslr_ramp_t*);
+int download_picture(pslr_handle_t, int, char*, int, pslr_status*, user_file_format, int, bool);
+int shoot_brackets(pslr_handle_t, pslr_bracket_t*, char*, int, int, pslr_status*, user_file_format, int, bool);
+void preview_check(pslr_handle_t, int, int, uint32_t);
+void fusion_finish(char*, int, int);
 void print_status_info(pslr_handle_t h, pslr_status status);
 void usage(char*);
 void version(char*);
@@ -119,6 +148,26 @@ long int timeval_diff(struct timeval *t2, struct timeval *t1) {
     return (t2->tv_usec + 1000000 * t2->tv_sec) - (t1->tv_usec + 1000000 * t1->tv_sec);
 }
 
+/* EV values are given as decimals or fractions, eg. -2.5 or 1/3 */
+static bool parse_ev(const char *s, double *ev) {
+    int nom, denom;
+    float F;
+    char C;
+
+    if (sscanf(s, "%d/%d%c", &nom, &denom, &C) == 2) {
+        if (denom <= 0) {
+            return false;
+        }
+        *ev = (double) nom / denom;
+        return true;
+    }
+    if (sscanf(s, "%f%c", &F, &C) == 1) {
+        *ev = F;
+        return true;
+    }
+    return false;
+}
+
 
 void warning_message( const char* message, ... ) {
     if( warnings ) {
@@ -145,6 +194,62 @@ void process_wbadj( const char* argv0, const char chr, uint32_t adj, uint32_t *w
     }
 }
 
+static char *trace_file = NULL;
+static bool print_metrics = false;
+static char *metrics_file = NULL;
+static bool raw_stats = false;
+static bool exposure_ramp = false;
+static double ramp_target = 0;
+static double ramp_step = 1.0 / 3;
+
+static bool fusion = false;
+static bool sharpness = false;
+
+// statistics of the last downloaded RAW file
+static pslr_raw_stats_t last_raw_stats;
+static bool last_raw_valid = false;
+static long int last_raw_analysis_us = 0;
+// mean level of the last checked preview, for the ramp without RAW statistics
+static double last_preview_level;
+static bool last_preview_valid = false;
+static long int last_preview_analysis_us = 0;
+static pslr_handle_t exit_handle = NULL;
+
+void save_trace(void) {
+    if (trace_file && exit_handle) {
+        if (pslr_trace_save(pslr_get_trace(exit_handle), trace_file) != 0) {
+            fprintf(stderr, "Could not write trace file %s\n", trace_file);
+        }
+    }
+}
+
+void save_metrics(void) {
+    pslr_metrics_t metrics;
+    if (!exit_handle || pslr_get_metrics(exit_handle, &metrics) != PSLR_OK) {
+        return;
+    }
+    if (print_metrics) {
+        pslr_metrics_print(&metrics, stderr);
+    }
+    if (metrics_file && pslr_metrics_write_prometheus(&metrics, metrics_file) != 0) {
+        fprintf(stderr, "Could not write metrics file %s\n", metrics_file);
+    }
+}
+
+static volatile sig_atomic_t interrupted = 0;
+
+/* Ctrl-C stops a running download at the next block, main() then
+ * closes the buffer and the camera connection cleanly */
+static void sigint_handler(int sig) {
+    if (interrupted || !exit_handle) {
+        signal(sig, SIG_DFL);
+        raise(sig);
+        return;
+    }
+    interrupted = 1;
+    pslr_buffer_cancel(exit_handle);
+}
+
 void camera_close(pslr_handle_t camhandle) {
     pslr_disconnect(camhandle);
     pslr_shutdown(camhandle);
@@ -162,7 +267,7 @@ int main(int argc, char **argv) {
     char *MODESTRING = NULL;
     int resolution = 0;
     int quality = -1;
-    int optc, fd, i;
+    int optc, i, ret;
     int wbadj_ss=0;
     pslr_handle_t camhandle;
     pslr_status status;
@@ -180,6 +285,7 @@ int main(int argc, char **argv) {
     bool auto_focus = false;
     bool green = false;
     bool dust = false;
+    bool raw_plus = false;
     bool status_info = false;
     bool status_hex_info = false;
     pslr_rational_t ec = {0, 0};
@@ -197,6 +303,8 @@ int main(int argc, char **argv) {
     uint32_t adj1;
     uint32_t adj2;
     bool reconnect = false;
+    pslr_bracket_t host_bracket;
+    host_bracket.count = 0;
     struct timeval prev_time;
     struct timeval current_time;
 
@@ -381,6 +489,60 @@ int main(int argc, char **argv) {
                 timeout = atoi(optarg);
                 break;
 
+            case 21:
+                trace_file = optarg;
+                break;
+
+            case 22:
+                print_metrics = true;
+                break;
+
+            case 23:
+                metrics_file = optarg;
+                break;
+
+            case 24:
+                raw_stats = true;
+                break;
+
+            case 25:
+                exposure_ramp = true;
+                if (!parse_ev(optarg, &ramp_target) || ramp_target >= 0) {
+                    warning_message("%s: Invalid exposure ramp target, it is given in EV below saturation (eg. -3)\n", argv[0]);
+                    exposure_ramp = false;
+                }
+                break;
+
+            case 26:
+                if (!parse_ev(optarg, &ramp_step) || ramp_step <= 0) {
+                    warning_message("%s: Invalid exposure ramp step\n", argv[0]);
+                    ramp_step = 1.0 / 3;
+                }
+                break;
+
+            case 28:
+#ifdef HAVE_LIBJPEG
+                fusion = true;
+#else
+                warning_message("%s: Fused previews need libjpeg, this build is without it\n", argv[0]);
+#endif
+                break;
+
+            case 29:
+#ifdef HAVE_LIBJPEG
+                sharpness = true;
+#else
+                warning_message("%s: Sharpness scores need libjpeg, this build is without it\n", argv[0]);
+#endif
+                break;
+
+            case 27:
+                if (pslr_bracket_parse(&host_bracket, optarg) != PSLR_OK) {
+                    warning_message("%s: Invalid bracket, give at most %d EV values separated by commas\n", argv[0], PSLR_BRACKET_MAX);
+                    host_bracket.count = 0;
+                }
+                break;
+
             case 'q':
                 quality  = atoi(optarg);
                 if (!quality) {
@@ -502,7 +664,16 @@ int main(int argc, char **argv) {
 	}
     }
 
-    if (camhandle) pslr_connect(camhandle);
+    exit_handle = camhandle;
+    if (trace_file) {
+        atexit(save_trace);
+    }
+    if (print_metrics || metrics_file) {
+        atexit(save_metrics);
+    }
+    signal(SIGINT, sigint_handler);
+
+    if (camhandle) pslr_connect_fast(camhandle);
 
     camera_name = pslr_camera_name(camhandle);
     printf("%s: %s Connected...\n", argv[0], camera_name);
@@ -554,6 +725,8 @@ int main(int argc, char **argv) {
         if( !pslr_get_model_only_limited( camhandle ) ) {
 	    // use the default of the camera
 	    uff = get_user_file_format( &status );
+	    // in RAW+ mode save the JPEG too, when writing to files
+	    raw_plus = output_file && status.image_format == PSLR_IMAGE_FORMAT_RAW_PLUS;
         } else {
 	    // use PEF, since all the camera supports this
 	    uff = USER_FILE_FORMAT_PEF;
@@ -668,8 +841,44 @@ int main(int argc, char **argv) {
 	exit(0);
     }
 
+    if( host_bracket.count ) {
+        if( status.exposure_mode != PSLR_GUI_EXPOSURE_MODE_M && status.exposure_mode != PSLR_GUI_EXPOSURE_MODE_TV ) {
+            fprintf(stderr, "%s: Bracketing needs M or Tv mode\n", argv[0]);
+            camera_close(camhandle);
+            exit(-1);
+        }
+        if( status.auto_bracket_mode != 0 ) {
+            fprintf(stderr, "%s: Turn off the auto bracketing of the camera for --bracket\n", argv[0]);
+            camera_close(camhandle);
+            exit(-1);
+        }
+        if( exposure_ramp ) {
+            warning_message("%s: Exposure ramping is not available with bracketing, disabled\n", argv[0]);
+            exposure_ramp = false;
+        }
+        pslr_bracket_prepare(&host_bracket, status.current_shutter_speed,
+                             1.0 / pslr_get_model_fastest_shutter_speed(camhandle), 30);
+        ret = shoot_brackets(camhandle, &host_bracket, output_file, frames, delay, &status, uff, quality, raw_plus);
+        camera_close(camhandle);
+        exit(ret != PSLR_OK || interrupted ? -1 : 0);
+    }
+
+    pslr_ramp_t ramp;
+    if( exposure_ramp ) {
+        if( status.exposure_mode != PSLR_GUI_EXPOSURE_MODE_M || !output_file ) {
+            fprintf(stderr, "%s: Exposure ramping needs M mode and an output file, disabled\n", argv[0]);
+            exposure_ramp = false;
+#ifndef HAVE_LIBJPEG
+        } else if( uff == USER_FILE_FORMAT_JPEG ) {
+            fprintf(stderr, "%s: Exposure ramping of JPEG files needs libjpeg, this build is without it\n", argv[0]);
+            exposure_ramp = false;
+#endif
+        } else {
+            init_ramp( camhandle, &ramp, &status, delay, auto_iso_min, auto_iso_max );
+        }
+    }
+
     double waitsec=0;
-    user_file_format_t ufft = *get_file_format_t(uff);
     int bracket_count = status.auto_bracket_picture_count;
     if( bracket_count < 1 || status.auto_bracket_mode == 0 ) {
 	bracket_count = 1;
@@ -683,7 +892,7 @@ int main(int argc, char **argv) {
 	status.drive_mode == PSLR_DRIVE_MODE_CONTINUOUS_LO;
     DPRINT("cont: %d\n", continuous);
 
-    for (frameNo = 0; frameNo < frames; ++frameNo) {
+    for (frameNo = 0; frameNo < frames && !interrupted; ++frameNo) {
 	gettimeofday(&current_time, NULL);
 	if( bracket_count <= bracket_index ) {
 	    if( reconnect ) {
@@ -691,7 +900,8 @@ int main(int argc, char **argv) {
 		while (!(camhandle = pslr_init( model, device ))) {
 		    sleep_sec(1);
 		}
-		pslr_connect(camhandle);
+		pslr_connect_fast(camhandle);
+		exit_handle = camhandle;
 	    }
 	    waitsec = 1.0 * delay - timeval_diff(&current_time, &prev_time) / 1000000.0;
 	    if( waitsec > 0 ) {
@@ -726,21 +936,423 @@ int main(int argc, char **argv) {
 		bracket_count = bracket_index+1;
 	    }
 	    for( buffer_index = 0; buffer_index < bracket_count; ++buffer_index ) {
-		fd = open_file(output_file, frameNo-bracket_count+buffer_index+1, ufft);
-		while( save_buffer(camhandle, buffer_index, fd, &status, uff, quality) ) {
-		    usleep(10000);
-		}
-		pslr_delete_buffer(camhandle, buffer_index);
-		if (fd != 1) {
-		    close(fd);
+		int fileNo = frameNo-bracket_count+buffer_index+1;
+		if( download_picture(camhandle, buffer_index, output_file, fileNo, &status, uff, quality, raw_plus) != 0 ) {
+		    camera_close(camhandle);
+		    exit(-1);
 		}
 	    }
+	    if( fusion ) {
+		fusion_finish(output_file, frameNo-bracket_count+1, frameNo);
+	    }
+	    if( exposure_ramp ) {
+		update_ramp( camhandle, &ramp );
+	    }
 	}
 	++bracket_index;
     }
     camera_close(camhandle);
 
-    exit(0);
+    exit(interrupted ? -1 : 0);
+}
+
+#ifdef HAVE_LIBJPEG
+/* The preview JPEGs of the camera are decoded at a reduced size with
+ * the DCT scaling of libjpeg, so the fusion of a bracket and the
+ * sharpness check take a bounded time */
+#define FUSION_SIZE 640         /* longest side of the decoded previews */
+#define FUSION_QUALITY 85
+
+static uint8_t *fusion_images[PSLR_BRACKET_MAX];
+static int fusion_count = 0;
+static int fusion_width = 0;
+static int fusion_height = 0;
+static long int fusion_us = 0;
+static pslr_sharpness_history_t sharpness_history;
+
+/* The default error handler of libjpeg exits; a broken preview only
+ * skips its frame */
+struct preview_error_mgr {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+static void preview_error_exit(j_common_ptr cinfo) {
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(((struct preview_error_mgr *) cinfo->err)->jump, 1);
+}
+
+static uint8_t *preview_decode(uint8_t *data, uint32_t size, int *width, int *height) {
+    struct jpeg_decompress_struct cinfo;
+    struct preview_error_mgr jerr;
+    uint8_t * volatile image = NULL;
+    JSAMPROW row;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = preview_error_exit;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(image);
+        return NULL;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, size);
+    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    cinfo.out_color_space = JCS_RGB;
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1;
+    while (cinfo.scale_denom < 8 &&
+           (cinfo.image_width > FUSION_SIZE * cinfo.scale_denom || cinfo.image_height > FUSION_SIZE * cinfo.scale_denom)) {
+        cinfo.scale_denom *= 2;
+    }
+    jpeg_start_decompress(&cinfo);
+    image = malloc(cinfo.output_width * cinfo.output_height * 3);
+    while (image && cinfo.output_scanline < cinfo.output_height) {
+        row = image + cinfo.output_scanline * cinfo.output_width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    if (image) {
+        jpeg_finish_decompress(&cinfo);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return image;
+}
+
+static int fusion_write(const char *fileName, uint8_t *image, int width, int height) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    JSAMPROW row;
+    FILE *f;
+
+    f = fopen(fileName, "wb");
+    if (!f) {
+        return -1;
+    }
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, f);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, FUSION_QUALITY, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        row = image + cinfo.next_scanline * width * 3;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(f);
+    return 0;
+}
+
+/* Sharpness score of a picture, soft ones are flagged */
+static void sharpness_print(uint8_t *image, int width, int height, int fileNo, uint32_t af_mask, long int decode_us) {
+    struct timeval t1, t2;
+    pslr_sharpness_t s;
+    float score;
+    bool soft;
+
+    gettimeofday(&t1, NULL);
+    pslr_sharpness_rgb(&s, image, width, height, width * 3);
+    score = pslr_sharpness_score(&s, af_mask);
+    soft = pslr_sharpness_history_add(&sharpness_history, score);
+    gettimeofday(&t2, NULL);
+    printf("Sharpness of picture %d: %.1f (%s, frame %.1f)%s, %.1f ms\n", fileNo, score,
+           af_mask ? "focused AF points" : "no AF point", s.frame, soft ? " SOFT" : "",
+           (decode_us + timeval_diff(&t2, &t1)) / 1000.0);
+}
+
+static void fusion_add(uint8_t *image, int width, int height) {
+    if (fusion_count == PSLR_BRACKET_MAX) {
+        free(image);
+        return;
+    }
+    if (fusion_count && (width != fusion_width || height != fusion_height)) {
+        DPRINT("fusion: preview size %dx%d differs from %dx%d\n", width, height, fusion_width, fusion_height);
+        free(image);
+        return;
+    }
+    fusion_width = width;
+    fusion_height = height;
+    fusion_images[fusion_count++] = image;
+}
+
+/*
+ * Mean level of a preview in EV below white, for ramping JPEG output
+ * and RAW files pslr_raw cannot read (compressed PEF, lossless JPEG
+ * DNG). The luminance histogram is linearized with the sRGB curve; the
+ * tone curve of the camera is ignored, so this approximates the RAW
+ * level.
+ */
+static void preview_level(uint8_t *image, int width, int height) {
+    struct timeval t1, t2;
+    pslr_histogram_t hist;
+    double sum = 0;
+    double v;
+    int i;
+
+    gettimeofday(&t1, NULL);
+    pslr_histogram_rgb(&hist, image, width, height, width * 3);
+    for (i = 0; i < PSLR_HISTOGRAM_BINS; ++i) {
+        v = i / 255.0;
+        v = v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+        sum += v * hist.bins[PSLR_HISTOGRAM_LUMA][i];
+    }
+    // same floor as pslr_raw_stats_mean_ev()
+    last_preview_level = hist.pixels && sum > 0 ? log2(sum / hist.pixels) : -log2(PSLR_HISTOGRAM_BINS);
+    last_preview_valid = true;
+    gettimeofday(&t2, NULL);
+    last_preview_analysis_us += timeval_diff(&t2, &t1);
+}
+
+/* Check the preview of a picture before it is deleted from the camera */
+void preview_check(pslr_handle_t camhandle, int bufno, int fileNo, uint32_t af_mask) {
+    struct timeval t1, t2;
+    uint8_t *data;
+    uint32_t size;
+    uint8_t *image;
+    int width, height;
+    long int decode_us;
+
+    if (pslr_get_buffer_pooled(camhandle, bufno, PSLR_BUF_PREVIEW, 4, &data, &size) != PSLR_OK) {
+        fprintf(stderr, "Could not get the preview of buffer %d\n", bufno);
+        return;
+    }
+    gettimeofday(&t1, NULL);
+    image = preview_decode(data, size, &width, &height);
+    gettimeofday(&t2, NULL);
+    decode_us = timeval_diff(&t2, &t1);
+    pslr_buffer_release(camhandle, data);
+    if (!image) {
+        return;
+    }
+    if (exposure_ramp && !last_raw_valid) {
+        last_preview_analysis_us = decode_us;
+        preview_level(image, width, height);
+    }
+    if (sharpness) {
+        sharpness_print(image, width, height, fileNo, af_mask, decode_us);
+    }
+    if (fusion) {
+        fusion_us += decode_us;
+        fusion_add(image, width, height);
+    } else {
+        free(image);
+    }
+}
+
+/* Fuse the previews of the pictures first..last into OUTPUT-first-last-fused.jpg */
+void fusion_finish(char *output_file, int first, int last) {
+    struct timeval t1, t2;
+    char fileName[256];
+    uint8_t *out;
+    int i;
+
+    if (fusion_count > 1 && output_file) {
+        out = malloc(fusion_width * fusion_height * 3);
+        gettimeofday(&t1, NULL);
+        if (out && pslr_fusion((const uint8_t *const *) fusion_images, fusion_count, fusion_width, fusion_height, out) == PSLR_OK) {
+            snprintf(fileName, 256, "%s-%04d-%04d-fused.jpg", output_file, first, last);
+            if (fusion_write(fileName, out, fusion_width, fusion_height) != 0) {
+                fprintf(stderr, "Could not open %s\n", fileName);
+            } else {
+                gettimeofday(&t2, NULL);
+                fusion_us += timeval_diff(&t2, &t1);
+                printf("Fused %d previews into %s (%dx%d) in %.1f ms\n", fusion_count, fileName,
+                       fusion_width, fusion_height, fusion_us / 1000.0);
+            }
+        }
+        free(out);
+    }
+    for (i = 0; i < fusion_count; ++i) {
+        free(fusion_images[i]);
+    }
+    fusion_count = 0;
+    fusion_us = 0;
+}
+#else
+void preview_check(pslr_handle_t camhandle, int bufno, int fileNo, uint32_t af_mask) {
+}
+
+void fusion_finish(char *output_file, int first, int last) {
+}
+#endif
+
+/* Save every file of a picture, then delete it from the camera */
+int download_picture(pslr_handle_t camhandle, int bufno, char *output_file, int fileNo, pslr_status *status,
+                     user_file_format uff, int quality, bool raw_plus) {
+    int ret = 0;
+
+    if (raw_plus) {
+        // JPEG first, it can be looked at while the RAW file is downloading
+        ret = save_file(camhandle, bufno, output_file, fileNo, status, USER_FILE_FORMAT_JPEG, quality);
+    }
+    if (ret == 0) {
+        ret = save_file(camhandle, bufno, output_file, fileNo, status, uff, quality);
+    }
+    // delete only after every file of the picture is complete
+    if (ret != 0 || interrupted) {
+        fprintf(stderr, "Download interrupted, the picture is kept in the camera\n");
+        return -1;
+    }
+    last_preview_valid = false;
+    if (fusion || sharpness || (exposure_ramp && !last_raw_valid)) {
+        preview_check(camhandle, bufno, fileNo, status->focused_af_point);
+    }
+    pslr_delete_buffer(camhandle, bufno);
+    return 0;
+}
+
+/* Host bracketing: every frame is a whole bracket, it is downloaded
+ * after its last release so nothing slows down the sequence */
+int shoot_brackets(pslr_handle_t camhandle, pslr_bracket_t *bracket, char *output_file, int frames, int delay,
+                   pslr_status *status, user_file_format uff, int quality, bool raw_plus) {
+    struct timeval prev_time;
+    struct timeval current_time;
+    double waitsec;
+    int frameNo, i, ret;
+    int fileNo = 0;
+
+    gettimeofday(&prev_time, NULL);
+    for (frameNo = 0; frameNo < frames && !interrupted; ++frameNo) {
+        if (frameNo > 0) {
+            gettimeofday(&current_time, NULL);
+            waitsec = 1.0 * delay - timeval_diff(&current_time, &prev_time) / 1000000.0;
+            if (waitsec > 0) {
+                printf("Waiting for %.2f sec\n", waitsec);
+                sleep_sec(waitsec);
+            }
+            gettimeofday(&prev_time, NULL);
+        }
+        if (frames > 1) {
+            printf("Taking bracket %d/%d\n", frameNo+1, frames);
+        }
+        ret = pslr_bracket_shoot(camhandle, bracket, &interrupted);
+        for (i = 0; i < bracket->shot; ++i) {
+            printf("  %+.2f EV %d/%d s released at %.3f s\n", bracket->ev[i], bracket->shutter[i].nom,
+                   bracket->shutter[i].denom, bracket->release_us[i] / 1000000.0);
+        }
+        printf("Bracket of %d frames took %.3f s\n", bracket->shot, bracket->total_us / 1000000.0);
+        if (ret != PSLR_OK) {
+            fprintf(stderr, "Bracket stopped after %d frames: %d\n", bracket->shot, ret);
+        }
+
+        pslr_get_status(camhandle, status);
+        for (i = 0; i < bracket->shot; ++i, ++fileNo) {
+            if (download_picture(camhandle, i, output_file, fileNo, status, uff, quality, raw_plus) != 0) {
+                return PSLR_READ_ERROR;
+            }
+        }
+        if (fusion) {
+            fusion_finish(output_file, fileNo - bracket->shot, fileNo - 1);
+        }
+        if (ret != PSLR_OK) {
+            return ret;
+        }
+    }
+    return PSLR_OK;
+}
+
+void init_ramp(pslr_handle_t camhandle, pslr_ramp_t *ramp, pslr_status *status, int delay, uint32_t iso_min, uint32_t iso_max) {
+    pslr_ramp_init(ramp, ramp_target, ramp_step);
+
+    ramp->shutter_min = 1.0 / pslr_get_model_fastest_shutter_speed(camhandle);
+    // leave time for the download between the frames
+    ramp->shutter_max = delay > 2 && delay - 2 < 30 ? delay - 2 : 30;
+    if (iso_min > 0) {
+        ramp->iso_min = iso_min;
+        ramp->iso_max = iso_max;
+    } else {
+        ramp->iso_min = pslr_get_model_extended_iso_min(camhandle);
+        ramp->iso_max = pslr_get_model_extended_iso_max(camhandle);
+    }
+    if (status->lens_min_aperture.denom && status->lens_max_aperture.denom) {
+        ramp->aperture_min = (double) status->lens_min_aperture.nom / status->lens_min_aperture.denom;
+        ramp->aperture_max = (double) status->lens_max_aperture.nom / status->lens_max_aperture.denom;
+    }
+
+    if (status->current_shutter_speed.denom) {
+        ramp->shutter = (double) status->current_shutter_speed.nom / status->current_shutter_speed.denom;
+    }
+    ramp->iso = status->current_iso;
+    if (status->current_aperture.denom) {
+        ramp->aperture = (double) status->current_aperture.nom / status->current_aperture.denom;
+    }
+    DPRINT("ramp: shutter %f-%f iso %f-%f aperture %f-%f\n", ramp->shutter_min, ramp->shutter_max,
+           ramp->iso_min, ramp->iso_max, ramp->aperture_min, ramp->aperture_max);
+}
+
+/* Change the exposure for the next frame from the RAW statistics of
+ * the last one, or from its preview if there are none */
+void update_ramp(pslr_handle_t camhandle, pslr_ramp_t *ramp) {
+    pslr_rational_t shutter = pslr_ramp_get_shutter(ramp);
+    uint32_t iso = pslr_ramp_get_iso(ramp);
+    pslr_rational_t aperture = pslr_ramp_get_aperture(ramp);
+    double level, change;
+    long int analysis_us;
+    const char *source;
+
+    if (last_raw_valid) {
+        level = pslr_raw_stats_mean_ev(&last_raw_stats);
+        analysis_us = last_raw_analysis_us;
+        source = "RAW";
+    } else if (last_preview_valid) {
+        level = last_preview_level;
+        analysis_us = last_preview_analysis_us;
+        source = "preview";
+    } else {
+        fprintf(stderr, "Exposure ramp: no RAW statistics or preview level, exposure unchanged\n");
+        return;
+    }
+    change = pslr_ramp_update(ramp, level);
+
+    // only send what changed after rounding to 1/3 stops
+    pslr_rational_t new_shutter = pslr_ramp_get_shutter(ramp);
+    if (new_shutter.nom != shutter.nom || new_shutter.denom != shutter.denom) {
+        pslr_set_shutter(camhandle, new_shutter);
+        shutter = new_shutter;
+    }
+    if (pslr_ramp_get_iso(ramp) != iso) {
+        iso = pslr_ramp_get_iso(ramp);
+        pslr_set_iso(camhandle, iso, 0, 0);
+    }
+    if (ramp->aperture_min > 0) {
+        pslr_rational_t new_aperture = pslr_ramp_get_aperture(ramp);
+        if (new_aperture.nom != aperture.nom || new_aperture.denom != aperture.denom) {
+            pslr_set_aperture(camhandle, new_aperture);
+            aperture = new_aperture;
+        }
+    }
+    printf("Exposure ramp: %s level %.2f EV, target %.2f EV, change %+.2f EV -> %d/%d s ISO %d f/%.1f, analysis %.1f ms\n",
+           source, level, ramp->target_ev, change, shutter.nom, shutter.denom, iso,
+           (double) aperture.nom / (aperture.denom ? aperture.denom : 1), analysis_us / 1000.0);
+}
+
+/* Save one representation of a buffer, waiting until the camera has it ready */
+int save_file(pslr_handle_t camhandle, int bufno, char *output_file, int frameNo, pslr_status *status, user_file_format filefmt, int jpeg_stars) {
+    int fd;
+    int ret;
+
+    fd = open_file(output_file, frameNo, *get_file_format_t(filefmt));
+    if (fd == -1) {
+        return -1;
+    }
+    while( (ret = save_buffer(camhandle, bufno, fd, status, filefmt, jpeg_stars)) == 1 && !interrupted ) {
+        usleep(10000);
+    }
+    if (fd != 1) {
+        close(fd);
+    }
+    return interrupted ? -1 : ret;
 }
 
 int save_buffer(pslr_handle_t camhandle, int bufno, int fd, pslr_status *status, user_file_format filefmt, int jpeg_stars) {
@@ -749,6 +1361,9 @@ int save_buffer(pslr_handle_t camhandle, int bufno, int fd, pslr_status *status,
     uint8_t buf[65536];
     uint32_t length;
     uint32_t current;
+    int ret;
+    pslr_raw_analyzer_t *raw = NULL;
+    pslr_raw_stats_t stats;
 
     if (filefmt == USER_FILE_FORMAT_PEF) {
       imagetype = PSLR_BUF_PEF;
@@ -766,6 +1381,12 @@ int save_buffer(pslr_handle_t camhandle, int bufno, int fd, pslr_status *status,
     DPRINT("Buffer length: %d\n", length);
     current = 0;
 
+    last_raw_valid = false;
+    last_raw_analysis_us = 0;
+    if ((raw_stats || exposure_ramp) && filefmt != USER_FILE_FORMAT_JPEG) {
+        raw = pslr_raw_analyzer_new();
+    }
+
     while (1) {
         uint32_t bytes;
         bytes = pslr_buffer_read(camhandle, buf, sizeof (buf));
@@ -773,9 +1394,37 @@ int save_buffer(pslr_handle_t camhandle, int bufno, int fd, pslr_status *status,
             break;
 	}
         write(fd, buf, bytes);
+        // analyzed while the next block is on its way
+        if (raw) {
+            struct timeval t1, t2;
+            gettimeofday(&t1, NULL);
+            pslr_raw_analyzer_feed(raw, buf, bytes);
+            gettimeofday(&t2, NULL);
+            last_raw_analysis_us += timeval_diff(&t2, &t1);
+        }
         current += bytes;
     }
+    ret = pslr_buffer_get_result(camhandle);
     pslr_buffer_close(camhandle);
+    if (ret != PSLR_OK) {
+        DPRINT("Download stopped after %d of %d bytes: %d\n", current, length, ret);
+        pslr_raw_analyzer_free(raw);
+        return (-1);
+    }
+    if (raw) {
+        ret = pslr_raw_analyzer_finish(raw, &stats);
+        if (ret == PSLR_OK) {
+            last_raw_stats = stats;
+            last_raw_valid = true;
+            if (raw_stats) {
+                pslr_raw_stats_print(&stats, stderr);
+            }
+        } else {
+            fprintf(stderr, "No RAW statistics for buffer %d (%s)\n", bufno,
+                    ret == PSLR_PARAM ? "compressed or unsupported RAW data" : "incomplete file");
+        }
+        pslr_raw_analyzer_free(raw);
+    }
     return (0);
 }
 
@@ -822,6 +1471,16 @@ Shoot a Pentax DSLR and send the picture to standard output.\n\
       --file_format=FORMAT              valid values: PEF, DNG, JPEG\n\
   -o, --output_file=FILE                send output to FILE instead of stdout\n\
       --debug                           turn on debug messages\n\
+      --trace=FILE                      save the binary protocol trace to FILE (see pktriggercord-trace)\n\
+      --metrics                         print protocol latency and throughput metrics on exit\n\
+      --metrics_file=FILE               write the metrics to FILE in Prometheus text format\n\
+      --raw_stats                       print sensor saturation and highlight headroom of downloaded PEF/DNG files\n\
+      --exposure_ramp=TARGET            in M mode adjust the exposure between the frames to keep the RAW (or preview)\n\
+                                        mean level at TARGET EV below saturation (eg. -3)\n\
+      --exposure_ramp_step=EV           largest exposure change between two frames (default 1/3 EV)\n\
+      --bracket=EV[,EV...]              in M or Tv mode take a bracket of the given shutter speed offsets for every frame\n\
+      --fusion                          save an exposure fused preview of every bracket\n\
+      --sharpness                       print the sharpness at the focused AF points of every picture\n\
   -v, --version                         display version information and exit\n\
   -h, --help                            display this help and exit\n\
 \n", name);
@@ -0,0 +1,52 @@
+/*
+    pkTriggerCord
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 3 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/gpl.html>.
+ */
+
+/* Decoder for the binary trace files written by pktriggercord-cli --trace */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pslr_trace.h"
+
+int main(int argc, char **argv) {
+    pslr_trace_t *trace;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "\nUsage: %s TRACE_FILE...\n\n", argv[0]);
+        exit(-1);
+    }
+
+    trace = malloc(sizeof (*trace));
+    if (!trace) {
+        exit(-1);
+    }
+    for (i = 1; i < argc; ++i) {
+        if (pslr_trace_load(trace, argv[i]) != 0) {
+            fprintf(stderr, "%s: cannot read trace file %s\n", argv[0], argv[i]);
+            free(trace);
+            exit(-1);
+        }
+        if (argc > 2) {
+            printf("%s:\n", argv[i]);
+        }
+        pslr_trace_print(trace, stdout);
+    }
+    free(trace);
+    exit(0);
+}
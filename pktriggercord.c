@@ -38,6 +38,11 @@
 
 #include "pslr.h"
 #include "pslr_lens.h"
+#include "pslr_sched.h"
+#include "pslr_watch.h"
+#include "pslr_histogram.h"
+#include "pslr_sharpness.h"
+#include "pslr_raw.h"
 
 #ifdef WIN32
 #define FILE_ACCESS O_WRONLY | O_CREAT | O_TRUNC | O_BINARY
@@ -68,12 +73,13 @@ void set_preview_icon(int n, GdkPixbuf *pBuf);
 
 void error_message(const gchar *message);
 
-static gboolean status_poll(gpointer data);
+static gpointer camera_worker(gpointer data);
+static gboolean status_idle(gpointer data);
 static void update_preview_area(int buffer);
-static void update_main_area(int buffer);
+static void update_main_area(int buffer, uint32_t af_points);
 
 static void init_controls(pslr_status *st_new, pslr_status *st_old);
-static bool auto_save_check(int format, int buffer);
+static bool auto_save_check(int format, int buffer, bool raw_plus, bool main_area, uint32_t af_points);
 static void manage_camera_buffers(pslr_status *st_new, pslr_status *st_old);
 static void manage_camera_buffers_limited();
 
@@ -82,7 +88,10 @@ static void which_iso_table(pslr_status *st, const int **table, int *steps);
 static void which_ec_table(pslr_status *st, const int **table, int *steps);
 static bool is_inside(int rect_x, int rect_y, int rect_w, int rect_h, int px, int py);
 
-static void save_buffer(int bufno, const char *filename);
+typedef struct save_group save_group_t;
+static bool save_buffer(int bufno, const char *filename, user_file_format filefmt, save_group_t *group);
+static void camera_wake(void);
+static void preview_icon_post(int buffer, GdkPixbuf *pixbuf);
 
 /* ----------------------------------------------------------------------- */
 
@@ -187,7 +196,21 @@ static const int ec_tbl_1_2[]= {
 
 /* ----------------------------------------------------------------------- */
 
+/* The camera worker thread polls the status and runs the downloads.
+ * camhandle, sched and watch are used with camera_mutex held; the UI
+ * takes it only for short commands and to queue downloads. The worker posts
+ * its results to the main loop with g_idle_add(), so GTK is only
+ * touched from the main thread. Decoding, file previews and waits for
+ * deleted buffers are queued by the download callbacks with
+ * camera_defer() and run by the worker without camera_mutex. */
 static pslr_handle_t camhandle;
+static pslr_sched_t *sched;
+static pslr_watch_t *watch;
+static GThread *camera_thread;
+static GMutex camera_mutex;
+static GCond camera_cond;
+static bool camera_quit;
+static GQueue camera_tasks = G_QUEUE_INIT;
 static GtkBuilder *xml;
 static GtkStatusbar *statusbar;
 static guint sbar_connect_ctx;
@@ -290,7 +313,7 @@ int common_init(void)
 
     init_controls(NULL, NULL);
 
-    g_timeout_add(1000, status_poll, 0);
+    camera_thread = g_thread_new("camera", camera_worker, NULL);
 
     gtk_widget_show(widget);
 
@@ -603,54 +626,283 @@ static void init_controls(pslr_status *st_new, pslr_status *st_old)
     gtk_widget_set_sensitive(pw, st_new != NULL);
 }
 
+static const char *sched_messages[PSLR_SCHED_PRIORITY_MAX] = {
+    "Getting thumbnails",
+    "Getting preview",
+    "Saving"
+};
+
+/* Download progress set by the worker and shown by one idle callback,
+ * however many blocks arrived in the meantime */
+static struct {
+    GMutex lock;
+    const char *message;        /* sched_messages entry or NULL */
+    char text[256];             /* progress bar text, empty if none */
+    gdouble fraction;
+    guint source;
+} progress;
+
+static gboolean progress_idle(gpointer data)
+{
+    static const char *shown = NULL;
+    const char *msg;
+    char text[256];
+    gdouble fraction;
+    GtkProgressBar *pbar;
+
+    g_mutex_lock(&progress.lock);
+    msg = progress.message;
+    g_strlcpy(text, progress.text, sizeof(text));
+    fraction = progress.fraction;
+    progress.source = 0;
+    g_mutex_unlock(&progress.lock);
+
+    if (msg != shown) {
+        if (shown)
+            gtk_statusbar_pop(statusbar, sbar_download_ctx);
+        if (msg)
+            gtk_statusbar_push(statusbar, sbar_download_ctx, msg);
+        shown = msg;
+    }
+    pbar = GTK_PROGRESS_BAR(GW("download_progress"));
+    gtk_progress_bar_set_text(pbar, text[0] ? text : NULL);
+    gtk_progress_bar_update(pbar, fraction);
+    return FALSE;
+}
+
+/* Called with progress.lock held */
+static void progress_kick(void)
+{
+    if (!progress.source)
+        progress.source = g_idle_add(progress_idle, NULL);
+}
+
+static void progress_set_message(const char *message)
+{
+    g_mutex_lock(&progress.lock);
+    if (progress.message != message) {
+        progress.message = message;
+        progress_kick();
+    }
+    g_mutex_unlock(&progress.lock);
+}
+
+static void progress_set_bar(const char *text, gdouble fraction)
+{
+    g_mutex_lock(&progress.lock);
+    g_strlcpy(progress.text, text ? text : "", sizeof(progress.text));
+    progress.fraction = fraction;
+    progress_kick();
+    g_mutex_unlock(&progress.lock);
+}
+
 static pslr_status cam_status[2];
 static pslr_status *status_new = NULL;
 static pslr_status *status_old = NULL;
 
-static gboolean status_poll(gpointer data)
+#define STATUS_POLL_US 1000000
+
+static guint af_indicate_timer;
+
+/* Connection state change for the status bar, posted by the worker */
+typedef struct {
+    gchar *message;
+    bool connected;
+} connect_msg_t;
+
+static gboolean connect_idle(gpointer data)
 {
-    GtkWidget *pw;
-    gchar buf[256];
-    pslr_status *tmp;
-    int ret;
-    static bool status_poll_inhibit = false;
+    connect_msg_t *msg = data;
 
-    if (status_poll_inhibit)
-        return TRUE;
+    if (msg->connected) {
+        camera_specific_init();
+    }
+    gtk_statusbar_pop(statusbar, sbar_connect_ctx);
+    gtk_statusbar_push(statusbar, sbar_connect_ctx, msg->message);
+    g_free(msg->message);
+    g_free(msg);
+    return FALSE;
+}
+
+static void connect_post(const char *message, bool connected)
+{
+    connect_msg_t *msg = g_new0(connect_msg_t, 1);
+    msg->message = g_strdup(message);
+    msg->connected = connected;
+    g_idle_add(connect_idle, msg);
+}
+
+typedef struct {
+    void (*func)(gpointer data);
+    gpointer data;
+} camera_task_t;
+
+/* Run func(data) later without camera_mutex; called with it held */
+static void camera_defer(void (*func)(gpointer data), gpointer data)
+{
+    camera_task_t *task = g_new(camera_task_t, 1);
+    task->func = func;
+    task->data = data;
+    g_queue_push_tail(&camera_tasks, task);
+}
 
-    /* Do not recursively status poll */
-    status_poll_inhibit = true;
+/* Called with camera_mutex held, which is released while a task runs */
+static void camera_run_tasks(void)
+{
+    camera_task_t *task;
+
+    while ((task = g_queue_pop_head(&camera_tasks))) {
+        g_mutex_unlock(&camera_mutex);
+        task->func(task->data);
+        g_free(task);
+        g_mutex_lock(&camera_mutex);
+    }
+}
+
+/* Post a copy of a changed status to the UI */
+static void status_changed(const pslr_status *status, uint32_t changed, void *user_data)
+{
+    pslr_status *st = g_new(pslr_status, 1);
+
+    memcpy(st, status, sizeof(pslr_status));
+    g_idle_add(status_idle, st);
+}
+
+/*
+ * Connect, or read the status; changes are posted to the UI by
+ * status_changed(). Runs in the camera worker with camera_mutex held.
+ */
+static void camera_poll(void)
+{
+    static bool no_camera_shown = true;
+    gchar buf[256];
+    int ret;
 
     if (!camhandle) {
         camhandle = pslr_init( NULL, NULL );
-        if (camhandle) {
-            /* Try to reconnect */
-            gtk_statusbar_pop(statusbar, sbar_connect_ctx);
-            gtk_statusbar_push(statusbar, sbar_connect_ctx, "Connecting...");
-
-            /* Allow the message to be seen */
-            while (gtk_events_pending())
-                gtk_main_iteration();
+        if (!camhandle) {
+            if (!no_camera_shown) {
+                connect_post("No camera connected.", false);
+                no_camera_shown = true;
+            }
+            return;
+        }
+        no_camera_shown = false;
+        connect_post("Connecting...", false);
+        pslr_connect_fast(camhandle);
+        sched = pslr_sched_new(camhandle);
+        watch = pslr_get_watch(camhandle);
+        pslr_watch_subscribe(watch, PSLR_WATCH_ALL, PSLR_WATCH_FAST_MS, status_changed, NULL);
+
+        snprintf(buf, sizeof(buf), "Connected: %s", pslr_camera_name(camhandle));
+        buf[sizeof(buf)-1] = '\0';
+        connect_post(buf, true);
+        return;
+    }
 
-            /* Connect */
-            pslr_connect(camhandle);
+    ret = pslr_watch_poll(watch);
+    if (ret != PSLR_OK) {
+        if (ret == PSLR_DEVICE_ERROR) {
+            /* Camera disconnected */
+            pslr_sched_free(sched);
+            sched = NULL;
+            /* Frees the watch and its subscriptions too */
+            pslr_shutdown(camhandle);
+            watch = NULL;
+            camhandle = NULL;
+            progress_set_message(NULL);
         }
+        DPRINT("pslr_get_status: %d\n", ret);
+        g_idle_add(status_idle, NULL);
+    }
+}
 
-        gtk_statusbar_pop(statusbar, sbar_connect_ctx);
-        if (camhandle) {
-            camera_specific_init();
-            const char *name;
-            name = pslr_camera_name(camhandle);
+static void camera_step(void)
+{
+    pslr_sched_req_t *req;
+
+    pslr_sched_step(sched);
+    req = pslr_sched_current(sched);
+    if (req) {
+        progress_set_message(sched_messages[req->priority]);
+    }
+    if (!pslr_sched_pending(sched)) {
+        progress_set_message(NULL);
+    }
+}
 
-            snprintf(buf, sizeof(buf), "Connected: %s", name);
-            buf[sizeof(buf)-1] = '\0';
-            gtk_statusbar_push(statusbar, sbar_connect_ctx, buf);
+/*
+ * The camera worker: polls the status when the watch wants it (fast
+ * after user actions and changes, slow when idle, not while downloads
+ * are queued) and downloads one block at a time in between. The mutex
+ * is released after every command and while the deferred work of the
+ * finished downloads runs, so UI commands wait at most one block.
+ * Without a camera it tries to connect every second.
+ */
+static gpointer camera_worker(gpointer data)
+{
+    gint64 next_poll = 0;
+    uint32_t ms;
+
+    g_mutex_lock(&camera_mutex);
+    while (!camera_quit) {
+        if (watch) {
+            pslr_watch_set_busy(watch, sched && pslr_sched_pending(sched));
+            ms = pslr_watch_next_ms(watch);
+            next_poll = ms == UINT32_MAX ? G_MAXINT64 : g_get_monotonic_time() + (gint64) ms * 1000;
+        }
+        if (g_get_monotonic_time() >= next_poll) {
+            camera_poll();
+            next_poll = g_get_monotonic_time() + STATUS_POLL_US;
+        } else if (camhandle && sched && pslr_sched_pending(sched)) {
+            camera_step();
         } else {
-            gtk_statusbar_push(statusbar, sbar_connect_ctx, "No camera connected.");
+            g_cond_wait_until(&camera_cond, &camera_mutex, next_poll);
+            continue;
         }
-        status_poll_inhibit = false;
-        return TRUE;
+        camera_run_tasks();
+        g_mutex_unlock(&camera_mutex);
+        g_thread_yield();
+        g_mutex_lock(&camera_mutex);
+    }
+    g_mutex_unlock(&camera_mutex);
+    return NULL;
+}
+
+/* Poll fast after a user action, with camera_mutex held */
+static void camera_kick(void)
+{
+    if (watch) {
+        pslr_watch_kick(watch);
+        g_cond_signal(&camera_cond);
     }
+}
+
+/* Wake the worker after queueing a download */
+static void camera_wake(void)
+{
+    g_cond_signal(&camera_cond);
+}
+
+/* The status is only posted when it changed, stop indicating changed
+ * AF points after one poll period */
+static gboolean af_indicate_done(gpointer data)
+{
+    GtkWidget *pw = GTK_WIDGET (gtk_builder_get_object (xml, "main_drawing_area"));
+
+    af_indicate_timer = 0;
+    focus_indicated_af_points = 0;
+    select_indicated_af_points = 0;
+    gdk_window_invalidate_rect(pw->window, &pw->allocation, FALSE);
+    return FALSE;
+}
+
+/* Show a changed status read by the worker, NULL if it failed */
+static gboolean status_idle(gpointer data)
+{
+    GtkWidget *pw;
+    gchar buf[256];
+    pslr_status *tmp;
 
     tmp = status_new;
     status_new = status_old;
@@ -663,16 +915,14 @@ static gboolean status_poll(gpointer data)
             status_new = &cam_status[1];
     }
 
-    ret = pslr_get_status(camhandle, status_new);
+    if (data) {
+        memcpy(status_new, data, sizeof(pslr_status));
+        g_free(data);
+    }
     // one time init of camera and status specific fields
     shutter_speed_table_init( status_new );
     iso_speed_table_init( status_new );
-    if (ret != PSLR_OK) {
-        if (ret == PSLR_DEVICE_ERROR) {
-            /* Camera disconnected */
-            camhandle = NULL;
-        }
-        DPRINT("pslr_get_status: %d\n", ret);
+    if (!data) {
         status_new = NULL;
     }
 
@@ -778,19 +1028,22 @@ static gboolean status_poll(gpointer data)
         }
         preselect_indicated_af_points = 0;
         preselect_reselect = false;
+        if (focus_indicated_af_points || select_indicated_af_points) {
+            if (af_indicate_timer) {
+                g_source_remove(af_indicate_timer);
+            }
+            af_indicate_timer = g_timeout_add(STATUS_POLL_US / 1000, af_indicate_done, NULL);
+        }
     }
     /* Camera buffer checks */
     manage_camera_buffers(status_new, status_old);
     DPRINT("end poll\n");
-
-    status_poll_inhibit = false;
-    return TRUE;
+    return FALSE;
 }
 
 static void manage_camera_buffers(pslr_status *st_new, pslr_status *st_old)
 {
     uint32_t new_pictures;
-    bool deleted;
     int new_picture;
     int format;
     int i;
@@ -821,28 +1074,20 @@ static void manage_camera_buffers(pslr_status *st_new, pslr_status *st_old)
             break;
 	}
     }
-    if (new_picture >= 0) {
-        update_main_area(new_picture);
-    }
-
+    /* These only queue the downloads. Auto-saved pictures get their
+     * thumbnail and preview from the saved file, the others fetch them
+     * from the camera first */
     format = get_user_file_format(st_new);
 
-    /* auto-save check buffers */
-    for (i=0; i<MAX_BUFFERS; i++) {
-        if (new_pictures & (1<<i)) {
-            deleted = auto_save_check(format, i);
-            if (deleted) {
-                new_pictures &= ~(1<<i);
-	    }
-        }
-    }
-
-    /* Update buffer window for buffers that were not deleted by
-     * auto_save_check */
     for (i=0; i<MAX_BUFFERS; i++) {
         if (new_pictures & (1<<i)) {
+            if (auto_save_check(format, i, st_new->image_format == PSLR_IMAGE_FORMAT_RAW_PLUS, i == new_picture,
+                                st_new->focused_af_point))
+                continue;
+            if (i == new_picture)
+                update_main_area(i, st_new->focused_af_point);
             update_preview_area(i);
-	}
+        }
     }
     /* Select the new picture in the buffer window */
     GtkWidget *pw;
@@ -857,7 +1102,7 @@ static void manage_camera_buffers(pslr_status *st_new, pslr_status *st_old)
 }
 
 static void manage_camera_buffers_limited() {
-    update_main_area(0);
+    update_main_area(0, 0);
     update_preview_area(0);
 }
 
@@ -895,19 +1140,98 @@ G_MODULE_EXPORT void auto_folder_entry_changed_cb(GtkAction *action)
     plugin_config.autosave_path = g_strdup(gtk_entry_get_text(widget));
 }
 
-static bool auto_save_check(int format, int buffer)
+/*
+ * Delete a saved buffer in the camera and wait until the camera
+ * reports it gone. Called without camera_mutex: it is taken for each
+ * command only, not for the waits in between.
+ */
+static bool delete_buffer(int buffer)
+{
+    int retry;
+    int ret;
+    pslr_status st;
+    /* Init bufmask to 1's so that we don't see buffer as deleted
+     * if we never got a good status. */
+    st.bufmask = ~0;
+    DPRINT("Delete buffer %d\n", buffer);
+    for (retry = 0; retry < 5; retry++)  {
+        g_mutex_lock(&camera_mutex);
+        if (!camhandle) {
+            g_mutex_unlock(&camera_mutex);
+            return false;
+        }
+        /* Another download may have the camera's buffer open */
+        if (sched)
+            pslr_sched_pause(sched);
+        ret = pslr_delete_buffer(camhandle, buffer);
+        g_mutex_unlock(&camera_mutex);
+        if (ret == PSLR_OK)
+            break;
+        DPRINT("Could not delete buffer %d: %d\n", buffer, ret);
+        usleep(100000);
+    }
+    for (retry=0; retry<5; retry++) {
+        g_mutex_lock(&camera_mutex);
+        if (camhandle)
+            pslr_get_status(camhandle, &st);
+        g_mutex_unlock(&camera_mutex);
+        if ((st.bufmask & (1<<buffer))==0)
+            break;
+        DPRINT("Buffer not gone - wait\n");
+    }
+    preview_icon_post(buffer, NULL);
+    return (st.bufmask & (1<<buffer)) == 0;
+}
+
+/*
+ * The files saved from one buffer. The buffer is deleted once the
+ * last of them completed, and only if none of them failed.
+ */
+struct save_group {
+    int pending;
+    bool failed;
+    bool autodelete;
+    bool previews;              /* thumbnail from the first saved file */
+    bool main_area;             /* and the main preview too */
+    uint32_t af_points;         /* focused AF points, for the sharpness */
+};
+
+/* Called without camera_mutex, as the delete waits for the camera */
+static void save_group_release(save_group_t *group, int buffer)
+{
+    bool last;
+
+    g_mutex_lock(&camera_mutex);
+    last = --group->pending == 0;
+    g_mutex_unlock(&camera_mutex);
+    if (!last)
+        return;
+    if (!group->failed && group->autodelete) {
+        delete_buffer(buffer);
+    }
+    g_free(group);
+}
+
+/*
+ * In RAW+ mode both files of the picture are saved under the same
+ * counter, the JPEG first so it can be looked at while the RAW file
+ * is still downloading. The buffer is deleted after both completed.
+ * Returns true if the thumbnail (and the main preview if main_area)
+ * will be made from the saved file.
+ */
+static bool auto_save_check(int format, int buffer, bool raw_plus, bool main_area, uint32_t af_points)
 {
     GtkWidget *pw;
     gboolean autosave;
     gboolean autodelete;
     const gchar *filebase;
     gint counter;
-    int ret;
     GtkSpinButton *spin;
-    char *old_path = NULL;
-    GtkProgressBar *pbar;
-    bool deleted = false;
-    char filename[256];
+    user_file_format formats[2];
+    int nformats = 0;
+    save_group_t *group;
+    bool queued = false;
+    int i;
 
     pw = GTK_WIDGET (gtk_builder_get_object (xml, "auto_save_check"));
     autosave = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(pw));
@@ -915,8 +1239,6 @@ static bool auto_save_check(int format, int buffer)
     if (!autosave)
         return false;
 
-    pbar = GTK_PROGRESS_BAR(GTK_WIDGET (gtk_builder_get_object (xml, "download_progress")));
-
     pw = GTK_WIDGET (gtk_builder_get_object (xml, "auto_delete_check"));
     autodelete = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(pw));
 
@@ -926,146 +1248,247 @@ static bool auto_save_check(int format, int buffer)
     pw = GTK_WIDGET (gtk_builder_get_object (xml, "auto_name_entry"));
     filebase = gtk_entry_get_text(GTK_ENTRY(pw));
 
-    /* Change to auto-save path */
-    if (plugin_config.autosave_path) {
-        old_path = getcwd(NULL, 0);
-        if (chdir(plugin_config.autosave_path) == -1) {
-            char msg[256];
-            
-            snprintf(msg, sizeof(msg), "Could not save in folder %s: %s", 
-                     plugin_config.autosave_path, strerror(errno));
-            error_message(msg);
-            free(old_path);
-            return false;
-        }
+    if (plugin_config.autosave_path && !g_file_test(plugin_config.autosave_path, G_FILE_TEST_IS_DIR)) {
+        char msg[256];
+
+        snprintf(msg, sizeof(msg), "Could not save in folder %s: %s", 
+                 plugin_config.autosave_path, strerror(ENOTDIR));
+        error_message(msg);
+        return false;
     }
 
-    gtk_statusbar_push(statusbar, sbar_download_ctx, "Auto-saving");
-    while (gtk_events_pending())
-        gtk_main_iteration();
-
-    snprintf(filename, sizeof(filename), "%s%04d.%s", filebase, counter, file_formats[format].extension);
-    DPRINT("Save buffer %d\n", buffer);
-    gtk_progress_bar_set_text(pbar, filename);
-    save_buffer(buffer, filename);
-    gtk_progress_bar_set_text(pbar, NULL);
-
-    if (autodelete) {
-        int retry;
-        pslr_status st;
-        /* Init bufmask to 1's so that we don't see buffer as deleted
-         * if we never got a good status. */
-        st.bufmask = ~0;
-        DPRINT("Delete buffer %d\n", buffer);
-        for (retry = 0; retry < 5; retry++)  {
-            ret = pslr_delete_buffer(camhandle, buffer);
-            if (ret == PSLR_OK)
-                break;
-            DPRINT("Could not delete buffer %d: %d\n", buffer, ret);
-            usleep(100000);
-        }
-        for (retry=0; retry<5; retry++) {
-            pslr_get_status(camhandle, &st);
-            if ((st.bufmask & (1<<buffer))==0)
-                break;
-            DPRINT("Buffer not gone - wait\n");
+    if (raw_plus) {
+        formats[nformats++] = USER_FILE_FORMAT_JPEG;
+    }
+    formats[nformats++] = format;
+
+    group = g_new0(save_group_t, 1);
+    group->autodelete = autodelete;
+    group->previews = true;
+    group->main_area = main_area;
+    group->af_points = af_points;
+    /* Held until every file is queued, so a quick failure of the
+     * first one cannot finish the group */
+    group->pending = 1;
+
+    g_mutex_lock(&camera_mutex);
+    for (i = 0; i < nformats; i++) {
+        char filename[256];
+        gchar *path;
+
+        snprintf(filename, sizeof(filename), "%s%04d.%s", filebase, counter, file_formats[formats[i]].extension);
+
+        /* The download runs later, so use the full path instead of
+         * changing to the auto-save folder */
+        if (plugin_config.autosave_path) {
+            path = g_build_filename(plugin_config.autosave_path, filename, NULL);
+        } else {
+            path = g_strdup(filename);
         }
-        set_preview_icon(buffer, NULL);
-        if ((st.bufmask & (1<<buffer)) == 0) {
-            deleted = true;
+
+        DPRINT("Save buffer %d as %s\n", buffer, path);
+        if (save_buffer(buffer, path, formats[i], group)) {
+            queued = true;
+        } else {
+            group->failed = true;
         }
+        g_free(path);
     }
-    counter++;
-    DPRINT("Set counter -> %d\n", counter);
-    gtk_spin_button_set_value(spin, counter);
-
-    if (old_path) {
-        chdir(old_path);
-        free(old_path);
+    if (!queued) {
+        group->previews = false;
     }
+    g_mutex_unlock(&camera_mutex);
+    save_group_release(group, buffer);
+    camera_wake();
 
-    gtk_statusbar_pop(statusbar, sbar_download_ctx);
-
-    //printf("auto_save_check done\n");
-    return deleted;
+    if (queued) {
+        counter++;
+        DPRINT("Set counter -> %d\n", counter);
+        gtk_spin_button_set_value(spin, counter);
+    }
+    return queued;
 }
 
 bool buf_updated = false;
 GdkPixbuf *pMainPixbuf = NULL;
 //static GdkPixbuf *pThumbPixbuf[MAX_BUFFERS];
 
-static void update_main_area(int buffer)
+/* A downloaded preview waiting to be decoded */
+typedef struct {
+    pslr_handle_t h;
+    int buffer;
+    uint8_t *data;
+    uint32_t length;
+    uint32_t af_points;
+    void (*post)(int buffer, GdkPixbuf *pixBuf, uint32_t af_points);
+} decode_task_t;
+
+/*
+ * Decode a downloaded preview in the camera worker without
+ * camera_mutex, so neither the UI nor the camera commands wait for
+ * it; only the result is handed over.
+ */
+static void decode_task(gpointer data)
 {
-    GError *pError;
-    uint8_t *pImage;
-    uint32_t imageSize;
-    int r;
+    decode_task_t *task = data;
+    GError *pError = NULL;
+    GInputStream *ginput;
     GdkPixbuf *pixBuf;
 
-    gtk_statusbar_push(statusbar, sbar_download_ctx, "Getting preview");
-    while (gtk_events_pending())
-        gtk_main_iteration();
+    DPRINT("got %d bytes at %p\n", task->length, task->data);
+    ginput = g_memory_input_stream_new_from_data (task->data, task->length, NULL);
+    pixBuf = gdk_pixbuf_new_from_stream( ginput, NULL, &pError);
+    g_object_unref(ginput);
 
-    pError = NULL;
-    DPRINT("Trying to read buffer %d\n", buffer);
-    r = pslr_get_buffer(camhandle, buffer, PSLR_BUF_PREVIEW, 4, &pImage, &imageSize);
-    if (r != PSLR_OK) {
-        printf("Could not get buffer data\n");
-        goto the_end;
-    }
+    /* The buffer pool is used with camera_mutex held */
+    g_mutex_lock(&camera_mutex);
+    pslr_buffer_release(task->h, task->data);
+    g_mutex_unlock(&camera_mutex);
 
-    GInputStream *ginput = g_memory_input_stream_new_from_data (pImage, imageSize, NULL);
-    pixBuf = gdk_pixbuf_new_from_stream( ginput, NULL, &pError);
-    if (!pixBuf) {
+    if (pixBuf) {
+        task->post(task->buffer, pixBuf, task->af_points);
+    } else {
         printf("No pixbuf from loader.\n");
-        goto the_end;
     }
-    g_object_ref(pixBuf);
-    pError = NULL;
-    pMainPixbuf = pixBuf;
-    
-  the_end:
-    gtk_statusbar_pop(statusbar, sbar_download_ctx);
-
+    g_free(task);
 }
 
-static void update_preview_area(int buffer)
+/* Keep the data of a finished preview download for decode_task(),
+ * the request's user_data holds the focused AF points */
+static void decode_defer(pslr_sched_req_t *req, void (*post)(int buffer, GdkPixbuf *pixBuf, uint32_t af_points))
 {
-    GError *pError;
-    uint8_t *pImage;
-    uint32_t imageSize;
-    int r;
-    GdkPixbuf *pixBuf;
-    //    GtkWidget *pw;
+    decode_task_t *task;
 
-    //    pw = GTK_WIDGET (gtk_builder_get_object (xml, "test_draw_area"));
-    
-    gtk_statusbar_push(statusbar, sbar_download_ctx, "Getting thumbnails");
-    while (gtk_events_pending())
-        gtk_main_iteration();
+    if (req->result != PSLR_OK) {
+        if (req->result != PSLR_CANCELLED)
+            printf("Could not get buffer data\n");
+        return;
+    }
+    task = g_new(decode_task_t, 1);
+    task->h = camhandle;
+    task->buffer = req->bufno;
+    task->data = req->data;
+    task->length = req->length;
+    task->af_points = GPOINTER_TO_UINT(req->user_data);
+    task->post = post;
+    req->data = NULL;
+    camera_defer(decode_task, task);
+}
+
+/* Sharpness of the main preview, computed by the camera worker */
+typedef struct {
+    GdkPixbuf *pixbuf;
+    int buffer;
+    uint32_t af_points;         /* focused when the picture was taken */
+    bool scored;                /* false if the pixbuf is not 8 bit RGB */
+    pslr_sharpness_t sharpness;
+} main_area_result_t;
+
+static pslr_sharpness_history_t sharpness_history;
+static float main_sharpness = -1;
+static bool main_sharpness_soft = false;
+
+static gboolean main_area_idle(gpointer data)
+{
+    main_area_result_t *result = data;
 
-    DPRINT("buffer %d has new contents\n", buffer);
-    pError = NULL;
+    if (pMainPixbuf)
+        g_object_unref(pMainPixbuf);
+    pMainPixbuf = result->pixbuf;
 
-    DPRINT("Trying to get thumbnail\n");
-    r = pslr_get_buffer(camhandle, buffer, PSLR_BUF_THUMBNAIL, 4, &pImage, &imageSize);
-    if (r != PSLR_OK) {
-        printf("Could not get buffer data\n");
-        goto the_end;
+    if (result->scored) {
+        main_sharpness = pslr_sharpness_score(&result->sharpness, result->af_points);
+        main_sharpness_soft = pslr_sharpness_history_add(&sharpness_history, main_sharpness);
+        DPRINT("Sharpness of buffer %d: %.1f%s\n", result->buffer, main_sharpness, main_sharpness_soft ? " SOFT" : "");
+    } else {
+        main_sharpness = -1;
+        main_sharpness_soft = false;
     }
-    DPRINT("got %d bytes at %p\n", imageSize, pImage);
-    GInputStream *ginput = g_memory_input_stream_new_from_data (pImage, imageSize, NULL);
+    g_free(result);
 
-    pixBuf = gdk_pixbuf_new_from_stream( ginput, NULL, &pError);
-    if (!pixBuf) {
-        printf("No pixbuf from loader.\n");
-        goto the_end;
+    gtk_widget_queue_draw(GW("main_drawing_area"));
+    return FALSE;
+}
+
+/* Score a new main preview and hand it over to the main thread;
+ * called without camera_mutex */
+static void main_area_post(int buffer, GdkPixbuf *pixBuf, uint32_t af_points)
+{
+    main_area_result_t *result;
+
+    result = g_new0(main_area_result_t, 1);
+    result->pixbuf = pixBuf;
+    result->buffer = buffer;
+    result->af_points = af_points;
+    /* Scored here so the main loop stays free during continuous shooting */
+    result->scored = gdk_pixbuf_get_n_channels(pixBuf) == 3 && gdk_pixbuf_get_bits_per_sample(pixBuf) == 8;
+    if (result->scored)
+        pslr_sharpness_rgb(&result->sharpness, gdk_pixbuf_get_pixels(pixBuf),
+                           gdk_pixbuf_get_width(pixBuf), gdk_pixbuf_get_height(pixBuf),
+                           gdk_pixbuf_get_rowstride(pixBuf));
+    g_idle_add(main_area_idle, result);
+}
+
+static void main_area_done(pslr_sched_req_t *req)
+{
+    decode_defer(req, main_area_post);
+}
+
+/* af_points are the AF points focused for the picture, the sharpness
+ * is measured there */
+static void update_main_area(int buffer, uint32_t af_points)
+{
+    g_mutex_lock(&camera_mutex);
+    if (sched) {
+        DPRINT("Trying to read buffer %d\n", buffer);
+        pslr_sched_add(sched, buffer, PSLR_BUF_PREVIEW, 4, PSLR_SCHED_PREVIEW, NULL, main_area_done,
+                       GUINT_TO_POINTER(af_points));
+    }
+    g_mutex_unlock(&camera_mutex);
+    camera_wake();
+}
+
+typedef struct {
+    int buffer;
+    GdkPixbuf *pixbuf;
+} preview_icon_msg_t;
+
+static gboolean preview_icon_idle(gpointer data)
+{
+    preview_icon_msg_t *msg = data;
+    set_preview_icon(msg->buffer, msg->pixbuf);
+    g_free(msg);
+    return FALSE;
+}
+
+/* set_preview_icon() from any thread */
+static void preview_icon_post(int buffer, GdkPixbuf *pixbuf)
+{
+    preview_icon_msg_t *msg = g_new(preview_icon_msg_t, 1);
+    msg->buffer = buffer;
+    msg->pixbuf = pixbuf;
+    g_idle_add(preview_icon_idle, msg);
+}
+
+static void preview_icon_decoded(int buffer, GdkPixbuf *pixbuf, uint32_t af_points)
+{
+    preview_icon_post(buffer, pixbuf);
+}
+
+static void preview_area_done(pslr_sched_req_t *req)
+{
+    decode_defer(req, preview_icon_decoded);
+}
+
+static void update_preview_area(int buffer)
+{
+    g_mutex_lock(&camera_mutex);
+    if (sched) {
+        DPRINT("buffer %d has new contents\n", buffer);
+        pslr_sched_add(sched, buffer, PSLR_BUF_THUMBNAIL, 4, PSLR_SCHED_THUMBNAIL, NULL, preview_area_done, NULL);
     }
-    g_object_ref(pixBuf);
-    set_preview_icon(buffer, pixBuf);
-    pError = NULL;
-  the_end:
-    gtk_statusbar_pop(statusbar, sbar_download_ctx);
+    g_mutex_unlock(&camera_mutex);
+    camera_wake();
 }
 
 G_MODULE_EXPORT void menu_quit_activate_cb(GtkAction *action, gpointer user_data)
@@ -1173,6 +1596,14 @@ G_MODULE_EXPORT int mainwindow_expose(GtkAction *action, gpointer userData)
                            af_points[i].w, af_points[i].h);
     }
 
+    if (pMainPixbuf && main_sharpness >= 0) {
+        gchar *text = g_strdup_printf("sharpness %.1f%s", main_sharpness, main_sharpness_soft ? " (soft)" : "");
+        PangoLayout *layout = gtk_widget_create_pango_layout(pw, text);
+        gdk_draw_layout(pw->window, main_sharpness_soft ? gc_focus : gc_sel, 8, 8, layout);
+        g_object_unref(layout);
+        g_free(text);
+    }
+
     gdk_gc_destroy(gc_focus);
     gdk_gc_destroy(gc_sel);
     gdk_gc_destroy(gc_presel);
@@ -1216,7 +1647,10 @@ G_MODULE_EXPORT gboolean main_drawing_area_button_press_event_cb(GtkAction *acti
             while (gtk_events_pending())
                 gtk_main_iteration();
             if (status_new && status_new->af_point_select == PSLR_AF_POINT_SEL_SELECT) {
+                g_mutex_lock(&camera_mutex);
                 ret = pslr_select_af_point(camhandle, 1 << i);
+                camera_kick();
+                g_mutex_unlock(&camera_mutex);
                 if (ret != PSLR_OK)
                     DPRINT("Could not select AF point %d\n", i);
             }
@@ -1263,14 +1697,15 @@ gboolean bufferwindow_expose_event_cb(GtkWidget *widget, GdkEventExpose *pEvent,
 
 GdkPixmap *calculate_histogram( GdkPixbuf *input, int hist_w, int hist_h ) {
     guchar *pixels;
-    uint32_t histogram[256][3];
+    pslr_histogram_t histogram;
     int x, y;
-    uint32_t scale;
+    int y1, y2;
     int pitch;
     int wx1, wy1, wx2, wy2;
     GdkGC *gc;
     int input_width, input_height;
     GdkColor cWhite = { 0, 65535, 65535, 65535 };
+    GdkColor cLuma = { 0, 52000, 52000, 52000 };
 
     if( !input ) {
 	return NULL;
@@ -1294,38 +1729,38 @@ GdkPixmap *calculate_histogram( GdkPixbuf *input, int hist_w, int hist_h ) {
     pixels = gdk_pixbuf_get_pixels(input);
     pitch = gdk_pixbuf_get_rowstride(input);
 
-    memset(histogram, 0, sizeof(histogram));
-
-    for (y=9.0/160*input_height; y<(151.0/160)*input_height; y++) {
-        for (x=0; x<input_width; x++) {
-            uint8_t r = pixels[y*pitch+x*3+0];
-            uint8_t g = pixels[y*pitch+x*3+1];
-            uint8_t b = pixels[y*pitch+x*3+2];
-            histogram[r][0]++;
-            histogram[g][1]++;
-            histogram[b][2]++;
-        }
-    }
+    /* Skip the black bands of the preview */
+    y1 = 9.0/160*input_height;
+    y2 = (151.0/160)*input_height;
+    pslr_histogram_rgb(&histogram, pixels + y1*pitch, input_width, y2-y1, pitch);
+    DPRINT("clipped shadows %.2f%% highlights %.2f%%\n",
+           histogram.shadows[PSLR_HISTOGRAM_LUMA], histogram.highlights[PSLR_HISTOGRAM_LUMA]);
 
-    scale = 0;
-    for (y=0; y<3; y++) {
-        for (x=0; x<256; x++) {
-            if (histogram[x][y] > scale)
-                scale = histogram[x][y];
-        }
-    }
     // draw onto 
     GdkPixmap *output = gdk_pixmap_new( NULL, hist_w, 3*hist_h, 24);
     gc = gdk_gc_new(output);
     gdk_gc_set_rgb_fg_color(gc, &cWhite);
     gdk_draw_rectangle(output, gc, TRUE, 0, 0, hist_w, 3*hist_h);
+    if (histogram.peak == 0) {
+        return output;
+    }
 
     for (y=0; y<3; y++) {
+        /* luminance behind each channel */
+        gdk_gc_set_rgb_fg_color(gc, &cLuma);
+        for (x=0; x<256; x++) {
+            wx1 = hist_w*x / 256;
+            wx2 = hist_w*(x+1) / 256;
+            int yval = MIN(histogram.bins[PSLR_HISTOGRAM_LUMA][x], histogram.peak) * (uint64_t)hist_h / histogram.peak;
+            wy1 = (hist_h * y) + hist_h - yval;
+            wy2 = (hist_h * y) + hist_h;
+            gdk_draw_rectangle(output, gc, TRUE, wx1, wy1, wx2-wx1, wy2-wy1);
+        }
         gdk_gc_set_rgb_fg_color(gc, &hist_colors[y]);
         for (x=0; x<256; x++) {
             wx1 = hist_w*x / 256;
             wx2 = hist_w*(x+1) / 256;
-            int yval = histogram[x][y] * hist_h / scale;
+            int yval = histogram.bins[y][x] * (uint64_t)hist_h / histogram.peak;
             wy1 = (hist_h * y) + hist_h - yval;
             wy2 = (hist_h * y) + hist_h;
             gdk_draw_rectangle(output, gc, TRUE, wx1, wy1, wx2-wx1, wy2-wy1);
@@ -1348,28 +1783,36 @@ G_MODULE_EXPORT void shutter_press(GtkAction *action)
       is_bulbing_on = FALSE;
       gtk_button_set_label((GtkButton *)widget, "Take picture");
       /* drop current bulb shooting */
+      g_mutex_lock(&camera_mutex);
       pslr_bulb(camhandle, false);
+      camera_kick();
+      g_mutex_unlock(&camera_mutex);
       if (pslr_get_model_only_limited(camhandle)) {
 	manage_camera_buffers_limited();
       }
       return;
     }
     DPRINT("Shutter press.\n");
+    g_mutex_lock(&camera_mutex);
+    /* The worker downloads between commands; close the open buffer
+     * so the shutter is not delayed, it is continued later */
+    if (sched)
+        pslr_sched_pause(sched);
     pslr_get_status(camhandle, &status);
     if (status.exposure_mode == PSLR_GUI_EXPOSURE_MODE_B) {
       GtkWidget * pw;
       pw = GTK_WIDGET (gtk_builder_get_object (xml, "bulb_exp_value"));
       bulb_exp_str = gtk_entry_get_text(GTK_ENTRY(pw));
-      if (bulb_exp_str == NULL) {
-	return;
-      }
-      shutter_speed = atoi(bulb_exp_str);
+      shutter_speed = bulb_exp_str ? atoi(bulb_exp_str) : 0;
       if (shutter_speed <= 0) {
+	g_mutex_unlock(&camera_mutex);
 	return;
       }
       is_bulbing_on = TRUE;
       pslr_bulb(camhandle, true);
       pslr_shutter(camhandle);
+      camera_kick();
+      g_mutex_unlock(&camera_mutex);
       while(shutter_speed > 0 && is_bulbing_on == TRUE) {
 	static gchar bulb_message[100];
 	sprintf (bulb_message, "BULB -> wait : %d seconds", shutter_speed);
@@ -1381,12 +1824,17 @@ G_MODULE_EXPORT void shutter_press(GtkAction *action)
 	}
       }
       if (is_bulbing_on == TRUE) {
+	g_mutex_lock(&camera_mutex);
 	pslr_bulb(camhandle, false);
+	camera_kick();
+	g_mutex_unlock(&camera_mutex);
 	is_bulbing_on = FALSE;
 	gtk_button_set_label((GtkButton *)widget, "Take picture");
       }
     } else {
       r = pslr_shutter(camhandle);
+      camera_kick();
+      g_mutex_unlock(&camera_mutex);
       if (r != PSLR_OK) {
         DPRINT("shutter error\n");
         return;
@@ -1402,7 +1850,10 @@ G_MODULE_EXPORT void focus_button_clicked_cb(GtkAction *action)
 {
     DPRINT("Focus");
     int ret;
+    g_mutex_lock(&camera_mutex);
     ret = pslr_focus(camhandle);
+    camera_kick();
+    g_mutex_unlock(&camera_mutex);
     if (ret != PSLR_OK) {
         DPRINT("Focus failed: %d\n", ret);
     }
@@ -1414,7 +1865,9 @@ G_MODULE_EXPORT void status_button_clicked_cb(GtkAction *action)
     GtkWidget *pw;
     pslr_status st;    
 
+    g_mutex_lock(&camera_mutex);
     pslr_get_status(camhandle, &st);
+    g_mutex_unlock(&camera_mutex);
 
     char *collected_status = collect_status_info(  camhandle, st );
     GtkLabel *label = GTK_LABEL(GTK_WIDGET (gtk_builder_get_object (xml, "status_label")));
@@ -1432,7 +1885,10 @@ G_MODULE_EXPORT void green_button_clicked_cb(GtkAction *action)
 {
     DPRINT("Green btn");
     int ret;
+    g_mutex_lock(&camera_mutex);
     ret = pslr_green_button( camhandle );
+    camera_kick();
+    g_mutex_unlock(&camera_mutex);
     if (ret != PSLR_OK) {
         DPRINT("Green button failed: %d\n", ret);
     }
@@ -1449,7 +1905,10 @@ G_MODULE_EXPORT void ae_lock_button_toggled_cb(GtkAction *action)
         return;
     locked = (status_new->light_meter_flags & PSLR_LIGHT_METER_AE_LOCK) != 0;
     if (locked != active) {
+        g_mutex_lock(&camera_mutex);
         ret = pslr_ae_lock(camhandle, active);
+        camera_kick();
+        g_mutex_unlock(&camera_mutex);
         if (ret != PSLR_OK) {
             DPRINT("AE lock failed: %d\n", ret);
         }
@@ -1464,11 +1923,34 @@ static void my_atexit(void)
 static gboolean added_quit(gpointer data)
 {
     DPRINT("added_quit\n");
+    if (camera_thread) {
+        g_mutex_lock(&camera_mutex);
+        camera_quit = true;
+        g_cond_signal(&camera_cond);
+        g_mutex_unlock(&camera_mutex);
+        g_thread_join(camera_thread);
+        camera_thread = NULL;
+    }
+    /* Queued downloads are dropped, partial files removed */
+    g_mutex_lock(&camera_mutex);
+    pslr_sched_free(sched);
+    sched = NULL;
+    camera_run_tasks();
+    g_mutex_unlock(&camera_mutex);
+    if (watch) {
+        pslr_watch_stats_t stats;
+        pslr_watch_get_stats(watch, &stats);
+        DPRINT("Status polls: %llu, %llu with changes, %llu us average, %llu us max, kick latency %llu us\n",
+               (unsigned long long) stats.polls, (unsigned long long) stats.changed_polls,
+               (unsigned long long) (stats.polls ? stats.poll_us / stats.polls : 0),
+               (unsigned long long) stats.max_poll_us, (unsigned long long) stats.kick_latency_us);
+    }
     if (camhandle) {
         pslr_disconnect(camhandle);
         pslr_shutdown(camhandle);
         camhandle = 0;
     }
+    watch = NULL;
     return FALSE;
 }
 
@@ -1681,7 +2163,10 @@ G_MODULE_EXPORT void aperture_scale_value_changed_cb(GtkAction *action, gpointer
     value.nom = aperture_tbl[idx];
     value.denom = 10;
     DPRINT("aperture->%d/%d\n", value.nom, value.denom);
+    g_mutex_lock(&camera_mutex);
     ret = pslr_set_aperture(camhandle, value);
+    camera_kick();
+    g_mutex_unlock(&camera_mutex);
     if (ret != PSLR_OK) {
         DPRINT("Set aperture failed: %d\n", ret);
     }
@@ -1706,7 +2191,10 @@ G_MODULE_EXPORT void shutter_scale_value_changed_cb(GtkAction *action, gpointer
     assert(idx < steps);
     value = tbl[idx];
     DPRINT("shutter->%d/%d\n", value.nom, value.denom);
+    g_mutex_lock(&camera_mutex);
     ret = pslr_set_shutter(camhandle, value);
+    camera_kick();
+    g_mutex_unlock(&camera_mutex);
     if (ret != PSLR_OK) {
         DPRINT("Set shutter failed: %d\n", ret);
     }
@@ -1736,7 +2224,10 @@ G_MODULE_EXPORT void iso_scale_value_changed_cb(GtkAction *action, gpointer user
      * user change, and we should NOT send any new value to the
      * camera; for example the Fn menu will be exited if we do. */
     if (status_new->fixed_iso != tbl[idx]) {
+        g_mutex_lock(&camera_mutex);
         ret = pslr_set_iso(camhandle, tbl[idx], 0, 0);
+        camera_kick();
+        g_mutex_unlock(&camera_mutex);
         if (ret != PSLR_OK) {
             DPRINT("Set ISO failed: %d\n", ret);
         }
@@ -1766,7 +2257,10 @@ G_MODULE_EXPORT void ec_scale_value_changed_cb(GtkAction *action, gpointer user_
     if (status_new == NULL)
         return;
     if (status_new->ec.nom != new_ec.nom || status_new->ec.denom != new_ec.denom) {
+        g_mutex_lock(&camera_mutex);
         ret = pslr_set_ec(camhandle, new_ec);
+        camera_kick();
+        g_mutex_unlock(&camera_mutex);
         if (ret != PSLR_OK) {
             DPRINT("Set EC failed: %d\n", ret);
         }
@@ -1789,7 +2283,9 @@ G_MODULE_EXPORT void jpeg_resolution_combo_changed_cb(GtkAction *action, gpointe
     DPRINT("jpeg res active->%d\n", megapixel);
     /* Prevent menu exit (see comment for iso_scale_value_changed_cb) */
     if (status_new == NULL || pslr_get_jpeg_resolution(camhandle, status_new->jpeg_resolution) != megapixel) {
+        g_mutex_lock(&camera_mutex);
         ret = pslr_set_jpeg_resolution(camhandle, megapixel);
+        g_mutex_unlock(&camera_mutex);
         if (ret != PSLR_OK) {
             DPRINT("Set JPEG resolution failed.\n");
         }
@@ -1806,7 +2302,9 @@ G_MODULE_EXPORT void jpeg_quality_combo_changed_cb(GtkAction *action, gpointer u
 
     /* Prevent menu exit (see comment for iso_scale_value_changed_cb) */
     if (status_new == NULL || status_new->jpeg_quality != val) {
+        g_mutex_lock(&camera_mutex);
         ret = pslr_set_jpeg_stars(camhandle, val);
+        g_mutex_unlock(&camera_mutex);
         if (ret != PSLR_OK) {
             DPRINT("Set JPEG quality failed.\n");
         }
@@ -1822,7 +2320,9 @@ G_MODULE_EXPORT void jpeg_image_tone_combo_changed_cb(GtkAction *action, gpointe
     assert( (int)val < PSLR_JPEG_IMAGE_TONE_MAX);
     /* Prevent menu exit (see comment for iso_scale_value_changed_cb) */
     if( val != -1 && (status_new == NULL || status_new->jpeg_image_tone != val) ) {
+        g_mutex_lock(&camera_mutex);
         ret = pslr_set_jpeg_image_tone(camhandle, val);
+        g_mutex_unlock(&camera_mutex);
         if (ret != PSLR_OK) {
             DPRINT("Set JPEG image tone failed.\n");
         }
@@ -1835,7 +2335,9 @@ G_MODULE_EXPORT void jpeg_sharpness_scale_value_changed_cb(GtkAction *action, gp
     int ret;
     assert(value >= -get_jpeg_property_shift());
     assert(value <= get_jpeg_property_shift());
+    g_mutex_lock(&camera_mutex);
     ret = pslr_set_jpeg_sharpness(camhandle, value);
+    g_mutex_unlock(&camera_mutex);
     if (ret != PSLR_OK) {
         DPRINT("Set JPEG sharpness failed.\n");
     }
@@ -1847,7 +2349,9 @@ G_MODULE_EXPORT void jpeg_contrast_scale_value_changed_cb(GtkAction *action, gpo
     int ret;
     assert(value >= -get_jpeg_property_shift());
     assert(value <= get_jpeg_property_shift());
+    g_mutex_lock(&camera_mutex);
     ret = pslr_set_jpeg_contrast(camhandle, value);
+    g_mutex_unlock(&camera_mutex);
     if (ret != PSLR_OK) {
         DPRINT("Set JPEG contrast failed.\n");
     }
@@ -1859,7 +2363,9 @@ G_MODULE_EXPORT void jpeg_hue_scale_value_changed_cb(GtkAction *action, gpointer
     int ret;
     assert(value >= -get_jpeg_property_shift());
     assert(value <= get_jpeg_property_shift());
+    g_mutex_lock(&camera_mutex);
     ret = pslr_set_jpeg_hue(camhandle, value);
+    g_mutex_unlock(&camera_mutex);
     if (ret != PSLR_OK) {
         DPRINT("Set JPEG hue failed.\n");
     }
@@ -1872,7 +2378,9 @@ G_MODULE_EXPORT void jpeg_saturation_scale_value_changed_cb(GtkAction *action, g
     int ret;
     assert(value >= -get_jpeg_property_shift());
     assert(value <= get_jpeg_property_shift());
+    g_mutex_lock(&camera_mutex);
     ret = pslr_set_jpeg_saturation(camhandle, value);
+    g_mutex_unlock(&camera_mutex);
     if (ret != PSLR_OK) {
         DPRINT("Set JPEG saturation failed.\n");
     }
@@ -1903,30 +2411,157 @@ G_MODULE_EXPORT void preview_icon_view_selection_changed_cb(GtkAction *action)
     gtk_widget_set_sensitive(pw, en);
 }
 
+typedef struct {
+    int fd;
+    gchar *filename;
+    save_group_t *group;
+    int bufno;                  /* result for save_task() */
+    int result;
+    bool previews;
+} save_job_t;
+
+static int save_sink(pslr_sched_req_t *req, const uint8_t *data, uint32_t n)
+{
+    save_job_t *job = req->user_data;
+
+    if (write(job->fd, data, n) != n) {
+        perror("could not write target");
+        return -1;
+    }
+    progress_set_bar(job->filename, (gdouble) req->offset / (gdouble) req->length);
+    return 0;
+}
+
 /*
- * Save the indicated buffer using the current UI file format
- * settings.  Updates the progress bar periodically & runs the GTK
- * main loop to show it.
+ * Thumbnail and main preview from a saved file instead of two more
+ * downloads: JPEG files are decoded directly, PEF and DNG files
+ * through their largest embedded JPEG. gdk-pixbuf decodes at the
+ * reduced size, which is fast even for full size JPEGs.
  */
-static void save_buffer(int bufno, const char *filename)
+static bool previews_from_file(int buffer, const char *filename, bool main_area, uint32_t af_points)
+{
+    gchar *contents;
+    gsize length;
+    uint32_t offset = 0;
+    uint32_t jpeg_length;
+    GInputStream *ginput;
+    GdkPixbuf *pixBuf;
+    GdkPixbuf *thumb;
+    GError *pError = NULL;
+
+    if (!g_file_get_contents(filename, &contents, &length, NULL))
+        return false;
+    jpeg_length = length;
+    if (length < 2 || (guchar) contents[0] != 0xff || (guchar) contents[1] != 0xd8) {
+        if (pslr_raw_find_preview((uint8_t *) contents, length, &offset, &jpeg_length) != PSLR_OK) {
+            g_free(contents);
+            return false;
+        }
+    }
+    ginput = g_memory_input_stream_new_from_data(contents + offset, jpeg_length, NULL);
+    pixBuf = gdk_pixbuf_new_from_stream_at_scale(ginput, 640, 480, TRUE, NULL, &pError);
+    g_object_unref(ginput);
+    g_free(contents);
+    if (!pixBuf) {
+        DPRINT("No preview in %s: %s\n", filename, pError ? pError->message : "");
+        if (pError)
+            g_error_free(pError);
+        return false;
+    }
+
+    thumb = gdk_pixbuf_scale_simple(pixBuf, THUMBNAIL_WIDTH,
+                                    THUMBNAIL_WIDTH * gdk_pixbuf_get_height(pixBuf) / gdk_pixbuf_get_width(pixBuf),
+                                    GDK_INTERP_BILINEAR);
+    if (thumb)
+        preview_icon_post(buffer, thumb);
+    if (main_area)
+        main_area_post(buffer, pixBuf, af_points);
+    else
+        g_object_unref(pixBuf);
+    return true;
+}
+
+/*
+ * The rest of a finished download of a group: previews from the saved
+ * file and the delete of the buffer, run without camera_mutex.
+ */
+static void save_task(gpointer data)
+{
+    save_job_t *job = data;
+    save_group_t *group = job->group;
+    bool previews = false;
+
+    if (job->previews) {
+        previews = job->result == PSLR_OK
+            && previews_from_file(job->bufno, job->filename, group->main_area, group->af_points);
+        g_mutex_lock(&camera_mutex);
+        if (!previews && sched && (group->failed || !group->autodelete || group->pending > 1)) {
+            /* Fall back to the camera while the buffer is still there;
+             * the previews outrank the remaining file of the group */
+            if (group->main_area)
+                pslr_sched_add(sched, job->bufno, PSLR_BUF_PREVIEW, 4, PSLR_SCHED_PREVIEW, NULL, main_area_done,
+                               GUINT_TO_POINTER(group->af_points));
+            pslr_sched_add(sched, job->bufno, PSLR_BUF_THUMBNAIL, 4, PSLR_SCHED_THUMBNAIL, NULL, preview_area_done, NULL);
+        }
+        g_mutex_unlock(&camera_mutex);
+    }
+    save_group_release(group, job->bufno);
+    g_free(job->filename);
+    g_free(job);
+}
+
+static void save_done(pslr_sched_req_t *req)
+{
+    save_job_t *job = req->user_data;
+    save_group_t *group = job->group;
+
+    close(job->fd);
+    if (req->result != PSLR_OK) {
+        DPRINT("Download of buffer %d stopped at %d/%d: %d\n", req->bufno, req->offset, req->length, req->result);
+        unlink(job->filename);
+        if (group) {
+            group->failed = true;
+        }
+    }
+    /* Dropped requests are finished at quit too, when the widgets may be gone */
+    if (req->result != PSLR_CANCELLED) {
+        progress_set_bar(NULL, 0.0);
+    }
+    if (group) {
+        job->bufno = req->bufno;
+        job->result = req->result;
+        job->previews = group->previews && req->result != PSLR_CANCELLED;
+        if (job->previews)
+            group->previews = false;
+        camera_defer(save_task, job);
+        return;
+    }
+    g_free(job->filename);
+    g_free(job);
+}
+
+/*
+ * Queue the download of the indicated buffer in the given format,
+ * using the current UI JPEG settings. The progress bar is updated as
+ * the blocks arrive; a failed download removes the partial file. The
+ * download counts in the group, if any. Called with camera_mutex held.
+ */
+static bool save_buffer(int bufno, const char *filename, user_file_format filefmt, save_group_t *group)
 {
-    int r;
     int fd;
     GtkWidget *pw;
     int quality;
     int resolution;
-    int filefmt;
     pslr_buffer_type imagetype;
-    uint8_t buf[65536];
-    uint32_t length;
-    uint32_t current;
+    save_job_t *job;
+
+    if (!sched)
+        return false;
 
     pw = GTK_WIDGET (gtk_builder_get_object (xml, "jpeg_quality_combo"));
     quality = gtk_combo_box_get_active(GTK_COMBO_BOX(pw));
     pw = GTK_WIDGET (gtk_builder_get_object (xml, "jpeg_resolution_combo"));
     resolution = gtk_combo_box_get_active(GTK_COMBO_BOX(pw));
-    pw = GTK_WIDGET (gtk_builder_get_object (xml, "file_format_combo"));
-    filefmt = gtk_combo_box_get_active(GTK_COMBO_BOX(pw));
 
     if (filefmt == USER_FILE_FORMAT_PEF) {
       imagetype = PSLR_BUF_PEF;
@@ -1937,49 +2572,40 @@ static void save_buffer(int bufno, const char *filename)
     }
     DPRINT("get buffer %d type %d res %d\n", bufno, imagetype, resolution);
 
-    r = pslr_buffer_open(camhandle, bufno, imagetype, resolution);
-    if (r != PSLR_OK) {
-        DPRINT("Could not open buffer: %d\n", r);
-        return;
-    }
-
-    length = pslr_buffer_get_size(camhandle);
-    current = 0;
-
     fd = open(filename, FILE_ACCESS, 0664);
     if (fd == -1) {
         perror("could not open target");
-        return;
+        return false;
     }
 
-    pw = GTK_WIDGET (gtk_builder_get_object (xml, "download_progress"));
-
-    while (1) {
-        uint32_t bytes;
-        bytes = pslr_buffer_read(camhandle, buf, sizeof(buf));
-        //printf("Read %d bytes\n", bytes);
-        if (bytes == 0)
-            break;
-        write(fd, buf, bytes);
-        current += bytes;
-        gtk_progress_bar_update(GTK_PROGRESS_BAR(pw), (gdouble) current / (gdouble) length);
-        /* process pending events */
-        while (gtk_events_pending())
-            gtk_main_iteration();
+    job = g_new0(save_job_t, 1);
+    job->fd = fd;
+    job->filename = g_strdup(filename);
+    job->group = group;
+    if (group) {
+        group->pending++;
     }
-    close(fd);
-    pslr_buffer_close(camhandle);
+    if (!pslr_sched_add(sched, bufno, imagetype, resolution, PSLR_SCHED_FULL, save_sink, save_done, job)) {
+        if (group) {
+            group->pending--;
+        }
+        close(fd);
+        unlink(filename);
+        g_free(job->filename);
+        g_free(job);
+        return false;
+    }
+    camera_wake();
+    return true;
 }
 
 G_MODULE_EXPORT void preview_save_as_cb(GtkAction *action)
 {
     GtkWidget *pw, *icon_view;
     GList *l, *i;
-    GtkProgressBar *pbar;
     DPRINT("preview save as\n");
     icon_view = GTK_WIDGET (gtk_builder_get_object (xml, "preview_icon_view"));
     l = gtk_icon_view_get_selected_items(GTK_ICON_VIEW(icon_view));
-    pbar = (GtkProgressBar *) GTK_WIDGET (gtk_builder_get_object (xml, "download_progress"));
     for (i=g_list_first(l); i; i=g_list_next(i)) {
         GtkTreePath *p;
         int d, *pi;
@@ -1999,9 +2625,11 @@ G_MODULE_EXPORT void preview_save_as_cb(GtkAction *action)
             char *filename;
             filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (pw));
             DPRINT("Save to: %s\n", filename);
-            gtk_progress_bar_set_text(pbar, filename);
-            save_buffer(*pi, filename);
-            gtk_progress_bar_set_text(pbar, NULL);
+            pw = GTK_WIDGET (gtk_builder_get_object (xml, "file_format_combo"));
+            g_mutex_lock(&camera_mutex);
+            save_buffer(*pi, filename, gtk_combo_box_get_active(GTK_COMBO_BOX(pw)), NULL);
+            g_mutex_unlock(&camera_mutex);
+            g_free(filename);
         }
     }
 
@@ -2042,6 +2670,9 @@ G_MODULE_EXPORT void preview_delete_button_clicked_cb(GtkAction *action)
         // needed? : g_object_unref(thumbpixbufs[i])?
         set_preview_icon(*pi, NULL);
 
+        g_mutex_lock(&camera_mutex);
+        if (sched)
+            pslr_sched_drop(sched, *pi);
         ret = pslr_delete_buffer(camhandle, *pi);
         if (ret != PSLR_OK)
             DPRINT("Could not delete buffer %d: %d\n", *pi, ret);
@@ -2051,6 +2682,7 @@ G_MODULE_EXPORT void preview_delete_button_clicked_cb(GtkAction *action)
                 break;
             DPRINT("Buffer not gone - retry\n");
         }
+        g_mutex_unlock(&camera_mutex);
     }
 
     g_list_foreach (l, (GFunc) gtk_tree_path_free, NULL);
@@ -2060,7 +2692,9 @@ G_MODULE_EXPORT void preview_delete_button_clicked_cb(GtkAction *action)
 G_MODULE_EXPORT void file_format_combo_changed_cb(GtkAction *action, gpointer user_data)
 {
     int val = gtk_combo_box_get_active(GTK_COMBO_BOX(GW("file_format_combo")));
+    g_mutex_lock(&camera_mutex);
     pslr_set_user_file_format( camhandle, val );
+    g_mutex_unlock(&camera_mutex);
 }
 
 G_MODULE_EXPORT void user_mode_combo_changed_cb(GtkAction *action, gpointer user_data)
@@ -2071,7 +2705,9 @@ G_MODULE_EXPORT void user_mode_combo_changed_cb(GtkAction *action, gpointer user
     assert(val >= 0);
     assert(val < PSLR_EXPOSURE_MODE_MAX);
 
+    g_mutex_lock(&camera_mutex);
     pslr_set_exposure_mode(camhandle, val);
+    g_mutex_unlock(&camera_mutex);
 }
 
 /* ----------------------------------------------------------------------- */
@@ -49,12 +49,18 @@
 #include "pslr.h"
 #include "pslr_scsi.h"
 #include "pslr_lens.h"
+#include "pslr_watch.h"
 
 #define POLL_INTERVAL 100000 /* Number of us to wait when polling */
 #define BLKSZ 65536 /* Block size for downloads; if too big, we get
                      * memory allocation error from sg driver */
 #define BLOCK_RETRY 3 /* Number of retries, since we can occasionally
                        * get SCSI errors when downloading data */
+#define SCSI_TIMEOUT 5000 /* Base timeout of a scsi transaction in ms */
+#define SCSI_MIN_RATE 32  /* Slowest transfer rate we wait for in bytes/ms;
+                           * a full block gets SCSI_TIMEOUT + 2 seconds */
+#define SCSI_MIN_TIMEOUT 1000 /* Never cut a transaction shorter than this
+                               * to meet a download deadline */
 
 #define CHECK(x) do {                           \
         int __r;                                \
@@ -86,13 +92,16 @@ static int ipslr_select_buffer(ipslr_handle_t *p, int bufno, pslr_buffer_type bu
 static int ipslr_buffer_segment_info(ipslr_handle_t *p, pslr_buffer_segment_info *pInfo);
 static int ipslr_next_segment(ipslr_handle_t *p);
 static int ipslr_download(ipslr_handle_t *p, uint32_t addr, uint32_t length, uint8_t *buf);
+static uint32_t ipslr_buffer_size(ipslr_handle_t *p);
 static int ipslr_identify(ipslr_handle_t *p);
 static int ipslr_write_args(ipslr_handle_t *p, int n, ...);
 
-static int command(int fd, int a, int b, int c);
-static int get_status(int fd);
-static int get_result(int fd);
-static int read_result(int fd, uint8_t *buf, uint32_t n);
+static int command(ipslr_handle_t *p, int a, int b, int c);
+static int get_status(ipslr_handle_t *p);
+static int get_result(ipslr_handle_t *p);
+static int read_result(ipslr_handle_t *p, uint8_t *buf, uint32_t n);
+static int ipslr_scsi_read(ipslr_handle_t *p, uint8_t *cmd, uint32_t cmdLen, uint8_t *buf, uint32_t bufLen);
+static int ipslr_scsi_write(ipslr_handle_t *p, uint8_t *cmd, uint32_t cmdLen, uint8_t *buf, uint32_t bufLen);
 
 void hexdump(uint8_t *buf, uint32_t bufLen);
 
@@ -255,13 +264,16 @@ pslr_handle_t pslr_init( char *model, char *device ) {
     char **drives;
     const char *camera_name;
 
+    if( pslr.trace.start_sec == 0 ) {
+	pslr_trace_init( &pslr.trace );
+    }
+
     if( device == NULL ) {
 	drives = get_drives(&driveNum);
     } else {
 	driveNum = 1;
 	drives = malloc( driveNum * sizeof(char*) );
-        drives[0] = malloc( sizeof( device ) );
-	strncpy( drives[0], device, sizeof( device ) );
+        drives[0] = strdup( device );
     }
     int i;
     for( i=0; i<driveNum; ++i ) {
@@ -274,6 +286,11 @@ pslr_handle_t pslr_init( char *model, char *device ) {
 		DPRINT("Found camera %s %s\n", vendorId, productId);
         open_drive(&fd, drives[i]); 
 		pslr.fd = fd;
+		// every body reports the same SCSI product, so a previous
+		// camera's model id must not survive on the static handle
+		pslr.id1 = 0;
+		pslr.model = NULL;
+		pslr.status_stale = true;
 		if( model != NULL ) {
 		    // user specified the camera model
 		    camera_name = pslr_camera_name( &pslr );
@@ -304,15 +321,28 @@ pslr_handle_t pslr_init( char *model, char *device ) {
     return NULL;
 }
 
-int pslr_connect(pslr_handle_t h) {
-    ipslr_handle_t *p = (ipslr_handle_t *) h;
+/* The fast handshake skips two of the three full status reads: the one
+ * before cmd 00 09 was only printed, and the final one is deferred to
+ * the first pslr_get_status() or pslr_get_status_buffer(). Until then
+ * p->status is the one read before cmd 10 0a and marked stale.
+ * ipslr_identify() is cheap (8 bytes) and always run, as the drive
+ * identity does not tell the bodies apart. */
+static int ipslr_connect(ipslr_handle_t *p, bool fast) {
     uint8_t statusbuf[28];
+
     CHECK(ipslr_status(p, statusbuf));
     CHECK(ipslr_set_mode(p, 1));
     CHECK(ipslr_status(p, statusbuf));
     CHECK(ipslr_identify(p));
-    CHECK(ipslr_status_full(p, &p->status));
-    DPRINT("init bufmask=0x%x\n", p->status.bufmask);
+    if (!p->model) {
+        DPRINT("Unknown camera id %x\n", p->id1);
+        return PSLR_DEVICE_ERROR;
+    }
+    PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_CONNECT, p->id1, fast, 0);
+    if (!fast) {
+        CHECK(ipslr_status_full(p, &p->status));
+        DPRINT("init bufmask=0x%x\n", p->status.bufmask);
+    }
     if( !p->model->old_scsi_command ) {
         CHECK(ipslr_cmd_00_09(p, 2));
     }
@@ -322,13 +352,42 @@ int pslr_connect(pslr_handle_t h) {
         CHECK(ipslr_cmd_00_05(p));
     }
 
-    CHECK(ipslr_status_full(p, &p->status));
-    return 0;
+    if (!fast) {
+        CHECK(ipslr_status_full(p, &p->status));
+    } else {
+        p->status_stale = true;
+    }
+    return PSLR_OK;
+}
+
+int pslr_connect(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    uint64_t start_us = pslr_metrics_now_us();
+    int ret = ipslr_connect(p, false);
+    pslr_metrics_record(&p->metrics, PSLR_METRIC_CONNECT, start_us);
+    return ret;
+}
+
+/* Shorter handshake for the models known to this library, falls back
+ * to the full one if it fails */
+int pslr_connect_fast(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    uint64_t start_us = pslr_metrics_now_us();
+    int ret = ipslr_connect(p, true);
+    if (ret != PSLR_OK) {
+        DPRINT("Fast connect failed: %d, trying the full handshake\n", ret);
+        p->id1 = 0;
+        p->model = NULL;
+        ret = ipslr_connect(p, false);
+    }
+    pslr_metrics_record(&p->metrics, PSLR_METRIC_CONNECT, start_us);
+    return ret;
 }
 
 int pslr_disconnect(pslr_handle_t h) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     uint8_t statusbuf[28];
+    PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_DISCONNECT, 0, 0, 0);
     CHECK(ipslr_cmd_10_0a(p, 0));
     CHECK(ipslr_set_mode(p, 0));
     CHECK(ipslr_status(p, statusbuf));
@@ -338,6 +397,9 @@ int pslr_disconnect(pslr_handle_t h) {
 int pslr_shutdown(pslr_handle_t h) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     close_drive(&p->fd);
+    pslr_pool_trim(&p->pool);
+    pslr_watch_free(p->watch);
+    p->watch = NULL;
     return PSLR_OK;
 }
 
@@ -442,35 +504,52 @@ char *collect_status_info( pslr_handle_t h, pslr_status status ) {
 
 int pslr_get_status_buffer(pslr_handle_t h, uint8_t *st_buf) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
+    int ret;
     memset( st_buf, 0, MAX_STATUS_BUF_SIZE);
 //    CHECK(ipslr_status_full(p, &p->status));
-    ipslr_status_full(p, &p->status);
+    ret = ipslr_status_full(p, &p->status);
+    if (ret != PSLR_OK && p->status_stale) {
+        // nothing read since the fast connect, do not hand out the old buffer
+        return ret;
+    }
     memcpy(st_buf, p->status_buffer, MAX_STATUS_BUF_SIZE);
     return PSLR_OK;
 }
 
-int pslr_get_buffer(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
-        uint8_t **ppData, uint32_t *pLen) {
+static int ipslr_get_buffer(ipslr_handle_t *p, int bufno, pslr_buffer_type type, int resolution,
+        bool pooled, uint8_t **ppData, uint32_t *pLen) {
     uint8_t *buf = 0;
     int ret;
-    ret = pslr_buffer_open(h, bufno, type, resolution);
+    ret = pslr_buffer_open(p, bufno, type, resolution);
     if( ret != PSLR_OK ) {
 	return ret;
     }
 
-    uint32_t size = pslr_buffer_get_size(h);
-    buf = malloc(size); 
+    uint32_t size = pslr_buffer_get_size(p);
+    buf = pooled ? pslr_pool_get(&p->pool, size) : malloc(size);
     if (!buf) {
+	pslr_buffer_close(p);
 	return PSLR_NO_MEMORY;
     }
 
-    int bytes = pslr_buffer_read(h, buf, size);
-
-    if( bytes != size ) {
-	return PSLR_READ_ERROR;
+    uint32_t bytes = 0;
+    uint32_t n;
+    while (bytes < size && (n = pslr_buffer_read(p, buf + bytes, size - bytes)) > 0) {
+	bytes += n;
     }
-    pslr_buffer_close(h);
-    if (ppData) {
+
+    ret = bytes != size ? pslr_buffer_get_result(p) : PSLR_OK;
+    pslr_buffer_close(p);
+    if( bytes != size || !ppData ) {
+	if (pooled) {
+	    pslr_pool_put(&p->pool, buf);
+	} else {
+	    free(buf);
+	}
+	if( bytes != size ) {
+	    return ret != PSLR_OK ? ret : PSLR_READ_ERROR;
+	}
+    } else {
 	*ppData = buf;
     }
     if (pLen) {
@@ -480,6 +559,28 @@ int pslr_get_buffer(pslr_handle_t h, int bufno, pslr_buffer_type type, int resol
     return PSLR_OK;
 }
 
+int pslr_get_buffer(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
+        uint8_t **ppData, uint32_t *pLen) {
+    return ipslr_get_buffer((ipslr_handle_t *) h, bufno, type, resolution, false, ppData, pLen);
+}
+
+/* Same as pslr_get_buffer, but the data comes from the buffer pool of
+ * the handle and has to be given back with pslr_buffer_release() */
+int pslr_get_buffer_pooled(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
+        uint8_t **ppData, uint32_t *pLen) {
+    return ipslr_get_buffer((ipslr_handle_t *) h, bufno, type, resolution, true, ppData, pLen);
+}
+
+uint8_t *pslr_buffer_alloc(pslr_handle_t h, uint32_t size) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    return pslr_pool_get(&p->pool, size);
+}
+
+void pslr_buffer_release(pslr_handle_t h, uint8_t *data) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    pslr_pool_put(&p->pool, data);
+}
+
 int pslr_set_progress_callback(pslr_handle_t h, pslr_progress_callback_t cb, uintptr_t user_data) {
     progress_callback = cb;
     return PSLR_OK;
@@ -501,9 +602,10 @@ int ipslr_handle_command_x18( ipslr_handle_t *p, bool cmd9_wrap, int subcommand,
 	args[i] = va_arg(ap, int);
     }
     va_end(ap);
+    PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_X18, subcommand, argnum, args[0]);
     CHECK(ipslr_write_args(p, argnum, args[0], args[1], args[2], args[3]));
-    CHECK(command(p->fd, 0x18, subcommand, 4 * argnum));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x18, subcommand, 4 * argnum));
+    CHECK(get_status(p));
     if( cmd9_wrap ) {
         CHECK(ipslr_cmd_00_09(p, 2));
     }
@@ -687,31 +789,32 @@ int pslr_delete_buffer(pslr_handle_t h, int bufno) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     if (bufno < 0 || bufno > 9)
         return PSLR_PARAM;
+    PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_DELETE_BUFFER, bufno, 0, 0);
     CHECK(ipslr_write_args(p, 1, bufno));
-    CHECK(command(p->fd, 0x02, 0x03, 0x04));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x02, 0x03, 0x04));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 int pslr_green_button(pslr_handle_t h) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
-    CHECK(command(p->fd, 0x10, X10_GREEN, 0x00));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x10, X10_GREEN, 0x00));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 int pslr_dust_removal(pslr_handle_t h) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
-    CHECK(command(p->fd, 0x10, X10_DUST, 0x00));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x10, X10_DUST, 0x00));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 int pslr_bulb(pslr_handle_t h, bool on ) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     CHECK(ipslr_write_args(p, 1, on ? 1 : 0));
-    CHECK(command(p->fd, 0x10, X10_BULB, 0x04));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x10, X10_BULB, 0x04));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
@@ -719,8 +822,8 @@ int pslr_button_test(pslr_handle_t h, int bno, int arg) {
     int r;
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     CHECK(ipslr_write_args(p, 1, arg));
-    CHECK(command(p->fd, 0x10, bno, 4));
-    r = get_status(p->fd);
+    CHECK(command(p, 0x10, bno, 4));
+    r = get_status(p);
     DPRINT("button result code: 0x%x\n", r);
     return PSLR_OK;
 }
@@ -729,10 +832,10 @@ int pslr_button_test(pslr_handle_t h, int bno, int arg) {
 int pslr_ae_lock(pslr_handle_t h, bool lock) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     if (lock)
-        CHECK(command(p->fd, 0x10, X10_AE_LOCK, 0x00));
+        CHECK(command(p, 0x10, X10_AE_LOCK, 0x00));
     else
-        CHECK(command(p->fd, 0x10, X10_AE_UNLOCK, 0x00));
-    CHECK(get_status(p->fd));
+        CHECK(command(p, 0x10, X10_AE_UNLOCK, 0x00));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
@@ -759,7 +862,11 @@ int pslr_buffer_open(pslr_handle_t h, int bufno, pslr_buffer_type buftype, int b
     ipslr_handle_t *p = (ipslr_handle_t *) h;
 
     memset(&info, 0, sizeof (info));
+    p->buffer_cancel = 0;
+    p->buffer_result = PSLR_OK;
+    p->buffer_busy = 1;
 
+    PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_BUFFER_OPEN, bufno, buftype, bufres);
     CHECK(ipslr_status_full(p, &p->status));
     bufs = p->status.bufmask;
     if( p->model->parser_function && (bufs & (1 << bufno)) == 0) {
@@ -784,6 +891,8 @@ int pslr_buffer_open(pslr_handle_t h, int bufno, pslr_buffer_type buftype, int b
             CHECK(ipslr_buffer_segment_info(p, &info));
             CHECK(ipslr_next_segment(p));
             DPRINT("Recover: b=%d\n", info.b);
+            ++p->metrics.desync_recoveries;
+            PSLR_TRACE(&p->trace, PSLR_TRACE_ERROR, PSLR_EV_BUFFER_DESYNC, retry, info.b, 0);
         } while (++retry2 < 10 && info.b != 2);
     }
 
@@ -795,6 +904,7 @@ int pslr_buffer_open(pslr_handle_t h, int bufno, pslr_buffer_type buftype, int b
     do {
         CHECK(ipslr_buffer_segment_info(p, &info));
         DPRINT("%d: addr: 0x%x len: %d B=%d\n", i, info.addr, info.length, info.b);
+        PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_SEGMENT, info.b, info.addr, info.length);
         if (info.b == 4)
             p->segments[j].offset = info.length;
         else if (info.b == 3) {
@@ -812,6 +922,7 @@ int pslr_buffer_open(pslr_handle_t h, int bufno, pslr_buffer_type buftype, int b
     } while (i < 9 && info.b != 2);
     p->segment_count = j;
     p->offset = 0;
+    PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_BUFFER_READY, j, buf_total, 0);
     return PSLR_OK;
 }
 
@@ -824,6 +935,9 @@ uint32_t pslr_buffer_read(pslr_handle_t h, uint8_t *buf, uint32_t size) {
     uint32_t blksz;
     int ret;
 
+    if (p->buffer_result != PSLR_OK)
+        return 0;
+
     /* Find current segment */
     for (i = 0; i < p->segment_count; i++) {
         if (p->offset < pos + p->segments[i].length)
@@ -845,28 +959,86 @@ uint32_t pslr_buffer_read(pslr_handle_t h, uint8_t *buf, uint32_t size) {
 //           i, seg_offs, addr, blksz);
 
     ret = ipslr_download(p, addr, blksz, buf);
-    if (ret != PSLR_OK)
+    if (ret != PSLR_OK) {
+        p->buffer_result = ret;
         return 0;
+    }
     p->offset += blksz;
+    if (progress_callback) {
+        progress_callback(p->offset, ipslr_buffer_size(p));
+    }
     return blksz;
 }
 
-uint32_t pslr_buffer_get_size(pslr_handle_t h) {
-    ipslr_handle_t *p = (ipslr_handle_t *) h;
+static uint32_t ipslr_buffer_size(ipslr_handle_t *p) {
     int i;
     uint32_t len = 0;
     for (i = 0; i < p->segment_count; i++) {
         len += p->segments[i].length;
     }
+    return len;
+}
+
+uint32_t pslr_buffer_get_size(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    uint32_t len = ipslr_buffer_size(p);
     DPRINT("buffer get size:%d\n",len);
     return len;
 }
 
+/* Number of bytes already read, for reporting partial progress */
+uint32_t pslr_buffer_get_offset(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    return p->offset;
+}
+
+/* Continue reading an open buffer at offset, used to resume a download */
+int pslr_buffer_seek(pslr_handle_t h, uint32_t offset) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    if (offset > ipslr_buffer_size(p)) {
+        return PSLR_PARAM;
+    }
+    p->offset = offset;
+    return PSLR_OK;
+}
+
+/* Reason of the last failed pslr_buffer_read: PSLR_CANCELLED,
+ * PSLR_TIMEOUT or a protocol error. PSLR_OK while the read succeeds. */
+int pslr_buffer_get_result(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    return p->buffer_result;
+}
+
+/* May be called from another thread or a signal handler. The running
+ * download stops at the next block boundary; it is a no-op if no buffer
+ * is open. The caller still has to call pslr_buffer_close(). */
+void pslr_buffer_cancel(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    if (p->buffer_busy) {
+        p->buffer_cancel = 1;
+    }
+}
+
+/* Fail the download with PSLR_TIMEOUT if it takes more than timeout_ms
+ * from now; 0 removes the deadline. It is cleared by pslr_buffer_close(). */
+void pslr_buffer_set_deadline(pslr_handle_t h, uint32_t timeout_ms) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    if (timeout_ms == 0) {
+        p->buffer_deadline = 0;
+    } else {
+        p->buffer_deadline = pslr_metrics_now_us() + (uint64_t)timeout_ms * 1000;
+    }
+}
+
 void pslr_buffer_close(pslr_handle_t h) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
+    PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_BUFFER_CLOSE, p->offset, 0, 0);
     memset(&p->segments[0], 0, sizeof (p->segments));
     p->offset = 0;
     p->segment_count = 0;
+    p->buffer_busy = 0;
+    p->buffer_cancel = 0;
+    p->buffer_deadline = 0;
 }
 
 int pslr_select_af_point(pslr_handle_t h, uint32_t point) {
@@ -929,6 +1101,28 @@ pslr_jpeg_image_tone_t pslr_get_model_max_supported_image_tone(pslr_handle_t h)
     return p->model->max_supported_image_tone;
 }
 
+pslr_trace_t *pslr_get_trace(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    return &p->trace;
+}
+
+int pslr_get_metrics(pslr_handle_t h, pslr_metrics_t *m) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    if (!m) {
+        return PSLR_PARAM;
+    }
+    memcpy(m, &p->metrics, sizeof (*m));
+    m->buffer_allocations = p->pool.allocations;
+    m->buffer_reuses = p->pool.reuses;
+    m->buffers_outstanding = p->pool.outstanding;
+    return PSLR_OK;
+}
+
+void pslr_reset_metrics(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    memset(&p->metrics, 0, sizeof (p->metrics));
+}
+
 const char *pslr_camera_name(pslr_handle_t h) {
     ipslr_handle_t *p = (ipslr_handle_t *) h;
     int ret;
@@ -955,44 +1149,44 @@ pslr_buffer_type pslr_get_jpeg_buffer_type(pslr_handle_t h, int jpeg_stars) {
 
 static int ipslr_set_mode(ipslr_handle_t *p, uint32_t mode) {
     CHECK(ipslr_write_args(p, 1, mode));
-    CHECK(command(p->fd, 0, 0, 4));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0, 0, 4));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 static int ipslr_cmd_00_09(ipslr_handle_t *p, uint32_t mode) {
     CHECK(ipslr_write_args(p, 1, mode));
-    CHECK(command(p->fd, 0, 9, 4));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0, 9, 4));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 static int ipslr_cmd_10_0a(ipslr_handle_t *p, uint32_t mode) {
     CHECK(ipslr_write_args(p, 1, mode));
-    CHECK(command(p->fd, 0x10, X10_CONNECT, 4));
-    CHECK(get_status(p->fd));
+    CHECK(command(p, 0x10, X10_CONNECT, 4));
+    CHECK(get_status(p));
     return PSLR_OK;
 }
 
 static int ipslr_cmd_00_05(ipslr_handle_t *p) {
     int n;
     uint8_t buf[0xb8];
-    CHECK(command(p->fd, 0x00, 0x05, 0x00));
-    n = get_result(p->fd);
+    CHECK(command(p, 0x00, 0x05, 0x00));
+    n = get_result(p);
     if (n != 0xb8) {
         DPRINT("only got %d bytes\n", n);
         return PSLR_READ_ERROR;
     }
-    CHECK(read_result(p->fd, buf, n));
+    CHECK(read_result(p, buf, n));
     return PSLR_OK;
 }
 
 static int ipslr_status(ipslr_handle_t *p, uint8_t *buf) {
     int n;
-    CHECK(command(p->fd, 0, 1, 0));
-    n = get_result(p->fd);
+    CHECK(command(p, 0, 1, 0));
+    n = get_result(p);
     if (n == 16 || n == 28) {
-        return read_result(p->fd, buf, n);
+        return read_result(p, buf, n);
     } else {
         return PSLR_READ_ERROR;
     }
@@ -1000,19 +1194,22 @@ static int ipslr_status(ipslr_handle_t *p, uint8_t *buf) {
 
 static int ipslr_status_full(ipslr_handle_t *p, pslr_status *status) {
     int n;
-    CHECK(command(p->fd, 0, 8, 0));
-    n = get_result(p->fd);
+    CHECK(command(p, 0, 8, 0));
+    n = get_result(p);
     DPRINT("read %d bytes\n", n);
     int expected_bufsize = p->model->buffer_size;
     DPRINT("expected_bufsize: %d\n",expected_bufsize);
 
-    CHECK(read_result(p->fd, p->status_buffer, n > MAX_STATUS_BUF_SIZE ? MAX_STATUS_BUF_SIZE: n));
+    CHECK(read_result(p, p->status_buffer, n > MAX_STATUS_BUF_SIZE ? MAX_STATUS_BUF_SIZE: n));
 
     if( expected_bufsize == 0 || !p->model->parser_function ) {
         // limited support only
+        PSLR_TRACE(&p->trace, PSLR_TRACE_VERBOSE, PSLR_EV_STATUS_FULL, n, expected_bufsize, 0);
+        p->status_stale = false;
         return PSLR_OK;
     } else if( expected_bufsize > 0 && expected_bufsize != n ) {
         DPRINT("Waiting for %d bytes but got %d\n", expected_bufsize, n);
+        PSLR_TRACE(&p->trace, PSLR_TRACE_ERROR, PSLR_EV_STATUS_FULL, n, expected_bufsize, 0);
         return PSLR_READ_ERROR;
     } else {
         // everything OK
@@ -1020,6 +1217,10 @@ static int ipslr_status_full(ipslr_handle_t *p, pslr_status *status) {
         // required for K-x, probably for other cameras too (but not for the K-30!)
         if (p->model->id1 != 0x12f52) // K-30 id
             status->exposure_mode = exposure_mode_conversion( status->exposure_mode );
+        PSLR_TRACE(&p->trace, PSLR_TRACE_VERBOSE, PSLR_EV_STATUS_FULL, n, expected_bufsize, status->bufmask);
+        if (status == &p->status) {
+            p->status_stale = false;
+        }
         return PSLR_OK;
     }
 }
@@ -1031,9 +1232,10 @@ static int ipslr_press_shutter(ipslr_handle_t *p, bool fullpress) {
     CHECK(ipslr_status_full(p, &p->status));
     DPRINT("before: mask=0x%x\n", p->status.bufmask);
     CHECK(ipslr_write_args(p, 1, fullpress ? 2 : 1));
-    CHECK(command(p->fd, 0x10, X10_SHUTTER, 0x04));
-    r = get_status(p->fd);
+    CHECK(command(p, 0x10, X10_SHUTTER, 0x04));
+    r = get_status(p);
     DPRINT("shutter result code: 0x%x\n", r);
+    PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_SHUTTER, fullpress, r, 0);
     return PSLR_OK;
 }
 
@@ -1042,13 +1244,13 @@ static int ipslr_select_buffer(ipslr_handle_t *p, int bufno, pslr_buffer_type bu
     DPRINT("Select buffer %d,%d,%d,0\n", bufno, buftype, bufres);
     if( !p->model->old_scsi_command ) {
         CHECK(ipslr_write_args(p, 4, bufno, buftype, bufres, 0));
-        CHECK(command(p->fd, 0x02, 0x01, 0x10));
+        CHECK(command(p, 0x02, 0x01, 0x10));
     } else {
         /* older cameras: 3-arg select buffer */
         CHECK(ipslr_write_args(p, 4, bufno, buftype, bufres));
-        CHECK(command(p->fd, 0x02, 0x01, 0x0c));
+        CHECK(command(p, 0x02, 0x01, 0x0c));
     }
-    r = get_status(p->fd);
+    r = get_status(p);
     if (r != 0) {
         return PSLR_COMMAND_ERROR;
     }
@@ -1058,9 +1260,9 @@ static int ipslr_select_buffer(ipslr_handle_t *p, int bufno, pslr_buffer_type bu
 static int ipslr_next_segment(ipslr_handle_t *p) {
     int r;
     CHECK(ipslr_write_args(p, 1, 0));
-    CHECK(command(p->fd, 0x04, 0x01, 0x04));
+    CHECK(command(p, 0x04, 0x01, 0x04));
     usleep(100000); // needed !! 100 too short, 1000 not short enough for PEF
-    r = get_status(p->fd);
+    r = get_status(p);
     if (r == 0)
         return PSLR_OK;
     return PSLR_COMMAND_ERROR;
@@ -1073,12 +1275,12 @@ static int ipslr_buffer_segment_info(ipslr_handle_t *p, pslr_buffer_segment_info
 
     pInfo->b = 0;
     while( pInfo->b == 0 && --num_try > 0 ) {
-        CHECK(command(p->fd, 0x04, 0x00, 0x00));
-        n = get_result(p->fd);
+        CHECK(command(p, 0x04, 0x00, 0x00));
+        n = get_result(p);
         if (n != 16) {
             return PSLR_READ_ERROR;
         }
-        CHECK(read_result(p->fd, buf, 16));
+        CHECK(read_result(p, buf, 16));
         pInfo->a = get_uint32(&buf[0]);
         pInfo->b = get_uint32(&buf[4]);
         pInfo->addr = get_uint32(&buf[8]);
@@ -1096,10 +1298,18 @@ static int ipslr_download(ipslr_handle_t *p, uint32_t addr, uint32_t length, uin
     uint32_t block;
     int n;
     int retry;
-    uint32_t length_start = length;
+    uint64_t start;
 
     retry = 0;
     while (length > 0) {
+        /* Stop only between blocks, so the camera is never left in
+         * the middle of a transfer */
+        if (p->buffer_cancel) {
+            return PSLR_CANCELLED;
+        }
+        if (p->buffer_deadline && pslr_metrics_now_us() > p->buffer_deadline) {
+            return PSLR_TIMEOUT;
+        }
         if (length > BLKSZ) {
             block = BLKSZ;
         } else {
@@ -1107,15 +1317,20 @@ static int ipslr_download(ipslr_handle_t *p, uint32_t addr, uint32_t length, uin
 	}
 
         //DPRINT("Get 0x%x bytes from 0x%x\n", block, addr);
+        PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_DOWNLOAD_BLOCK, addr, block, 0);
+        start = pslr_metrics_now_us();
         CHECK(ipslr_write_args(p, 2, addr, block));
-        CHECK(command(p->fd, 0x06, 0x00, 0x08));
-        get_status(p->fd);
+        CHECK(command(p, 0x06, 0x00, 0x08));
+        get_status(p);
 
-        n = scsi_read(p->fd, downloadCmd, sizeof (downloadCmd), buf, block);
-        get_status(p->fd);
+        n = ipslr_scsi_read(p, downloadCmd, sizeof (downloadCmd), buf, block);
+        get_status(p);
+        pslr_metrics_record(&p->metrics, PSLR_METRIC_DOWNLOAD_BLOCK, start);
 
         if (n < 0) {
+            PSLR_TRACE(&p->trace, PSLR_TRACE_ERROR, PSLR_EV_BLOCK_RETRY, addr, block, retry);
             if (retry < BLOCK_RETRY) {
+                ++p->metrics.block_retries;
                 retry++;
                 continue;
             }
@@ -1125,9 +1340,6 @@ static int ipslr_download(ipslr_handle_t *p, uint32_t addr, uint32_t length, uin
         length -= n;
         addr += n;
         retry = 0;
-        if (progress_callback) {
-            progress_callback(length_start - length, length_start);
-        }
     }
     return PSLR_OK;
 }
@@ -1136,11 +1348,11 @@ static int ipslr_identify(ipslr_handle_t *p) {
     uint8_t idbuf[8];
     int n;
 
-    CHECK(command(p->fd, 0, 4, 0));
-    n = get_result(p->fd);
+    CHECK(command(p, 0, 4, 0));
+    n = get_result(p);
     if (n != 8)
         return PSLR_READ_ERROR;
-    CHECK(read_result(p->fd, idbuf, 8));
+    CHECK(read_result(p, idbuf, 8));
     p->id1 = get_uint32(&idbuf[0]);
     DPRINT("id1 of the camera: %x\n", p->id1);
     p->model = find_model_by_id( p->id1 );
@@ -1151,7 +1363,6 @@ static int ipslr_write_args(ipslr_handle_t *p, int n, ...) {
     va_list ap;
     uint8_t cmd[8] = {0xf0, 0x4f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     uint8_t buf[4 * n];
-    int fd = p->fd;
     int res;
     int i;
     uint32_t data;
@@ -1167,8 +1378,9 @@ static int ipslr_write_args(ipslr_handle_t *p, int n, ...) {
             buf[4 * i + 3] = data;
         }
         cmd[4] = 4 * n;
-        res = scsi_write(fd, cmd, sizeof (cmd), buf, 4 * n);
+        res = ipslr_scsi_write(p, cmd, sizeof (cmd), buf, 4 * n);
         if (res != PSLR_OK) {
+            PSLR_TRACE(&p->trace, PSLR_TRACE_ERROR, PSLR_EV_SCSI_ERROR, cmd[1], 4 * n, res);
             return res;
 	}
     } else {
@@ -1181,8 +1393,9 @@ static int ipslr_write_args(ipslr_handle_t *p, int n, ...) {
             buf[3] = data;
             cmd[4] = 4;
             cmd[2] = i * 4;
-            res = scsi_write(fd, cmd, sizeof (cmd), buf, 4);
+            res = ipslr_scsi_write(p, cmd, sizeof (cmd), buf, 4);
             if (res != PSLR_OK) {
+                PSLR_TRACE(&p->trace, PSLR_TRACE_ERROR, PSLR_EV_SCSI_ERROR, cmd[1], 4, res);
                 return res;
 	    }
         }
@@ -1193,23 +1406,69 @@ static int ipslr_write_args(ipslr_handle_t *p, int n, ...) {
 
 /* ----------------------------------------------------------------------- */
 
-static int command(int fd, int a, int b, int c) {
+/* All scsi traffic of the handle goes through these two, so the
+ * metrics see every byte and every error class */
+static uint32_t ipslr_scsi_timeout(ipslr_handle_t *p, uint64_t now, uint32_t bufLen) {
+    uint32_t timeout = SCSI_TIMEOUT + bufLen / SCSI_MIN_RATE;
+    if (p->buffer_deadline) {
+        uint64_t left = p->buffer_deadline > now ? (p->buffer_deadline - now) / 1000 : 0;
+        if (left < SCSI_MIN_TIMEOUT) {
+            left = SCSI_MIN_TIMEOUT;
+        }
+        if (left < timeout) {
+            timeout = left;
+        }
+    }
+    return timeout;
+}
+
+static int ipslr_scsi_read(ipslr_handle_t *p, uint8_t *cmd, uint32_t cmdLen,
+                           uint8_t *buf, uint32_t bufLen) {
+    uint64_t start = pslr_metrics_now_us();
+    int n = scsi_read(p->fd, cmd, cmdLen, buf, bufLen, ipslr_scsi_timeout(p, start, bufLen));
+    pslr_metrics_record(&p->metrics, PSLR_METRIC_SCSI_READ, start);
+    if (n < 0) {
+        pslr_metrics_scsi_error(&p->metrics, scsi_last_error());
+    } else {
+        p->metrics.scsi_read_bytes += n;
+    }
+    return n;
+}
+
+static int ipslr_scsi_write(ipslr_handle_t *p, uint8_t *cmd, uint32_t cmdLen,
+                            uint8_t *buf, uint32_t bufLen) {
+    uint64_t start = pslr_metrics_now_us();
+    int r = scsi_write(p->fd, cmd, cmdLen, buf, bufLen, ipslr_scsi_timeout(p, start, bufLen));
+    pslr_metrics_record(&p->metrics, PSLR_METRIC_SCSI_WRITE, start);
+    if (r != PSLR_OK) {
+        pslr_metrics_scsi_error(&p->metrics, scsi_last_error());
+    } else {
+        p->metrics.scsi_write_bytes += bufLen;
+    }
+    return r;
+}
+
+static int command(ipslr_handle_t *p, int a, int b, int c) {
     uint8_t cmd[8] = {0xf0, 0x24, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    uint64_t start = pslr_metrics_now_us();
 
+    PSLR_TRACE(&p->trace, PSLR_TRACE_INFO, PSLR_EV_COMMAND, a, b, c);
     cmd[2] = a;
     cmd[3] = b;
     cmd[4] = c;
-    CHECK(scsi_write(fd, cmd, sizeof (cmd), 0, 0));
+    CHECK(ipslr_scsi_write(p, cmd, sizeof (cmd), 0, 0));
+    pslr_metrics_record(&p->metrics, PSLR_METRIC_COMMAND, start);
     return PSLR_OK;
 }
 
-static int read_status(int fd, uint8_t *buf) {
+static int read_status(ipslr_handle_t *p, uint8_t *buf) {
     uint8_t cmd[8] = {0xf0, 0x26, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     int n;
 
-    n = scsi_read(fd, cmd, 8, buf, 8);
+    n = ipslr_scsi_read(p, cmd, 8, buf, 8);
     if (n != 8) {
         DPRINT("Only got %d bytes\n", n);
+        PSLR_TRACE(&p->trace, PSLR_TRACE_ERROR, PSLR_EV_SCSI_ERROR, cmd[1], 8, n);
         /* The *ist DS doesn't know to return the correct number of
             read bytes for this command, so return PSLR_OK instead of
             PSLR_READ_ERROR */
@@ -1218,11 +1477,15 @@ static int read_status(int fd, uint8_t *buf) {
     return PSLR_OK;
 }
 
-static int get_status(int fd) {
+static int get_status(ipslr_handle_t *p) {
     uint8_t statusbuf[8];
+    uint32_t polls = 0;
+    uint64_t start = pslr_metrics_now_us();
     while (1) {
         //usleep(POLL_INTERVAL);
-        CHECK(read_status(fd, statusbuf));
+        CHECK(read_status(p, statusbuf));
+        ++polls;
+        ++p->metrics.status_polls;
         //DPRINT("get_status->\n");
         //hexdump(statusbuf, 8);
         if ((statusbuf[7] & 0x01) == 0)
@@ -1231,17 +1494,25 @@ static int get_status(int fd) {
         //hexdump(statusbuf, 8);
         usleep(POLL_INTERVAL);
     }
+    pslr_metrics_record(&p->metrics, PSLR_METRIC_GET_STATUS, start);
+    PSLR_TRACE(&p->trace, PSLR_TRACE_VERBOSE, PSLR_EV_STATUS, statusbuf[7], polls, 0);
     if ((statusbuf[7] & 0xff) != 0) {
         DPRINT("ERROR: 0x%x\n", statusbuf[7]);
+        PSLR_TRACE(&p->trace, PSLR_TRACE_ERROR, PSLR_EV_STATUS, statusbuf[7], polls, 0);
     }
     return statusbuf[7];
 }
 
-static int get_result(int fd) {
+static int get_result(ipslr_handle_t *p) {
     uint8_t statusbuf[8];
+    uint32_t polls = 0;
+    uint64_t start = pslr_metrics_now_us();
+    int n;
     while (1) {
         //DPRINT("read out status\n");
-        CHECK(read_status(fd, statusbuf));
+        CHECK(read_status(p, statusbuf));
+        ++polls;
+        ++p->metrics.status_polls;
         //hexdump(statusbuf, 8);
         if (statusbuf[6] == 0x01)
             break;
@@ -1249,23 +1520,32 @@ static int get_result(int fd) {
         //hexdump(statusbuf, 8);
         usleep(POLL_INTERVAL);
     }
+    pslr_metrics_record(&p->metrics, PSLR_METRIC_GET_RESULT, start);
     if ((statusbuf[7] & 0xff) != 0) {
         DPRINT("ERROR: 0x%x\n", statusbuf[7]);
+        PSLR_TRACE(&p->trace, PSLR_TRACE_ERROR, PSLR_EV_RESULT, 0, polls, statusbuf[7]);
         return -1;
     }
-    return statusbuf[0] | statusbuf[1] << 8 | statusbuf[2] << 16 | statusbuf[3] << 24;
+    n = statusbuf[0] | statusbuf[1] << 8 | statusbuf[2] << 16 | statusbuf[3] << 24;
+    PSLR_TRACE(&p->trace, PSLR_TRACE_VERBOSE, PSLR_EV_RESULT, n, polls, 0);
+    return n;
 }
 
-static int read_result(int fd, uint8_t *buf, uint32_t n) {
+static int read_result(ipslr_handle_t *p, uint8_t *buf, uint32_t n) {
     uint8_t cmd[8] = {0xf0, 0x49, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    uint64_t start = pslr_metrics_now_us();
     int r;
     cmd[4] = n;
     cmd[5] = n >> 8;
     cmd[6] = n >> 16;
     cmd[7] = n >> 24;
-    r = scsi_read(fd, cmd, sizeof (cmd), buf, n);
-    if (r != n)
+    r = ipslr_scsi_read(p, cmd, sizeof (cmd), buf, n);
+    pslr_metrics_record(&p->metrics, PSLR_METRIC_READ_RESULT, start);
+    PSLR_TRACE(&p->trace, PSLR_TRACE_VERBOSE, PSLR_EV_READ_RESULT, n, r, 0);
+    if (r != n) {
+        PSLR_TRACE(&p->trace, PSLR_TRACE_ERROR, PSLR_EV_READ_RESULT, n, r, 0);
         return PSLR_READ_ERROR;
+    }
     return PSLR_OK;
 }
 
@@ -171,6 +171,7 @@ void sleep_sec(double sec);
 
 pslr_handle_t pslr_init(char *model, char *device);
 int pslr_connect(pslr_handle_t h);
+int pslr_connect_fast(pslr_handle_t h);
 int pslr_disconnect(pslr_handle_t h);
 int pslr_shutdown(pslr_handle_t h);
 const char *pslr_model(uint32_t id);
@@ -185,6 +186,10 @@ char *collect_status_info( pslr_handle_t h, pslr_status status );
 
 int pslr_get_buffer(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
                     uint8_t **pdata, uint32_t *pdatalen);
+int pslr_get_buffer_pooled(pslr_handle_t h, int bufno, pslr_buffer_type type, int resolution,
+                           uint8_t **pdata, uint32_t *pdatalen);
+uint8_t *pslr_buffer_alloc(pslr_handle_t h, uint32_t size);
+void pslr_buffer_release(pslr_handle_t h, uint8_t *data);
 
 int pslr_set_progress_callback(pslr_handle_t h, pslr_progress_callback_t cb, 
                                uintptr_t user_data);
@@ -234,10 +239,19 @@ int pslr_buffer_open(pslr_handle_t h, int bufno, pslr_buffer_type type, int reso
 uint32_t pslr_buffer_read(pslr_handle_t h, uint8_t *buf, uint32_t size);
 void pslr_buffer_close(pslr_handle_t h);
 uint32_t pslr_buffer_get_size(pslr_handle_t h);
+uint32_t pslr_buffer_get_offset(pslr_handle_t h);
+int pslr_buffer_seek(pslr_handle_t h, uint32_t offset);
+int pslr_buffer_get_result(pslr_handle_t h);
+void pslr_buffer_cancel(pslr_handle_t h);
+void pslr_buffer_set_deadline(pslr_handle_t h, uint32_t timeout_ms);
 
 int pslr_set_exposure_mode(pslr_handle_t h, pslr_exposure_mode_t mode);
 int pslr_select_af_point(pslr_handle_t h, uint32_t point);
 
+pslr_trace_t *pslr_get_trace(pslr_handle_t h);
+int pslr_get_metrics(pslr_handle_t h, pslr_metrics_t *m);
+void pslr_reset_metrics(pslr_handle_t h);
+
 const char *pslr_camera_name(pslr_handle_t h);
 int pslr_get_model_jpeg_stars(pslr_handle_t h);
 int pslr_get_model_jpeg_property_levels(pslr_handle_t h);
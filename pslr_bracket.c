@@ -0,0 +1,93 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pslr_bracket.h"
+#include "pslr_metrics.h"
+#include "pslr_ramp.h"
+
+int pslr_bracket_parse(pslr_bracket_t *b, const char *list) {
+    const char *s = list;
+    char *end;
+
+    memset(b, 0, sizeof (*b));
+    while (*s) {
+        if (b->count == PSLR_BRACKET_MAX) {
+            return PSLR_PARAM;
+        }
+        b->ev[b->count] = strtod(s, &end);
+        if (end == s || (*end && *end != ',')) {
+            return PSLR_PARAM;
+        }
+        ++b->count;
+        s = *end ? end + 1 : end;
+    }
+    return b->count > 0 ? PSLR_OK : PSLR_PARAM;
+}
+
+void pslr_bracket_prepare(pslr_bracket_t *b, pslr_rational_t base, double fastest, double slowest) {
+    double t = (double) base.nom / base.denom;
+    int i;
+
+    b->base = base;
+    for (i = 0; i < b->count; ++i) {
+        b->shutter[i] = pslr_ramp_snap_shutter(t * pow(2, b->ev[i]), fastest, slowest);
+        DPRINT("bracket %d: %+.2f EV %d/%d\n", i, b->ev[i], b->shutter[i].nom, b->shutter[i].denom);
+    }
+}
+
+int pslr_bracket_shoot(pslr_handle_t h, pslr_bracket_t *b, volatile sig_atomic_t *stop) {
+    pslr_rational_t *last;
+    uint64_t start;
+    int i, ret;
+
+    memset(b->release_us, 0, sizeof (b->release_us));
+    b->total_us = 0;
+    b->shot = 0;
+    ret = pslr_set_shutter(h, b->shutter[0]);
+    if (ret != PSLR_OK) {
+        return ret;
+    }
+    start = pslr_metrics_now_us();
+    for (i = 0; i < b->count && !(stop && *stop); ++i) {
+        b->release_us[i] = pslr_metrics_now_us() - start;
+        ret = pslr_shutter(h);
+        if (ret != PSLR_OK) {
+            break;
+        }
+        // the camera takes the next setting while it is still exposing
+        if (i + 1 < b->count) {
+            ret = pslr_set_shutter(h, b->shutter[i + 1]);
+            if (ret != PSLR_OK) {
+                ++i;
+                break;
+            }
+        }
+    }
+    if (i > 0) {
+        last = &b->shutter[i - 1];
+        b->total_us = b->release_us[i - 1] + (uint64_t) (1000000.0 * last->nom / last->denom);
+    }
+    b->shot = i;
+    pslr_set_shutter(h, b->base);
+    return ret;
+}
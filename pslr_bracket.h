@@ -0,0 +1,61 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_BRACKET_H
+#define PSLR_BRACKET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+
+#include "pslr.h"
+
+/* Host driven exposure bracketing.
+ *
+ * The camera's own bracketing is limited to a few frames with a fixed
+ * step. Here any list of EV offsets is turned into shutter speeds in
+ * advance, and the frames are released back to back: after each
+ * shutter command only the shutter speed of the next frame is sent, the
+ * downloads wait until the whole bracket is in the camera buffers. */
+
+#define PSLR_BRACKET_MAX 16         /* buffers of the camera (bufmask) */
+
+typedef struct {
+    int count;
+    double ev[PSLR_BRACKET_MAX];
+    pslr_rational_t shutter[PSLR_BRACKET_MAX];
+    pslr_rational_t base;           /* restored after the bracket */
+
+    /* Result of the last pslr_bracket_shoot(), times in microseconds
+     * since the first release */
+    int shot;                       /* frames released */
+    uint64_t release_us[PSLR_BRACKET_MAX];
+    uint64_t total_us;              /* until the end of the last exposure */
+} pslr_bracket_t;
+
+/* Parses a comma separated EV list, e.g. "-2,0,2" or "-3,-1.5,0,1.5,3" */
+int pslr_bracket_parse(pslr_bracket_t *b, const char *list);
+
+/* Computes the shutter speeds around base, limited to [fastest, slowest] seconds */
+void pslr_bracket_prepare(pslr_bracket_t *b, pslr_rational_t base, double fastest, double slowest);
+
+/* Releases every frame of the bracket, stops early when *stop is set
+ * (e.g. from a signal handler) */
+int pslr_bracket_shoot(pslr_handle_t h, pslr_bracket_t *b, volatile sig_atomic_t *stop);
+
+#endif
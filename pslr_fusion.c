@@ -0,0 +1,257 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pslr_fusion.h"
+
+#define FUSION_SIGMA 0.2       /* width of the well-exposedness curve */
+#define FUSION_MIN_SIZE 8      /* smallest pyramid level */
+#define FUSION_MAX_LEVELS 10
+
+typedef struct {
+    int w;
+    int h;
+    float *p;
+} fusion_level_t;
+
+static int clamp_index(int i, int n) {
+    return i < 0 ? 0 : (i >= n ? n - 1 : i);
+}
+
+/* Blur with [1 4 6 4 1]/16 and keep every second pixel */
+static void fusion_reduce(const float *src, int w, int h, int ch, float *dst, int dw, int dh, float *tmp) {
+    static const float k[5] = { 1/16.0, 4/16.0, 6/16.0, 4/16.0, 1/16.0 };
+    int x, y, c, i;
+
+    for (y = 0; y < h; ++y) {
+        const float *s = src + y * w * ch;
+        float *t = tmp + y * dw * ch;
+        for (x = 0; x < dw; ++x) {
+            for (c = 0; c < ch; ++c) {
+                float v = 0;
+                for (i = -2; i <= 2; ++i) {
+                    v += k[i + 2] * s[clamp_index(2 * x + i, w) * ch + c];
+                }
+                t[x * ch + c] = v;
+            }
+        }
+    }
+    for (y = 0; y < dh; ++y) {
+        const float *t[5];
+        float *d = dst + y * dw * ch;
+        for (i = -2; i <= 2; ++i) {
+            t[i + 2] = tmp + clamp_index(2 * y + i, h) * dw * ch;
+        }
+        for (x = 0; x < dw * ch; ++x) {
+            d[x] = k[0] * t[0][x] + k[1] * t[1][x] + k[2] * t[2][x] + k[3] * t[3][x] + k[4] * t[4][x];
+        }
+    }
+}
+
+/* The inverse of fusion_reduce: insert zeros and blur with [1 4 6 4 1]/8,
+ * dst += expanded (sign = 1) or dst -= expanded (sign = -1) */
+static void fusion_expand(const float *src, int sw, int sh, int ch, float *dst, int w, int h, float sign, float *tmp) {
+    int x, y, c, i;
+
+    for (y = 0; y < sh; ++y) {
+        const float *s = src + y * sw * ch;
+        float *t = tmp + y * w * ch;
+        for (x = 0; x < w; ++x) {
+            i = x / 2;
+            for (c = 0; c < ch; ++c) {
+                if (x & 1) {
+                    t[x * ch + c] = 0.5 * (s[i * ch + c] + s[clamp_index(i + 1, sw) * ch + c]);
+                } else {
+                    t[x * ch + c] = 0.125 * (s[clamp_index(i - 1, sw) * ch + c] + 6 * s[i * ch + c] +
+                                             s[clamp_index(i + 1, sw) * ch + c]);
+                }
+            }
+        }
+    }
+    for (y = 0; y < h; ++y) {
+        const float *t0, *t1, *t2;
+        float *d = dst + y * w * ch;
+        i = y / 2;
+        t1 = tmp + i * w * ch;
+        if (y & 1) {
+            t2 = tmp + clamp_index(i + 1, sh) * w * ch;
+            for (x = 0; x < w * ch; ++x) {
+                d[x] += sign * 0.5f * (t1[x] + t2[x]);
+            }
+        } else {
+            t0 = tmp + clamp_index(i - 1, sh) * w * ch;
+            t2 = tmp + clamp_index(i + 1, sh) * w * ch;
+            for (x = 0; x < w * ch; ++x) {
+                d[x] += sign * 0.125f * (t0[x] + 6 * t1[x] + t2[x]);
+            }
+        }
+    }
+}
+
+static void fusion_free_pyramid(fusion_level_t *pyr, int levels) {
+    int l;
+
+    for (l = 0; l < levels; ++l) {
+        free(pyr[l].p);
+        pyr[l].p = NULL;
+    }
+}
+
+static int fusion_alloc_pyramid(fusion_level_t *pyr, int levels, int width, int height, int ch) {
+    int l;
+
+    for (l = 0; l < levels; ++l) {
+        pyr[l].w = width;
+        pyr[l].h = height;
+        pyr[l].p = calloc((size_t) width * height * ch, sizeof (float));
+        if (!pyr[l].p) {
+            fusion_free_pyramid(pyr, l);
+            return PSLR_NO_MEMORY;
+        }
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+    return PSLR_OK;
+}
+
+/* Contrast, saturation and well-exposedness of one image */
+static void fusion_weights(const uint8_t *img, int w, int h, float *weight) {
+    float exposedness[256];
+    int x, y, i;
+
+    for (i = 0; i < 256; ++i) {
+        double v = i / 255.0 - 0.5;
+        exposedness[i] = exp(-v * v / (2 * FUSION_SIGMA * FUSION_SIGMA));
+    }
+    for (y = 0; y < h; ++y) {
+        for (x = 0; x < w; ++x) {
+            const uint8_t *p = img + (y * w + x) * 3;
+            const uint8_t *n[4];
+            float r = p[0] / 255.0, g = p[1] / 255.0, b = p[2] / 255.0;
+            float mean = (r + g + b) / 3;
+            float contrast, saturation;
+
+            n[0] = img + (clamp_index(y - 1, h) * w + x) * 3;
+            n[1] = img + (clamp_index(y + 1, h) * w + x) * 3;
+            n[2] = img + (y * w + clamp_index(x - 1, w)) * 3;
+            n[3] = img + (y * w + clamp_index(x + 1, w)) * 3;
+            contrast = 4 * (p[0] + p[1] + p[2]);
+            for (i = 0; i < 4; ++i) {
+                contrast -= n[i][0] + n[i][1] + n[i][2];
+            }
+            contrast = fabsf(contrast) / (3 * 255.0);
+            saturation = sqrtf(((r - mean) * (r - mean) + (g - mean) * (g - mean) + (b - mean) * (b - mean)) / 3);
+            weight[y * w + x] = contrast * saturation * exposedness[p[0]] * exposedness[p[1]] * exposedness[p[2]] + 1e-6;
+        }
+    }
+}
+
+static void fusion_blend(const uint8_t *const *images, int count, int n, int levels, float *weights, float *tmp,
+                         fusion_level_t *result, fusion_level_t *gauss, fusion_level_t *weight, uint8_t *out) {
+    int l, k, i;
+
+    for (k = 0; k < count; ++k) {
+        fusion_weights(images[k], gauss[0].w, gauss[0].h, weights + k * n);
+    }
+    for (i = 0; i < n; ++i) {
+        float sum = 0;
+        for (k = 0; k < count; ++k) {
+            sum += weights[k * n + i];
+        }
+        for (k = 0; k < count; ++k) {
+            weights[k * n + i] /= sum;
+        }
+    }
+
+    for (k = 0; k < count; ++k) {
+        // Gaussian pyramids of the image and of its weights
+        for (i = 0; i < n * 3; ++i) {
+            gauss[0].p[i] = images[k][i] / 255.0f;
+        }
+        memcpy(weight[0].p, weights + k * n, n * sizeof (float));
+        for (l = 1; l < levels; ++l) {
+            fusion_reduce(gauss[l - 1].p, gauss[l - 1].w, gauss[l - 1].h, 3, gauss[l].p, gauss[l].w, gauss[l].h, tmp);
+            fusion_reduce(weight[l - 1].p, weight[l - 1].w, weight[l - 1].h, 1, weight[l].p, weight[l].w, weight[l].h, tmp);
+        }
+        // Laplacian pyramid of the image, weighted into the result
+        for (l = 0; l < levels; ++l) {
+            fusion_level_t *g = &gauss[l];
+            if (l + 1 < levels) {
+                fusion_expand(gauss[l + 1].p, gauss[l + 1].w, gauss[l + 1].h, 3, g->p, g->w, g->h, -1, tmp);
+            }
+            for (i = 0; i < g->w * g->h; ++i) {
+                float w = weight[l].p[i];
+                result[l].p[3 * i] += w * g->p[3 * i];
+                result[l].p[3 * i + 1] += w * g->p[3 * i + 1];
+                result[l].p[3 * i + 2] += w * g->p[3 * i + 2];
+            }
+        }
+    }
+
+    for (l = levels - 1; l > 0; --l) {
+        fusion_expand(result[l].p, result[l].w, result[l].h, 3, result[l - 1].p, result[l - 1].w, result[l - 1].h, 1, tmp);
+    }
+    for (i = 0; i < n * 3; ++i) {
+        float v = result[0].p[i] * 255 + 0.5f;
+        out[i] = v < 0 ? 0 : (v > 255 ? 255 : (uint8_t) v);
+    }
+}
+
+int pslr_fusion(const uint8_t *const *images, int count, int width, int height, uint8_t *out) {
+    fusion_level_t result[FUSION_MAX_LEVELS];
+    fusion_level_t gauss[FUSION_MAX_LEVELS];
+    fusion_level_t weight[FUSION_MAX_LEVELS];
+    float *weights;
+    float *tmp;
+    int levels, n;
+    int ret = PSLR_NO_MEMORY;
+
+    if (count < 1 || width < 1 || height < 1) {
+        return PSLR_PARAM;
+    }
+    n = width * height;
+    for (levels = 1; levels < FUSION_MAX_LEVELS; ++levels) {
+        if ((width >> levels) < FUSION_MIN_SIZE || (height >> levels) < FUSION_MIN_SIZE) {
+            break;
+        }
+    }
+    memset(result, 0, sizeof (result));
+    memset(gauss, 0, sizeof (gauss));
+    memset(weight, 0, sizeof (weight));
+
+    weights = malloc((size_t) count * n * sizeof (float));
+    tmp = malloc((size_t) n * 3 * sizeof (float));
+    if (weights && tmp &&
+        fusion_alloc_pyramid(result, levels, width, height, 3) == PSLR_OK &&
+        fusion_alloc_pyramid(gauss, levels, width, height, 3) == PSLR_OK &&
+        fusion_alloc_pyramid(weight, levels, width, height, 1) == PSLR_OK) {
+        fusion_blend(images, count, n, levels, weights, tmp, result, gauss, weight, out);
+        ret = PSLR_OK;
+    }
+
+    fusion_free_pyramid(result, levels);
+    fusion_free_pyramid(gauss, levels);
+    fusion_free_pyramid(weight, levels);
+    free(weights);
+    free(tmp);
+    return ret;
+}
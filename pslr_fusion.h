@@ -0,0 +1,38 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_FUSION_H
+#define PSLR_FUSION_H
+
+#include <stdint.h>
+
+#include "pslr.h"
+
+/* Exposure fusion (Mertens, Kautz, Van Reeth) of a bracket.
+ *
+ * Every pixel of every image gets a weight from its local contrast,
+ * saturation and well-exposedness, and the images are blended with
+ * these weights level by level in a Laplacian pyramid, so there are no
+ * seams where the weights change quickly. It is meant for small
+ * previews, the images should be downscaled before. */
+
+/* Fuses count RGB images (3 bytes per pixel, rows without padding) of
+ * the same size into out */
+int pslr_fusion(const uint8_t *const *images, int count, int width, int height, uint8_t *out);
+
+#endif
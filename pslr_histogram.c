@@ -0,0 +1,91 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "pslr_histogram.h"
+
+/* Consecutive pixels count into different copies of the table, so the
+ * increments of neighbouring pixels with the same value do not wait for
+ * each other's stores. The copies are added up at the end. */
+#define HISTOGRAM_COPIES 4
+
+/* Rec.709 luma weights in 1/256 units, they add up to 256 */
+#define LUMA_R 54
+#define LUMA_G 183
+#define LUMA_B 19
+
+#define LUMA(r, g, b) ((LUMA_R * (r) + LUMA_G * (g) + LUMA_B * (b) + 128) >> 8)
+
+typedef uint32_t histogram_copy_t[PSLR_HISTOGRAM_CHANNELS][PSLR_HISTOGRAM_BINS];
+
+static void histogram_row(histogram_copy_t *c, const uint8_t *p, uint32_t width) {
+    uint32_t x = 0;
+    int k;
+
+    for (; x + HISTOGRAM_COPIES <= width; x += HISTOGRAM_COPIES, p += 3 * HISTOGRAM_COPIES) {
+        for (k = 0; k < HISTOGRAM_COPIES; ++k) {
+            uint32_t r = p[3 * k];
+            uint32_t g = p[3 * k + 1];
+            uint32_t b = p[3 * k + 2];
+            ++c[k][PSLR_HISTOGRAM_RED][r];
+            ++c[k][PSLR_HISTOGRAM_GREEN][g];
+            ++c[k][PSLR_HISTOGRAM_BLUE][b];
+            ++c[k][PSLR_HISTOGRAM_LUMA][LUMA(r, g, b)];
+        }
+    }
+    for (; x < width; ++x, p += 3) {
+        ++c[0][PSLR_HISTOGRAM_RED][p[0]];
+        ++c[0][PSLR_HISTOGRAM_GREEN][p[1]];
+        ++c[0][PSLR_HISTOGRAM_BLUE][p[2]];
+        ++c[0][PSLR_HISTOGRAM_LUMA][LUMA(p[0], p[1], p[2])];
+    }
+}
+
+void pslr_histogram_rgb(pslr_histogram_t *h, const uint8_t *pixels,
+                        uint32_t width, uint32_t height, uint32_t rowstride) {
+    histogram_copy_t copies[HISTOGRAM_COPIES];
+    uint32_t y;
+    int ch, i, k;
+
+    memset(copies, 0, sizeof (copies));
+    for (y = 0; y < height; ++y) {
+        histogram_row(copies, pixels + (size_t)y * rowstride, width);
+    }
+
+    memset(h, 0, sizeof (*h));
+    h->pixels = width * height;
+    for (ch = 0; ch < PSLR_HISTOGRAM_CHANNELS; ++ch) {
+        for (i = 0; i < PSLR_HISTOGRAM_BINS; ++i) {
+            uint32_t n = 0;
+            for (k = 0; k < HISTOGRAM_COPIES; ++k) {
+                n += copies[k][ch][i];
+            }
+            h->bins[ch][i] = n;
+            if (ch != PSLR_HISTOGRAM_LUMA && n > h->peak) {
+                h->peak = n;
+            }
+        }
+        if (h->pixels) {
+            h->shadows[ch] = 100.0f * h->bins[ch][0] / h->pixels;
+            h->highlights[ch] = 100.0f * h->bins[ch][PSLR_HISTOGRAM_BINS - 1] / h->pixels;
+        }
+    }
+}
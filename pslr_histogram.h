@@ -0,0 +1,47 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_HISTOGRAM_H
+#define PSLR_HISTOGRAM_H
+
+#include <stdint.h>
+
+#define PSLR_HISTOGRAM_BINS 256
+
+typedef enum {
+    PSLR_HISTOGRAM_RED,
+    PSLR_HISTOGRAM_GREEN,
+    PSLR_HISTOGRAM_BLUE,
+    PSLR_HISTOGRAM_LUMA,        /* Rec.709 luminance */
+    PSLR_HISTOGRAM_CHANNELS
+} pslr_histogram_channel_t;
+
+typedef struct {
+    uint32_t bins[PSLR_HISTOGRAM_CHANNELS][PSLR_HISTOGRAM_BINS];
+    uint32_t pixels;
+    uint32_t peak;              /* largest red, green or blue bin */
+    /* Percentage of the pixels at 0 and at 255 */
+    float shadows[PSLR_HISTOGRAM_CHANNELS];
+    float highlights[PSLR_HISTOGRAM_CHANNELS];
+} pslr_histogram_t;
+
+/* Histogram of packed 8 bit RGB pixels, rows are rowstride bytes apart */
+void pslr_histogram_rgb(pslr_histogram_t *h, const uint8_t *pixels,
+                        uint32_t width, uint32_t height, uint32_t rowstride);
+
+#endif
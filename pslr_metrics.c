@@ -0,0 +1,181 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "pslr_metrics.h"
+
+static const char *metric_names[PSLR_METRIC_MAX] = {
+    "command",
+    "get_status",
+    "get_result",
+    "read_result",
+    "scsi_read",
+    "scsi_write",
+    "download_block",
+    "connect",
+};
+
+static const char *scsi_error_names[SCSI_ERROR_MAX] = {
+    "ioctl",
+    "sense",
+    "status",
+    "host",
+    "driver",
+};
+
+uint64_t pslr_metrics_now_us(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void pslr_metrics_record(pslr_metrics_t *m, pslr_metric_t metric, uint64_t start_us) {
+    pslr_latency_t *l = &m->latency[metric];
+    uint64_t us = pslr_metrics_now_us() - start_us;
+    int b = 0;
+
+    while (b < PSLR_METRICS_BUCKETS - 1 && us >= ((uint64_t)PSLR_METRICS_BUCKET_US << b)) {
+        ++b;
+    }
+    ++l->buckets[b];
+    ++l->count;
+    l->total_us += us;
+    if (us > l->max_us) {
+        l->max_us = us;
+    }
+}
+
+void pslr_metrics_scsi_error(pslr_metrics_t *m, uint32_t error_mask) {
+    int i;
+    for (i = 0; i < SCSI_ERROR_MAX; ++i) {
+        if (error_mask & (1 << i)) {
+            ++m->scsi_errors[i];
+        }
+    }
+}
+
+const char *pslr_metric_name(pslr_metric_t metric) {
+    if (metric < 0 || metric >= PSLR_METRIC_MAX) {
+        return "unknown";
+    }
+    return metric_names[metric];
+}
+
+void pslr_metrics_print(const pslr_metrics_t *m, FILE *out) {
+    int i;
+
+    fprintf(out, "%-16s %10s %12s %10s %10s\n", "primitive", "count", "total ms", "avg us", "max us");
+    for (i = 0; i < PSLR_METRIC_MAX; ++i) {
+        const pslr_latency_t *l = &m->latency[i];
+        fprintf(out, "%-16s %10" PRIu64 " %12.1f %10" PRIu64 " %10" PRIu64 "\n",
+                metric_names[i], l->count, l->total_us / 1000.0,
+                l->count ? l->total_us / l->count : 0, l->max_us);
+    }
+    fprintf(out, "%-32s: %" PRIu64 "\n", "status polls", m->status_polls);
+    fprintf(out, "%-32s: %" PRIu64 "\n", "scsi bytes read", m->scsi_read_bytes);
+    fprintf(out, "%-32s: %" PRIu64 "\n", "scsi bytes written", m->scsi_write_bytes);
+    if (m->latency[PSLR_METRIC_SCSI_READ].total_us > 0) {
+        fprintf(out, "%-32s: %.1f\n", "scsi read throughput KiB/s",
+                m->scsi_read_bytes * 1000000.0 / 1024 / m->latency[PSLR_METRIC_SCSI_READ].total_us);
+    }
+    fprintf(out, "%-32s: %" PRIu64 "\n", "block retries", m->block_retries);
+    fprintf(out, "%-32s: %" PRIu64 "\n", "desync recoveries", m->desync_recoveries);
+    for (i = 0; i < SCSI_ERROR_MAX; ++i) {
+        char name[32];
+        snprintf(name, sizeof (name), "scsi errors (%s)", scsi_error_names[i]);
+        fprintf(out, "%-32s: %" PRIu64 "\n", name, m->scsi_errors[i]);
+    }
+    fprintf(out, "%-32s: %" PRIu64 "\n", "buffer allocations", m->buffer_allocations);
+    fprintf(out, "%-32s: %" PRIu64 "\n", "buffer reuses", m->buffer_reuses);
+    fprintf(out, "%-32s: %" PRIu64 "\n", "buffers outstanding", m->buffers_outstanding);
+}
+
+static void write_prometheus_counter(FILE *f, const char *name, const char *help, uint64_t value) {
+    fprintf(f, "# HELP pslr_%s %s\n", name, help);
+    fprintf(f, "# TYPE pslr_%s counter\n", name);
+    fprintf(f, "pslr_%s %" PRIu64 "\n", name, value);
+}
+
+/* Prometheus text exposition format. The file is written next to its
+ * final name and renamed, so a collector never sees a partial file. */
+int pslr_metrics_write_prometheus(const pslr_metrics_t *m, const char *filename) {
+    char tmpname[1024];
+    FILE *f;
+    int i, b;
+
+    snprintf(tmpname, sizeof (tmpname), "%s.tmp", filename);
+    f = fopen(tmpname, "w");
+    if (!f) {
+        return -1;
+    }
+
+    fprintf(f, "# HELP pslr_duration_seconds Latency of the camera protocol primitives.\n");
+    fprintf(f, "# TYPE pslr_duration_seconds histogram\n");
+    for (i = 0; i < PSLR_METRIC_MAX; ++i) {
+        const pslr_latency_t *l = &m->latency[i];
+        uint64_t cumulative = 0;
+        for (b = 0; b < PSLR_METRICS_BUCKETS - 1; ++b) {
+            cumulative += l->buckets[b];
+            fprintf(f, "pslr_duration_seconds_bucket{primitive=\"%s\",le=\"%g\"} %" PRIu64 "\n",
+                    metric_names[i], ((uint64_t)PSLR_METRICS_BUCKET_US << b) / 1000000.0, cumulative);
+        }
+        fprintf(f, "pslr_duration_seconds_bucket{primitive=\"%s\",le=\"+Inf\"} %" PRIu64 "\n",
+                metric_names[i], l->count);
+        fprintf(f, "pslr_duration_seconds_sum{primitive=\"%s\"} %.6f\n",
+                metric_names[i], l->total_us / 1000000.0);
+        fprintf(f, "pslr_duration_seconds_count{primitive=\"%s\"} %" PRIu64 "\n",
+                metric_names[i], l->count);
+    }
+
+    write_prometheus_counter(f, "status_polls_total", "read_status calls while waiting for the camera.", m->status_polls);
+    write_prometheus_counter(f, "scsi_read_bytes_total", "Bytes read from the camera.", m->scsi_read_bytes);
+    write_prometheus_counter(f, "scsi_write_bytes_total", "Bytes written to the camera.", m->scsi_write_bytes);
+    write_prometheus_counter(f, "block_retries_total", "Download block retries.", m->block_retries);
+    write_prometheus_counter(f, "desync_recoveries_total", "Segment info recoveries while opening a buffer.", m->desync_recoveries);
+
+    fprintf(f, "# HELP pslr_scsi_errors_total SCSI errors by class.\n");
+    fprintf(f, "# TYPE pslr_scsi_errors_total counter\n");
+    for (i = 0; i < SCSI_ERROR_MAX; ++i) {
+        fprintf(f, "pslr_scsi_errors_total{class=\"%s\"} %" PRIu64 "\n", scsi_error_names[i], m->scsi_errors[i]);
+    }
+
+    write_prometheus_counter(f, "buffer_allocations_total", "Download buffers taken from malloc.", m->buffer_allocations);
+    write_prometheus_counter(f, "buffer_reuses_total", "Download buffers taken from the pool.", m->buffer_reuses);
+    fprintf(f, "# HELP pslr_buffers_outstanding Download buffers not released yet.\n");
+    fprintf(f, "# TYPE pslr_buffers_outstanding gauge\n");
+    fprintf(f, "pslr_buffers_outstanding %" PRIu64 "\n", m->buffers_outstanding);
+
+    if (fclose(f) != 0) {
+        remove(tmpname);
+        return -1;
+    }
+#ifdef WIN32
+    /* rename() does not replace an existing file on Windows */
+    remove(filename);
+#endif
+    if (rename(tmpname, filename) != 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_METRICS_H
+#define PSLR_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pslr_scsi.h"
+
+/* Latency histogram: bucket i counts calls faster than
+ * (PSLR_METRICS_BUCKET_US << i) microseconds, the last bucket counts
+ * everything slower. */
+#define PSLR_METRICS_BUCKETS 16
+#define PSLR_METRICS_BUCKET_US 64
+
+typedef enum {
+    PSLR_METRIC_COMMAND,        // command(), one scsi write
+    PSLR_METRIC_GET_STATUS,     // get_status(), polling until the camera is ready
+    PSLR_METRIC_GET_RESULT,     // get_result(), polling until the result is ready
+    PSLR_METRIC_READ_RESULT,    // read_result()
+    PSLR_METRIC_SCSI_READ,
+    PSLR_METRIC_SCSI_WRITE,
+    PSLR_METRIC_DOWNLOAD_BLOCK, // one block of ipslr_download() including status checks
+    PSLR_METRIC_CONNECT,        // pslr_connect() / pslr_connect_fast() handshake
+    PSLR_METRIC_MAX
+} pslr_metric_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t buckets[PSLR_METRICS_BUCKETS];
+} pslr_latency_t;
+
+typedef struct {
+    pslr_latency_t latency[PSLR_METRIC_MAX];
+    uint64_t status_polls;      // read_status calls made by get_status and get_result
+    uint64_t scsi_read_bytes;
+    uint64_t scsi_write_bytes;
+    uint64_t block_retries;     // BLOCK_RETRY retries in ipslr_download
+    uint64_t desync_recoveries; // segment info recoveries in pslr_buffer_open
+    uint64_t scsi_errors[SCSI_ERROR_MAX];
+    uint64_t buffer_allocations; // download buffers taken from malloc
+    uint64_t buffer_reuses;     // download buffers taken from the pool
+    uint64_t buffers_outstanding; // download buffers not released yet
+} pslr_metrics_t;
+
+uint64_t pslr_metrics_now_us(void);
+void pslr_metrics_record(pslr_metrics_t *m, pslr_metric_t metric, uint64_t start_us);
+void pslr_metrics_scsi_error(pslr_metrics_t *m, uint32_t error_mask);
+
+const char *pslr_metric_name(pslr_metric_t metric);
+
+void pslr_metrics_print(const pslr_metrics_t *m, FILE *out);
+int pslr_metrics_write_prometheus(const pslr_metrics_t *m, const char *filename);
+
+#endif
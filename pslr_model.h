@@ -35,6 +35,9 @@
 
 #include "pslr_enum.h"
 #include "pslr_scsi.h"
+#include "pslr_trace.h"
+#include "pslr_metrics.h"
+#include "pslr_pool.h"
 
 #define MAX_RESOLUTION_SIZE 4
 #define MAX_STATUS_BUF_SIZE 452
@@ -136,7 +139,16 @@ struct ipslr_handle {
     ipslr_segment_t segments[MAX_SEGMENTS];
     uint32_t segment_count;
     uint32_t offset;
+    volatile int buffer_busy;   // between pslr_buffer_open and pslr_buffer_close
+    volatile int buffer_cancel; // set by pslr_buffer_cancel, checked between blocks
+    uint64_t buffer_deadline;   // pslr_metrics_now_us() based, 0 means none
+    int buffer_result;          // why pslr_buffer_read returned 0
     uint8_t status_buffer[MAX_STATUS_BUF_SIZE];
+    pslr_trace_t trace;
+    pslr_metrics_t metrics;
+    pslr_pool_t pool;           // download buffers
+    bool status_stale;          // status not read since pslr_init or a fast connect
+    struct pslr_watch *watch;   // status subscriptions, see pslr_get_watch()
 };
 
 void ipslr_status_parse_kx   (ipslr_handle_t *p, pslr_status *status);
@@ -0,0 +1,95 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "pslr_pool.h"
+
+/* Header in front of every block, sized to keep the data aligned */
+union pslr_pool_block {
+    struct {
+        pslr_pool_block_t *next;    /* on the free list */
+        uint32_t size_class;        /* PSLR_POOL_CLASSES if not pooled */
+    } h;
+    uint64_t align[2];
+};
+
+static uint32_t pool_class(uint32_t size) {
+    uint32_t c = 0;
+
+    while (c < PSLR_POOL_CLASSES && ((uint64_t) 1 << (PSLR_POOL_MIN_SHIFT + c)) < size) {
+        ++c;
+    }
+    return c;
+}
+
+uint8_t *pslr_pool_get(pslr_pool_t *pool, uint32_t size) {
+    uint32_t c = pool_class(size);
+    pslr_pool_block_t *b;
+
+    if (c < PSLR_POOL_CLASSES && pool->free[c]) {
+        b = pool->free[c];
+        pool->free[c] = b->h.next;
+        --pool->free_count[c];
+        ++pool->reuses;
+    } else {
+        size_t n = c < PSLR_POOL_CLASSES ? (size_t) 1 << (PSLR_POOL_MIN_SHIFT + c) : size;
+        b = malloc(sizeof (*b) + n);
+        if (!b) {
+            return NULL;
+        }
+        b->h.size_class = c;
+        ++pool->allocations;
+    }
+    b->h.next = NULL;
+    ++pool->outstanding;
+    return (uint8_t *) (b + 1);
+}
+
+void pslr_pool_put(pslr_pool_t *pool, uint8_t *data) {
+    pslr_pool_block_t *b;
+    uint32_t c;
+
+    if (!data) {
+        return;
+    }
+    b = (pslr_pool_block_t *) data - 1;
+    c = b->h.size_class;
+    --pool->outstanding;
+    if (c < PSLR_POOL_CLASSES && pool->free_count[c] < PSLR_POOL_KEEP) {
+        b->h.next = pool->free[c];
+        pool->free[c] = b;
+        ++pool->free_count[c];
+    } else {
+        free(b);
+    }
+}
+
+void pslr_pool_trim(pslr_pool_t *pool) {
+    pslr_pool_block_t *b;
+    int c;
+
+    for (c = 0; c < PSLR_POOL_CLASSES; ++c) {
+        while ((b = pool->free[c])) {
+            pool->free[c] = b->h.next;
+            free(b);
+        }
+        pool->free_count[c] = 0;
+    }
+}
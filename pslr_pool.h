@@ -0,0 +1,52 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_POOL_H
+#define PSLR_POOL_H
+
+#include <stdint.h>
+
+/* Size classed buffer pool.
+ *
+ * Blocks are rounded up to a power of two from 64 KiB and kept on a
+ * free list of their class when released, so a long session that
+ * downloads pictures of similar sizes stops allocating after the first
+ * ones. A zeroed pool is ready to use. Not thread safe: use it under
+ * the same lock as the camera handle. */
+
+#define PSLR_POOL_MIN_SHIFT 16      /* 64 KiB */
+#define PSLR_POOL_CLASSES 12        /* up to 128 MiB, larger blocks are not pooled */
+#define PSLR_POOL_KEEP 4            /* free blocks kept per class */
+
+typedef union pslr_pool_block pslr_pool_block_t;
+
+typedef struct {
+    pslr_pool_block_t *free[PSLR_POOL_CLASSES];
+    uint32_t free_count[PSLR_POOL_CLASSES];
+    uint64_t allocations;           /* blocks taken from malloc */
+    uint64_t reuses;                /* blocks taken from a free list */
+    uint64_t outstanding;           /* blocks not released yet */
+} pslr_pool_t;
+
+uint8_t *pslr_pool_get(pslr_pool_t *pool, uint32_t size);
+void pslr_pool_put(pslr_pool_t *pool, uint8_t *data);
+
+/* Frees the cached blocks, the outstanding ones can still be released */
+void pslr_pool_trim(pslr_pool_t *pool);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "pslr_ramp.h"
+
+#define RAMP_SMOOTHING 0.5
+
+void pslr_ramp_init(pslr_ramp_t *r, double target_ev, double max_step_ev) {
+    memset(r, 0, sizeof (*r));
+    r->target_ev = target_ev;
+    r->max_step_ev = max_step_ev;
+    r->smoothing = RAMP_SMOOTHING;
+}
+
+/* Move *value by up to ev stops (scaled by ev_per_stop) within
+ * [lo, hi], returns the EV that was used */
+static double ramp_move(double *value, double ev, double ev_per_stop, double lo, double hi) {
+    double room;
+
+    if (*value <= 0 || lo <= 0 || hi < lo) {
+        return 0;
+    }
+    if (ev * ev_per_stop > 0) {
+        room = fabs(log2(hi / *value) / ev_per_stop);
+    } else {
+        room = fabs(log2(*value / lo) / ev_per_stop);
+    }
+    if (fabs(ev) > room) {
+        ev = ev > 0 ? room : -room;
+    }
+    *value *= pow(2, ev * ev_per_stop);
+    return ev;
+}
+
+double pslr_ramp_update(pslr_ramp_t *r, double measured_ev) {
+    double error = r->target_ev - measured_ev;
+    double step, left;
+
+    if (!r->primed) {
+        r->error_ev = error;
+        r->primed = true;
+    } else {
+        r->error_ev += r->smoothing * (error - r->error_ev);
+    }
+    step = r->error_ev;
+    if (step > r->max_step_ev) {
+        step = r->max_step_ev;
+    } else if (step < -r->max_step_ev) {
+        step = -r->max_step_ev;
+    }
+
+    left = step;
+    /* Opening the aperture (smaller f-number) brightens: -1/2 per EV */
+    if (left > 0) {
+        left -= ramp_move(&r->shutter, left, 1, r->shutter_min, r->shutter_max);
+        left -= ramp_move(&r->iso, left, 1, r->iso_min, r->iso_max);
+        left -= ramp_move(&r->aperture, left, -0.5, r->aperture_min, r->aperture_max);
+    } else {
+        left -= ramp_move(&r->iso, left, 1, r->iso_min, r->iso_max);
+        left -= ramp_move(&r->shutter, left, 1, r->shutter_min, r->shutter_max);
+        left -= ramp_move(&r->aperture, left, -0.5, r->aperture_min, r->aperture_max);
+    }
+    step -= left;
+    /* The next measurement already contains this change */
+    r->error_ev -= step;
+    return step;
+}
+
+/* Nominal 1/3 stop values as the camera names them */
+static const double ramp_shutters[] = {
+    1.0/8000, 1.0/6400, 1.0/5000, 1.0/4000, 1.0/3200, 1.0/2500, 1.0/2000, 1.0/1600, 1.0/1250,
+    1.0/1000, 1.0/800, 1.0/640, 1.0/500, 1.0/400, 1.0/320, 1.0/250, 1.0/200, 1.0/160,
+    1.0/125, 1.0/100, 1.0/80, 1.0/60, 1.0/50, 1.0/40, 1.0/30, 1.0/25, 1.0/20, 1.0/15,
+    1.0/13, 1.0/10, 1.0/8, 1.0/6, 1.0/5, 1.0/4, 0.3, 0.4, 0.5, 0.6, 0.8,
+    1, 1.3, 1.6, 2, 2.5, 3.2, 4, 5, 6, 8, 10, 13, 15, 20, 25, 30
+};
+
+static const double ramp_isos[] = {
+    80, 100, 125, 160, 200, 250, 320, 400, 500, 640, 800, 1000, 1250, 1600, 2000,
+    2500, 3200, 4000, 5000, 6400, 8000, 10000, 12800, 16000, 20000, 25600, 32000,
+    40000, 51200
+};
+
+static const double ramp_apertures[] = {
+    1.0, 1.1, 1.2, 1.4, 1.6, 1.8, 2.0, 2.2, 2.5, 2.8, 3.2, 3.5, 4.0, 4.5, 5.0, 5.6,
+    6.3, 7.1, 8.0, 9.0, 10, 11, 13, 14, 16, 18, 20, 22, 25, 29, 32, 36, 40, 45
+};
+
+/* Nearest table value to v (on a log scale) within the limits */
+static double ramp_snap(const double *table, int n, double v, double lo, double hi) {
+    double best = v;
+    double best_dist = HUGE_VAL;
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        if (table[i] < lo * 0.97 || table[i] > hi * 1.03) {
+            continue;
+        }
+        if (fabs(log2(table[i] / v)) < best_dist) {
+            best_dist = fabs(log2(table[i] / v));
+            best = table[i];
+        }
+    }
+    return best;
+}
+
+#define RAMP_SNAP(table, v, lo, hi) ramp_snap(table, sizeof (table) / sizeof (table[0]), v, lo, hi)
+
+pslr_rational_t pslr_ramp_snap_shutter(double seconds, double min, double max) {
+    double t = RAMP_SNAP(ramp_shutters, seconds, min, max);
+    pslr_rational_t v;
+
+    if (t >= 0.3) {
+        v.nom = rint(t * 10);
+        v.denom = 10;
+    } else {
+        v.nom = 1;
+        v.denom = rint(1 / t);
+    }
+    return v;
+}
+
+pslr_rational_t pslr_ramp_get_shutter(const pslr_ramp_t *r) {
+    return pslr_ramp_snap_shutter(r->shutter, r->shutter_min, r->shutter_max);
+}
+
+uint32_t pslr_ramp_get_iso(const pslr_ramp_t *r) {
+    return rint(RAMP_SNAP(ramp_isos, r->iso, r->iso_min, r->iso_max));
+}
+
+pslr_rational_t pslr_ramp_get_aperture(const pslr_ramp_t *r) {
+    pslr_rational_t v;
+
+    v.nom = rint(RAMP_SNAP(ramp_apertures, r->aperture, r->aperture_min, r->aperture_max) * 10);
+    v.denom = 10;
+    return v;
+}
@@ -0,0 +1,69 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_RAMP_H
+#define PSLR_RAMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pslr.h"
+
+/* Exposure ramping for timelapses in manual mode.
+ *
+ * Every frame the measured brightness is compared to the target, the
+ * error is smoothed and the exposure is changed by at most
+ * max_step_ev. Brightening lengthens the shutter first, then raises
+ * the ISO and opens the aperture last; darkening lowers the ISO first.
+ * The settings are tracked continuously and rounded to the nominal 1/3
+ * stop values when they are sent to the camera, so slow ramps still
+ * progress. */
+
+typedef struct {
+    double target_ev;           /* wanted mean level, EV below the white level */
+    double max_step_ev;         /* largest change per frame */
+    double smoothing;           /* weight of a new measurement, 0..1 */
+
+    double shutter_min;         /* seconds */
+    double shutter_max;
+    double iso_min;
+    double iso_max;
+    double aperture_min;        /* f-number, 0 if not ramped */
+    double aperture_max;
+
+    double shutter;
+    double iso;
+    double aperture;
+
+    double error_ev;            /* smoothed error, positive if too dark */
+    bool primed;
+} pslr_ramp_t;
+
+void pslr_ramp_init(pslr_ramp_t *r, double target_ev, double max_step_ev);
+
+/* Returns the change in EV that was applied to the settings */
+double pslr_ramp_update(pslr_ramp_t *r, double measured_ev);
+
+pslr_rational_t pslr_ramp_get_shutter(const pslr_ramp_t *r);
+
+/* Nearest nominal 1/3 stop shutter speed within [min, max] seconds */
+pslr_rational_t pslr_ramp_snap_shutter(double seconds, double min, double max);
+uint32_t pslr_ramp_get_iso(const pslr_ramp_t *r);
+pslr_rational_t pslr_ramp_get_aperture(const pslr_ramp_t *r);
+
+#endif
@@ -0,0 +1,615 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pslr_raw.h"
+#include "pslr_scsi.h"
+
+/* The IFDs are expected in the first megabytes of the file */
+#define RAW_HEAD_MAX (4 * 1024 * 1024)
+#define RAW_IFD_CHAIN_MAX 16
+#define RAW_IFD_DEPTH_MAX 4
+
+#define TIFF_NEW_SUBFILE_TYPE 254
+#define TIFF_IMAGE_WIDTH 256
+#define TIFF_IMAGE_LENGTH 257
+#define TIFF_BITS_PER_SAMPLE 258
+#define TIFF_COMPRESSION 259
+#define TIFF_PHOTOMETRIC 262
+#define TIFF_STRIP_OFFSETS 273
+#define TIFF_SAMPLES_PER_PIXEL 277
+#define TIFF_ROWS_PER_STRIP 278
+#define TIFF_STRIP_BYTE_COUNTS 279
+#define TIFF_SUB_IFDS 330
+#define TIFF_JPEG_OFFSET 513
+#define TIFF_JPEG_LENGTH 514
+#define TIFF_CFA_PATTERN 33422
+#define DNG_BLACK_LEVEL 50714
+#define DNG_WHITE_LEVEL 50717
+
+#define TIFF_COMPRESSION_NONE 1
+#define TIFF_COMPRESSION_OLD_JPEG 6
+#define TIFF_COMPRESSION_JPEG 7
+#define TIFF_PHOTOMETRIC_CFA 32803
+
+typedef enum {
+    RAW_HEADER,                 /* buffering until the raw IFD is parsed */
+    RAW_DATA,                   /* unpacking the strips */
+    RAW_FAILED
+} raw_state_t;
+
+struct pslr_raw_analyzer {
+    pslr_raw_stats_t stats;
+    raw_state_t state;
+    int result;                 /* reason of RAW_FAILED */
+    bool big_endian;
+    uint64_t pos;               /* file offset of the next fed byte */
+
+    uint8_t *head;
+    uint32_t head_len;
+    uint32_t head_cap;
+
+    uint32_t *strip_offsets;
+    uint32_t *strip_counts;
+    uint32_t strips;
+    uint32_t strip;             /* current strip */
+
+    uint8_t *lut;               /* sample value -> histogram bin */
+    uint8_t *row;
+    uint32_t row_bytes;
+    uint32_t row_fill;
+    uint32_t rows_done;
+};
+
+typedef struct {
+    const uint8_t *p;
+    uint32_t len;
+    bool big_endian;
+    bool short_read;            /* an offset beyond the buffered data was needed */
+} tiff_t;
+
+typedef struct {
+    uint32_t subfile;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bits;
+    uint32_t compression;
+    uint32_t photometric;
+    uint32_t samples_per_pixel;
+    uint32_t rows_per_strip;
+    uint32_t offsets_entry;
+    uint32_t counts_entry;
+    uint32_t black;
+    uint32_t white;
+    uint8_t cfa[PSLR_RAW_CFA_CHANNELS];
+} raw_ifd_t;
+
+static uint32_t tiff_get(tiff_t *t, uint32_t off, uint32_t size) {
+    uint32_t v = 0;
+    uint32_t i;
+
+    if (off > t->len || size > t->len - off) {
+        t->short_read = true;
+        return 0;
+    }
+    for (i = 0; i < size; ++i) {
+        if (t->big_endian) {
+            v = (v << 8) | t->p[off + i];
+        } else {
+            v |= (uint32_t)t->p[off + i] << (8 * i);
+        }
+    }
+    return v;
+}
+
+static uint32_t tiff_count(tiff_t *t, uint32_t entry) {
+    return tiff_get(t, entry + 4, 4);
+}
+
+/* Value i of an IFD entry, the integer part for rationals */
+static uint32_t tiff_value(tiff_t *t, uint32_t entry, uint32_t i) {
+    uint32_t type = tiff_get(t, entry + 2, 2);
+    uint32_t count = tiff_count(t, entry);
+    uint32_t size;
+    uint32_t off;
+    uint32_t d;
+
+    switch (type) {
+        case 1: case 2: case 6: case 7: size = 1; break;
+        case 3: case 8: size = 2; break;
+        case 5: case 10: size = 8; break;
+        default: size = 4; break;
+    }
+    if (i >= count) {
+        return 0;
+    }
+    off = (uint64_t)size * count <= 4 ? entry + 8 : tiff_get(t, entry + 8, 4);
+    off += i * size;
+    if (size == 8) {
+        d = tiff_get(t, off + 4, 4);
+        return d ? tiff_get(t, off, 4) / d : 0;
+    }
+    return tiff_get(t, off, size);
+}
+
+/* Find the full size CFA image: IFD0 of PEF files, a sub IFD in DNG */
+static bool tiff_find_raw(tiff_t *t, uint32_t ifd, int depth, raw_ifd_t *raw) {
+    raw_ifd_t cur;
+    uint32_t n, i, j, e;
+    int chain;
+
+    for (chain = 0; ifd && chain < RAW_IFD_CHAIN_MAX && !t->short_read; ++chain) {
+        memset(&cur, 0, sizeof (cur));
+        cur.compression = TIFF_COMPRESSION_NONE;
+        cur.samples_per_pixel = 1;
+        cur.cfa[1] = cur.cfa[2] = 1;   /* RGGB unless the file says otherwise */
+        cur.cfa[3] = 2;
+
+        n = tiff_get(t, ifd, 2);
+        for (i = 0; i < n && !t->short_read; ++i) {
+            e = ifd + 2 + 12 * i;
+            switch (tiff_get(t, e, 2)) {
+                case TIFF_NEW_SUBFILE_TYPE: cur.subfile = tiff_value(t, e, 0); break;
+                case TIFF_IMAGE_WIDTH: cur.width = tiff_value(t, e, 0); break;
+                case TIFF_IMAGE_LENGTH: cur.height = tiff_value(t, e, 0); break;
+                case TIFF_BITS_PER_SAMPLE: cur.bits = tiff_value(t, e, 0); break;
+                case TIFF_COMPRESSION: cur.compression = tiff_value(t, e, 0); break;
+                case TIFF_PHOTOMETRIC: cur.photometric = tiff_value(t, e, 0); break;
+                case TIFF_STRIP_OFFSETS: cur.offsets_entry = e; break;
+                case TIFF_SAMPLES_PER_PIXEL: cur.samples_per_pixel = tiff_value(t, e, 0); break;
+                case TIFF_ROWS_PER_STRIP: cur.rows_per_strip = tiff_value(t, e, 0); break;
+                case TIFF_STRIP_BYTE_COUNTS: cur.counts_entry = e; break;
+                case TIFF_CFA_PATTERN:
+                    if (tiff_count(t, e) == PSLR_RAW_CFA_CHANNELS) {
+                        for (j = 0; j < PSLR_RAW_CFA_CHANNELS; ++j) {
+                            cur.cfa[j] = tiff_value(t, e, j);
+                        }
+                    }
+                    break;
+                case DNG_BLACK_LEVEL: cur.black = tiff_value(t, e, 0); break;
+                case DNG_WHITE_LEVEL: cur.white = tiff_value(t, e, 0); break;
+                case TIFF_SUB_IFDS:
+                    if (depth < RAW_IFD_DEPTH_MAX) {
+                        for (j = 0; j < tiff_count(t, e); ++j) {
+                            if (tiff_find_raw(t, tiff_value(t, e, j), depth + 1, raw)) {
+                                return true;
+                            }
+                        }
+                    }
+                    break;
+            }
+        }
+        if (!t->short_read && cur.photometric == TIFF_PHOTOMETRIC_CFA && cur.subfile == 0) {
+            *raw = cur;
+            return true;
+        }
+        ifd = tiff_get(t, ifd + 2 + 12 * n, 4);
+    }
+    return false;
+}
+
+/* Keep the largest JPEG stream found in the IFDs */
+static void tiff_preview_candidate(tiff_t *t, uint32_t offset, uint32_t length, uint32_t *best_offset, uint32_t *best_length) {
+    if (length > *best_length && length >= 2 && offset < t->len && length <= t->len - offset
+        && t->p[offset] == 0xff && t->p[offset + 1] == 0xd8) {
+        *best_offset = offset;
+        *best_length = length;
+    }
+}
+
+/* JPEG previews: JPEGInterchangeFormat tags (PEF) and single strip
+ * JPEG compressed images (DNG preview sub IFDs) */
+static void tiff_find_preview(tiff_t *t, uint32_t ifd, int depth, uint32_t *offset, uint32_t *length) {
+    uint32_t n, i, j, e;
+    uint32_t jpeg_offset, jpeg_length, compression, strips_entry, counts_entry;
+    int chain;
+
+    for (chain = 0; ifd && chain < RAW_IFD_CHAIN_MAX; ++chain) {
+        jpeg_offset = jpeg_length = compression = strips_entry = counts_entry = 0;
+        n = tiff_get(t, ifd, 2);
+        for (i = 0; i < n; ++i) {
+            e = ifd + 2 + 12 * i;
+            switch (tiff_get(t, e, 2)) {
+                case TIFF_COMPRESSION: compression = tiff_value(t, e, 0); break;
+                case TIFF_STRIP_OFFSETS: strips_entry = e; break;
+                case TIFF_STRIP_BYTE_COUNTS: counts_entry = e; break;
+                case TIFF_JPEG_OFFSET: jpeg_offset = tiff_value(t, e, 0); break;
+                case TIFF_JPEG_LENGTH: jpeg_length = tiff_value(t, e, 0); break;
+                case TIFF_SUB_IFDS:
+                    if (depth < RAW_IFD_DEPTH_MAX) {
+                        for (j = 0; j < tiff_count(t, e); ++j) {
+                            tiff_find_preview(t, tiff_value(t, e, j), depth + 1, offset, length);
+                        }
+                    }
+                    break;
+            }
+        }
+        if (jpeg_offset && jpeg_length) {
+            tiff_preview_candidate(t, jpeg_offset, jpeg_length, offset, length);
+        }
+        if ((compression == TIFF_COMPRESSION_JPEG || compression == TIFF_COMPRESSION_OLD_JPEG)
+            && strips_entry && counts_entry && tiff_count(t, strips_entry) == 1) {
+            tiff_preview_candidate(t, tiff_value(t, strips_entry, 0), tiff_value(t, counts_entry, 0), offset, length);
+        }
+        ifd = tiff_get(t, ifd + 2 + 12 * n, 4);
+    }
+}
+
+int pslr_raw_find_preview(const uint8_t *data, uint32_t len, uint32_t *offset, uint32_t *length) {
+    tiff_t t;
+
+    if (len < 8) {
+        return PSLR_PARAM;
+    }
+    t.p = data;
+    t.len = len;
+    t.short_read = false;
+    if (!memcmp(data, "II*\0", 4)) {
+        t.big_endian = false;
+    } else if (!memcmp(data, "MM\0*", 4)) {
+        t.big_endian = true;
+    } else {
+        return PSLR_PARAM;
+    }
+    *offset = 0;
+    *length = 0;
+    tiff_find_preview(&t, tiff_get(&t, 4, 4), 0, offset, length);
+    DPRINT("raw preview: %u bytes at %u\n", *length, *offset);
+    return *length ? PSLR_OK : PSLR_PARAM;
+}
+
+static void raw_fail(pslr_raw_analyzer_t *a, int result, const char *why) {
+    DPRINT("raw analysis: %s\n", why);
+    a->state = RAW_FAILED;
+    a->result = result;
+}
+
+/* Returns false while more of the file is needed */
+static bool raw_parse(pslr_raw_analyzer_t *a) {
+    tiff_t t;
+    raw_ifd_t raw;
+    pslr_raw_stats_t *s = &a->stats;
+    uint32_t i, v, range;
+
+    if (a->head_len < 8) {
+        return false;
+    }
+    t.p = a->head;
+    t.len = a->head_len;
+    t.short_read = false;
+    if (!memcmp(a->head, "II*\0", 4)) {
+        t.big_endian = false;
+    } else if (!memcmp(a->head, "MM\0*", 4)) {
+        t.big_endian = true;
+    } else {
+        raw_fail(a, PSLR_PARAM, "not a TIFF based file");
+        return true;
+    }
+    if (!tiff_find_raw(&t, tiff_get(&t, 4, 4), 0, &raw)) {
+        if (!t.short_read) {
+            raw_fail(a, PSLR_PARAM, "no CFA image");
+        }
+        return !t.short_read;
+    }
+    if (raw.compression != TIFF_COMPRESSION_NONE) {
+        raw_fail(a, PSLR_PARAM, "compressed raw data");
+        return true;
+    }
+    if (raw.samples_per_pixel != 1 || raw.bits < 8 || raw.bits > 16 || !raw.width || !raw.height
+        || !raw.offsets_entry || !raw.counts_entry || !tiff_count(&t, raw.offsets_entry)
+        || tiff_count(&t, raw.offsets_entry) != tiff_count(&t, raw.counts_entry)) {
+        raw_fail(a, PSLR_PARAM, "unsupported raw layout");
+        return true;
+    }
+
+    a->strips = tiff_count(&t, raw.offsets_entry);
+    a->strip_offsets = malloc(a->strips * sizeof (uint32_t));
+    a->strip_counts = malloc(a->strips * sizeof (uint32_t));
+    if (!a->strip_offsets || !a->strip_counts) {
+        raw_fail(a, PSLR_NO_MEMORY, "out of memory");
+        return true;
+    }
+    for (i = 0; i < a->strips; ++i) {
+        a->strip_offsets[i] = tiff_value(&t, raw.offsets_entry, i);
+        a->strip_counts[i] = tiff_value(&t, raw.counts_entry, i);
+    }
+    if (t.short_read) {
+        free(a->strip_offsets);
+        free(a->strip_counts);
+        a->strip_offsets = a->strip_counts = NULL;
+        return false;
+    }
+    for (i = 1; i < a->strips; ++i) {
+        /* Strips are consumed in file order */
+        if (a->strip_offsets[i] < a->strip_offsets[i - 1] + a->strip_counts[i - 1]) {
+            raw_fail(a, PSLR_PARAM, "strips out of order");
+            return true;
+        }
+    }
+
+    s->width = raw.width;
+    s->height = raw.height;
+    s->bits = raw.bits;
+    s->black = raw.black;
+    s->white = raw.white ? raw.white : (1u << raw.bits) - 1;
+    memcpy(s->cfa, raw.cfa, sizeof (s->cfa));
+    if (s->black >= s->white) {
+        raw_fail(a, PSLR_PARAM, "bad black / white level");
+        return true;
+    }
+
+    a->big_endian = t.big_endian;
+    a->row_bytes = ((uint64_t)raw.width * raw.bits + 7) / 8;
+    a->row = malloc(a->row_bytes);
+    a->lut = malloc(1u << raw.bits);
+    if (!a->row || !a->lut) {
+        raw_fail(a, PSLR_NO_MEMORY, "out of memory");
+        return true;
+    }
+    range = s->white - s->black;
+    for (v = 0; v < (1u << raw.bits); ++v) {
+        if (v <= s->black) {
+            a->lut[v] = 0;
+        } else if (v >= s->white) {
+            a->lut[v] = PSLR_RAW_HISTOGRAM_BINS - 1;
+        } else {
+            a->lut[v] = (uint64_t)(v - s->black) * PSLR_RAW_HISTOGRAM_BINS / range;
+        }
+    }
+    DPRINT("raw analysis: %ux%u %u bit, %u strips, black %u white %u\n",
+           s->width, s->height, s->bits, a->strips, s->black, s->white);
+    a->state = RAW_DATA;
+    return true;
+}
+
+#define RAW_COUNT(ch, v) do { \
+        uint32_t v_ = (v); \
+        ++hist[ch][lut[v_]]; \
+        if (v_ >= white) ++saturated[ch]; \
+    } while (0)
+
+/* Rows are byte aligned; samples narrower than 16 bit are packed most
+ * significant bit first whatever the byte order of the file is */
+static void raw_unpack_row(pslr_raw_analyzer_t *a) {
+    pslr_raw_stats_t *s = &a->stats;
+    uint32_t *hist[2];
+    uint64_t *saturated = &s->saturated[(a->rows_done & 1) * 2];
+    const uint8_t *lut = a->lut;
+    const uint8_t *p = a->row;
+    uint32_t white = s->white;
+    uint32_t mask = (1u << s->bits) - 1;
+    uint32_t width = s->width;
+    uint32_t x;
+
+    hist[0] = s->histogram[(a->rows_done & 1) * 2];
+    hist[1] = s->histogram[(a->rows_done & 1) * 2 + 1];
+
+    if (s->bits == 8) {
+        for (x = 0; x < width; ++x) {
+            RAW_COUNT(x & 1, p[x]);
+        }
+    } else if (s->bits == 16) {
+        for (x = 0; x < width; ++x, p += 2) {
+            RAW_COUNT(x & 1, a->big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0]);
+        }
+    } else if (s->bits == 12) {
+        for (x = 0; x + 1 < width; x += 2, p += 3) {
+            RAW_COUNT(0, (p[0] << 4) | (p[1] >> 4));
+            RAW_COUNT(1, ((p[1] & 0x0f) << 8) | p[2]);
+        }
+        if (x < width) {
+            RAW_COUNT(0, (p[0] << 4) | (p[1] >> 4));
+        }
+    } else {
+        uint32_t acc = 0;
+        uint32_t nbits = 0;
+        for (x = 0; x < width; ++x) {
+            while (nbits < s->bits) {
+                acc = (acc << 8) | *p++;
+                nbits += 8;
+            }
+            nbits -= s->bits;
+            RAW_COUNT(x & 1, (acc >> nbits) & mask);
+            acc &= (1u << nbits) - 1;
+        }
+    }
+    s->samples[(a->rows_done & 1) * 2] += (width + 1) / 2;
+    s->samples[(a->rows_done & 1) * 2 + 1] += width / 2;
+    ++a->rows_done;
+}
+
+/* Consume the part of data (starting at file offset pos) that belongs
+ * to the strips */
+static void raw_consume(pslr_raw_analyzer_t *a, const uint8_t *data, uint64_t pos, uint32_t n) {
+    while (n > 0 && a->strip < a->strips && a->rows_done < a->stats.height) {
+        uint64_t start = a->strip_offsets[a->strip];
+        uint64_t end = start + a->strip_counts[a->strip];
+        uint32_t take;
+
+        if (pos >= end) {
+            /* Strips start at a row boundary */
+            a->row_fill = 0;
+            ++a->strip;
+            continue;
+        }
+        if (pos < start) {
+            if (pos + n <= start) {
+                return;
+            }
+            data += start - pos;
+            n -= start - pos;
+            pos = start;
+        }
+        take = end - pos < n ? end - pos : n;
+        pos += take;
+        n -= take;
+        while (take > 0 && a->rows_done < a->stats.height) {
+            uint32_t c = a->row_bytes - a->row_fill;
+            if (c > take) {
+                c = take;
+            }
+            memcpy(a->row + a->row_fill, data, c);
+            a->row_fill += c;
+            data += c;
+            take -= c;
+            if (a->row_fill == a->row_bytes) {
+                raw_unpack_row(a);
+                a->row_fill = 0;
+            }
+        }
+        data += take;
+    }
+}
+
+pslr_raw_analyzer_t *pslr_raw_analyzer_new(void) {
+    pslr_raw_analyzer_t *a = malloc(sizeof (*a));
+    if (!a) {
+        return NULL;
+    }
+    memset(a, 0, sizeof (*a));
+    a->state = RAW_HEADER;
+    return a;
+}
+
+void pslr_raw_analyzer_free(pslr_raw_analyzer_t *a) {
+    if (!a) {
+        return;
+    }
+    free(a->head);
+    free(a->strip_offsets);
+    free(a->strip_counts);
+    free(a->lut);
+    free(a->row);
+    free(a);
+}
+
+void pslr_raw_analyzer_feed(pslr_raw_analyzer_t *a, const uint8_t *data, uint32_t n) {
+    if (a->state == RAW_HEADER) {
+        if (a->head_len + n > a->head_cap) {
+            uint32_t cap = a->head_cap ? a->head_cap : 65536;
+            uint8_t *head;
+            while (cap < a->head_len + n) {
+                cap *= 2;
+            }
+            head = realloc(a->head, cap);
+            if (!head) {
+                raw_fail(a, PSLR_NO_MEMORY, "out of memory");
+                return;
+            }
+            a->head = head;
+            a->head_cap = cap;
+        }
+        memcpy(a->head + a->head_len, data, n);
+        a->head_len += n;
+        a->pos += n;
+        if (!raw_parse(a)) {
+            if (a->head_len >= RAW_HEAD_MAX) {
+                raw_fail(a, PSLR_PARAM, "raw image not found in the file header");
+            }
+            return;
+        }
+        if (a->state == RAW_DATA) {
+            /* The buffered part may already contain image data */
+            raw_consume(a, a->head, 0, a->head_len);
+        }
+        free(a->head);
+        a->head = NULL;
+        a->head_len = a->head_cap = 0;
+    } else if (a->state == RAW_DATA) {
+        raw_consume(a, data, a->pos, n);
+        a->pos += n;
+    }
+}
+
+/* PSLR_PARAM if the file cannot be analyzed, PSLR_READ_ERROR if the
+ * image data was incomplete */
+int pslr_raw_analyzer_finish(pslr_raw_analyzer_t *a, pslr_raw_stats_t *stats) {
+    pslr_raw_stats_t *s = &a->stats;
+    float headroom = -1;
+    int ch, bin;
+
+    if (a->state == RAW_FAILED) {
+        return a->result;
+    }
+    if (a->state != RAW_DATA || a->rows_done < s->height) {
+        return PSLR_READ_ERROR;
+    }
+    for (ch = 0; ch < PSLR_RAW_CFA_CHANNELS; ++ch) {
+        uint64_t limit = s->samples[ch] / 1000;
+        uint64_t above = 0;
+        float h;
+
+        if (!s->samples[ch]) {
+            continue;
+        }
+        for (bin = PSLR_RAW_HISTOGRAM_BINS - 1; bin > 0; --bin) {
+            above += s->histogram[ch][bin];
+            if (above > limit) {
+                break;
+            }
+        }
+        h = bin == PSLR_RAW_HISTOGRAM_BINS - 1 ? 0 : log2f((float)PSLR_RAW_HISTOGRAM_BINS / (bin + 1));
+        if (headroom < 0 || h < headroom) {
+            headroom = h;
+        }
+    }
+    s->headroom_ev = headroom < 0 ? 0 : headroom;
+    *stats = *s;
+    return PSLR_OK;
+}
+
+double pslr_raw_stats_mean_ev(const pslr_raw_stats_t *s) {
+    double sum = 0;
+    uint64_t n = 0;
+    int ch, bin;
+
+    for (ch = 0; ch < PSLR_RAW_CFA_CHANNELS; ++ch) {
+        for (bin = 0; bin < PSLR_RAW_HISTOGRAM_BINS; ++bin) {
+            sum += (bin + 0.5) * s->histogram[ch][bin];
+        }
+        n += s->samples[ch];
+    }
+    if (!n || sum <= 0) {
+        return -log2(PSLR_RAW_HISTOGRAM_BINS);
+    }
+    return log2(sum / n / PSLR_RAW_HISTOGRAM_BINS);
+}
+
+void pslr_raw_stats_print(const pslr_raw_stats_t *s, FILE *out) {
+    static const char *colors[] = { "red", "green", "blue" };
+    int ch;
+
+    fprintf(out, "%-32s: %ux%u %u bit\n", "raw image", s->width, s->height, s->bits);
+    fprintf(out, "%-32s: %u / %u\n", "black / white level", s->black, s->white);
+    for (ch = 0; ch < PSLR_RAW_CFA_CHANNELS; ++ch) {
+        char name[32];
+        snprintf(name, sizeof (name), "saturated (%d,%d %s)", ch / 2, ch % 2,
+                 s->cfa[ch] < 3 ? colors[s->cfa[ch]] : "?");
+        fprintf(out, "%-32s: %" PRIu64 " (%.3f%%)\n", name, s->saturated[ch],
+                s->samples[ch] ? 100.0 * s->saturated[ch] / s->samples[ch] : 0.0);
+    }
+    fprintf(out, "%-32s: %.2f EV\n", "highlight headroom", s->headroom_ev);
+}
@@ -0,0 +1,71 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_RAW_H
+#define PSLR_RAW_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Sensor level statistics of PEF / DNG files.
+ *
+ * The file is fed block by block as it is downloaded. The TIFF
+ * structure at the start of the file is buffered until the raw image
+ * is located, later blocks are unpacked on the fly, so the statistics
+ * are ready when the download ends. Only uncompressed strips of 8-16
+ * bit CFA samples can be analyzed; Huffman or lossless JPEG
+ * compressed files report PSLR_PARAM. */
+
+#define PSLR_RAW_HISTOGRAM_BINS 256
+
+/* The four positions of the 2x2 colour filter array, row major */
+#define PSLR_RAW_CFA_CHANNELS 4
+
+typedef struct pslr_raw_analyzer pslr_raw_analyzer_t;
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bits;
+    uint32_t black;
+    uint32_t white;
+    uint8_t cfa[PSLR_RAW_CFA_CHANNELS];        /* 0 red, 1 green, 2 blue */
+    uint64_t samples[PSLR_RAW_CFA_CHANNELS];
+    uint64_t saturated[PSLR_RAW_CFA_CHANNELS]; /* samples at or above the white level */
+    /* linear from the black to the white level */
+    uint32_t histogram[PSLR_RAW_CFA_CHANNELS][PSLR_RAW_HISTOGRAM_BINS];
+    /* Stops between the brightest 0.1% of the samples of any channel
+     * and the white level, 0 if the channel is clipped */
+    float headroom_ev;
+} pslr_raw_stats_t;
+
+pslr_raw_analyzer_t *pslr_raw_analyzer_new(void);
+void pslr_raw_analyzer_free(pslr_raw_analyzer_t *a);
+void pslr_raw_analyzer_feed(pslr_raw_analyzer_t *a, const uint8_t *data, uint32_t n);
+int pslr_raw_analyzer_finish(pslr_raw_analyzer_t *a, pslr_raw_stats_t *stats);
+
+/* Mean level of all samples in EV below the white level */
+double pslr_raw_stats_mean_ev(const pslr_raw_stats_t *s);
+
+void pslr_raw_stats_print(const pslr_raw_stats_t *s, FILE *out);
+
+/* Largest embedded JPEG preview of a complete PEF / DNG file in memory,
+ * PSLR_PARAM if there is none */
+int pslr_raw_find_preview(const uint8_t *data, uint32_t len, uint32_t *offset, uint32_t *length);
+
+#endif
@@ -0,0 +1,252 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pslr_sched.h"
+
+#define SCHED_BLKSZ 65536 /* Same as the download block size of pslr.c */
+
+struct pslr_sched {
+    pslr_handle_t h;
+    pslr_sched_req_t *queue;    /* FIFO within the same priority */
+    pslr_sched_req_t *current;  /* request whose buffer is open */
+    bool stepping;
+    uint8_t block[SCHED_BLKSZ];
+};
+
+pslr_sched_t *pslr_sched_new(pslr_handle_t h) {
+    pslr_sched_t *s = malloc(sizeof (*s));
+    if (!s) {
+        return NULL;
+    }
+    memset(s, 0, sizeof (*s));
+    s->h = h;
+    return s;
+}
+
+static void sched_close(pslr_sched_t *s) {
+    if (s->current) {
+        pslr_buffer_close(s->h);
+        s->current = NULL;
+    }
+}
+
+static void sched_finish(pslr_sched_t *s, pslr_sched_req_t *req, int result) {
+    pslr_sched_req_t **pp;
+
+    if (s->current == req) {
+        sched_close(s);
+    }
+    for (pp = &s->queue; *pp; pp = &(*pp)->next) {
+        if (*pp == req) {
+            *pp = req->next;
+            break;
+        }
+    }
+    req->next = NULL;
+    req->result = result;
+    DPRINT("sched: buffer %d type %d done: %d\n", req->bufno, req->type, result);
+    if (req->done) {
+        req->done(req);
+    }
+    pslr_buffer_release(s->h, req->data);
+    free(req);
+}
+
+void pslr_sched_free(pslr_sched_t *s) {
+    if (!s) {
+        return;
+    }
+    sched_close(s);
+    while (s->queue) {
+        sched_finish(s, s->queue, PSLR_CANCELLED);
+    }
+    free(s);
+}
+
+pslr_sched_req_t *pslr_sched_add(pslr_sched_t *s, int bufno, pslr_buffer_type type, int resolution,
+                                 pslr_sched_priority_t priority, pslr_sched_sink_t sink,
+                                 pslr_sched_done_t done, void *user_data) {
+    pslr_sched_req_t *req;
+    pslr_sched_req_t **pp;
+
+    req = malloc(sizeof (*req));
+    if (!req) {
+        return NULL;
+    }
+    memset(req, 0, sizeof (*req));
+    req->bufno = bufno;
+    req->type = type;
+    req->resolution = resolution;
+    req->priority = priority;
+    req->sink = sink;
+    req->done = done;
+    req->user_data = user_data;
+
+    for (pp = &s->queue; *pp; pp = &(*pp)->next)
+        ;
+    *pp = req;
+    return req;
+}
+
+/* Forget every request of a buffer, e.g. because it was deleted */
+void pslr_sched_drop(pslr_sched_t *s, int bufno) {
+    pslr_sched_req_t *req = s->queue;
+    pslr_sched_req_t *next;
+
+    while (req) {
+        next = req->next;
+        if (req->bufno == bufno) {
+            sched_finish(s, req, PSLR_CANCELLED);
+        }
+        req = next;
+    }
+}
+
+/* Close the open buffer before other camera commands (e.g. the
+ * shutter); the next step reopens it and continues at the same offset */
+void pslr_sched_pause(pslr_sched_t *s) {
+    if (!s->stepping) {
+        sched_close(s);
+    }
+}
+
+bool pslr_sched_pending(pslr_sched_t *s) {
+    return s->queue != NULL;
+}
+
+pslr_sched_req_t *pslr_sched_current(pslr_sched_t *s) {
+    return s->current;
+}
+
+/* The running request keeps going until something strictly more
+ * important arrives, so equal priorities do not thrash the camera
+ * with buffer selections */
+static pslr_sched_req_t *sched_pick(pslr_sched_t *s) {
+    pslr_sched_req_t *best = s->current;
+    pslr_sched_req_t *req;
+
+    for (req = s->queue; req; req = req->next) {
+        if (!best || req->priority < best->priority) {
+            best = req;
+        }
+    }
+    return best;
+}
+
+static int sched_open(pslr_sched_t *s, pslr_sched_req_t *req) {
+    uint32_t length;
+    int ret;
+
+    sched_close(s);
+    ret = pslr_buffer_open(s->h, req->bufno, req->type, req->resolution);
+    if (ret != PSLR_OK) {
+        pslr_buffer_close(s->h);
+        return ret;
+    }
+    length = pslr_buffer_get_size(s->h);
+    if (req->length && req->length != length) {
+        /* The buffer changed while the request was preempted */
+        pslr_buffer_close(s->h);
+        return PSLR_READ_ERROR;
+    }
+    req->length = length;
+    if (!req->sink && !req->data) {
+        req->data = pslr_buffer_alloc(s->h, length);
+        if (!req->data) {
+            pslr_buffer_close(s->h);
+            return PSLR_NO_MEMORY;
+        }
+    }
+    ret = pslr_buffer_seek(s->h, req->offset);
+    if (ret != PSLR_OK) {
+        pslr_buffer_close(s->h);
+        return ret;
+    }
+    if (req->offset) {
+        DPRINT("sched: resume buffer %d type %d at %d/%d\n", req->bufno, req->type, req->offset, length);
+    }
+    s->current = req;
+    return PSLR_OK;
+}
+
+/* Download one block of the most important request. Returns PSLR_OK
+ * while there is progress, PSLR_CANCELLED if pslr_buffer_cancel()
+ * paused the transfer. Failed requests are finished with their error. */
+int pslr_sched_step(pslr_sched_t *s) {
+    pslr_sched_req_t *req;
+    uint8_t *dst;
+    uint32_t n;
+    int ret;
+
+    if (s->stepping) {
+        return PSLR_OK;
+    }
+    req = sched_pick(s);
+    if (!req) {
+        return PSLR_OK;
+    }
+    s->stepping = true;
+
+    if (req != s->current) {
+        ret = sched_open(s, req);
+        if (ret != PSLR_OK) {
+            sched_finish(s, req, ret);
+            s->stepping = false;
+            return ret;
+        }
+    }
+
+    if (req->sink) {
+        dst = s->block;
+        n = SCHED_BLKSZ;
+    } else {
+        dst = req->data + req->offset;
+        n = req->length - req->offset;
+    }
+    n = req->offset < req->length ? pslr_buffer_read(s->h, dst, n) : 0;
+    if (n == 0) {
+        ret = pslr_buffer_get_result(s->h);
+        if (ret == PSLR_CANCELLED) {
+            /* Paused, continue from the same offset later */
+            sched_close(s);
+        } else {
+            if (ret == PSLR_OK && req->offset != req->length) {
+                ret = PSLR_READ_ERROR;
+            }
+            sched_finish(s, req, ret);
+        }
+        s->stepping = false;
+        return ret;
+    }
+    req->offset += n;
+    if (req->sink && req->sink(req, dst, n) != 0) {
+        sched_finish(s, req, PSLR_CANCELLED);
+        s->stepping = false;
+        return PSLR_OK;
+    }
+    if (req->offset == req->length) {
+        sched_finish(s, req, PSLR_OK);
+    }
+    s->stepping = false;
+    return PSLR_OK;
+}
@@ -0,0 +1,85 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_SCHED_H
+#define PSLR_SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pslr.h"
+
+/* Download scheduler.
+ *
+ * Buffer downloads are queued with a priority and executed one block
+ * per pslr_sched_step() call, so the caller can interleave them with
+ * other camera I/O (status polling, shutter). A request of higher
+ * priority preempts the running one at the next block: the running
+ * buffer is closed, and later reopened and continued from the same
+ * offset. pslr_buffer_cancel() on the handle also pauses the running
+ * request, it is resumed by a later step. */
+
+typedef enum {
+    PSLR_SCHED_THUMBNAIL,       /* highest priority */
+    PSLR_SCHED_PREVIEW,
+    PSLR_SCHED_FULL,
+    PSLR_SCHED_PRIORITY_MAX
+} pslr_sched_priority_t;
+
+typedef struct pslr_sched pslr_sched_t;
+typedef struct pslr_sched_req pslr_sched_req_t;
+
+/* Called with every downloaded block, a non zero return value aborts
+ * the request. Without a sink the data is collected in req->data. */
+typedef int (*pslr_sched_sink_t)(pslr_sched_req_t *req, const uint8_t *data, uint32_t n);
+
+/* Called once when the request finished, failed or was dropped. The
+ * request is freed afterwards; set req->data to NULL to keep the data,
+ * it has to be given back with pslr_buffer_release() then. */
+typedef void (*pslr_sched_done_t)(pslr_sched_req_t *req);
+
+struct pslr_sched_req {
+    int bufno;
+    pslr_buffer_type type;
+    int resolution;
+    pslr_sched_priority_t priority;
+    pslr_sched_sink_t sink;
+    pslr_sched_done_t done;
+    void *user_data;
+
+    uint32_t offset;            /* bytes downloaded so far, including the block passed to sink */
+    uint32_t length;            /* buffer size, 0 until first opened */
+    uint8_t *data;              /* collected data if there is no sink (pslr_buffer_alloc) */
+    int result;                 /* set before done is called */
+    pslr_sched_req_t *next;
+};
+
+pslr_sched_t *pslr_sched_new(pslr_handle_t h);
+void pslr_sched_free(pslr_sched_t *s);
+
+pslr_sched_req_t *pslr_sched_add(pslr_sched_t *s, int bufno, pslr_buffer_type type, int resolution,
+                                 pslr_sched_priority_t priority, pslr_sched_sink_t sink,
+                                 pslr_sched_done_t done, void *user_data);
+void pslr_sched_drop(pslr_sched_t *s, int bufno);
+
+bool pslr_sched_pending(pslr_sched_t *s);
+pslr_sched_req_t *pslr_sched_current(pslr_sched_t *s);
+int pslr_sched_step(pslr_sched_t *s);
+void pslr_sched_pause(pslr_sched_t *s);
+
+#endif
@@ -35,7 +35,9 @@ extern bool debug;
 extern void write_debug( const char* message, ... );
 
 #ifndef ANDROID
-    #define DPRINT(x...) write_debug(x)
+    /* Test the flag here, so disabled debug output costs neither a call
+     * nor the evaluation of the arguments */
+    #define DPRINT(x...) do { if (debug) write_debug(x); } while (0)
 #else
     #include <android/log.h>
     #define DPRINT(...)	\
@@ -50,14 +52,30 @@ typedef enum {
     PSLR_READ_ERROR,
     PSLR_NO_MEMORY,
     PSLR_PARAM,                 /* Invalid parameters to API */
+    PSLR_CANCELLED,             /* Download cancelled by pslr_buffer_cancel() */
+    PSLR_TIMEOUT,               /* Download deadline exceeded */
     PSLR_ERROR_MAX
 } pslr_result;
 
+/* Error classes of the last failed scsi_read() / scsi_write() call,
+ * returned as a bitmask of (1 << class) by scsi_last_error() */
+typedef enum {
+    SCSI_ERROR_IOCTL = 0,       // the ioctl / DeviceIoControl call itself failed
+    SCSI_ERROR_SENSE,           // sense data was returned
+    SCSI_ERROR_STATUS,          // SCSI status
+    SCSI_ERROR_HOST,            // host adapter status
+    SCSI_ERROR_DRIVER,          // driver status
+    SCSI_ERROR_MAX
+} scsi_error_class;
+
+uint32_t scsi_last_error(void);
+
+/* timeout_ms limits a single transaction */
 int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
-		     uint8_t *buf, uint32_t bufLen);
+		     uint8_t *buf, uint32_t bufLen, uint32_t timeout_ms);
 
 int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
-               uint8_t *buf, uint32_t bufLen);
+               uint8_t *buf, uint32_t bufLen, uint32_t timeout_ms);
 
 char **get_drives(int *driveNum);
 
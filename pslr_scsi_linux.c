@@ -38,10 +38,18 @@
     #include "scsi_android.h"
 #endif /* ANDROID */
 
+static uint32_t last_error = 0;
+
+uint32_t scsi_last_error(void) {
+    return last_error;
+}
+
 void print_scsi_error(sg_io_hdr_t *pIo, uint8_t *sense_buffer) {
     int k;
 
+    last_error = 0;
     if (pIo->sb_len_wr > 0) {
+        last_error |= 1 << SCSI_ERROR_SENSE;
         DPRINT("SCSI error: sense data: ");
         for (k = 0; k < pIo->sb_len_wr; ++k) {
             if ((k > 0) && (0 == (k % 10)))
@@ -50,12 +58,18 @@ void print_scsi_error(sg_io_hdr_t *pIo, uint8_t *sense_buffer) {
         }
         DPRINT("\n");
     }
-    if (pIo->masked_status)
+    if (pIo->masked_status) {
+        last_error |= 1 << SCSI_ERROR_STATUS;
         DPRINT("SCSI status=0x%x\n", pIo->status);
-    if (pIo->host_status)
+    }
+    if (pIo->host_status) {
+        last_error |= 1 << SCSI_ERROR_HOST;
         DPRINT("host_status=0x%x\n", pIo->host_status);
-    if (pIo->driver_status)
+    }
+    if (pIo->driver_status) {
+        last_error |= 1 << SCSI_ERROR_DRIVER;
         DPRINT("driver_status=0x%x\n", pIo->driver_status);
+    }
 }
 
 char **get_drives(int *driveNum) {
@@ -151,7 +165,7 @@ void close_drive(int *hDevice) {
 }
 
 int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
-        uint8_t *buf, uint32_t bufLen) {
+        uint8_t *buf, uint32_t bufLen, uint32_t timeout_ms) {
     sg_io_hdr_t io;
     uint8_t sense[32];
     int r;
@@ -167,7 +181,7 @@ int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
     io.dxferp = buf;
     io.cmdp = cmd;
     io.sbp = sense;
-    io.timeout = 20000; /* 20000 millisecs == 20 seconds */
+    io.timeout = timeout_ms;
     /* io.flags = 0; */ /* take defaults: indirect IO, etc */
     /* io.pack_id = 0; */
     /* io.usr_ptr = NULL; */
@@ -175,6 +189,7 @@ int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
     r = ioctl(sg_fd, SG_IO, &io);
     if (r == -1) {
         perror("ioctl");
+        last_error = 1 << SCSI_ERROR_IOCTL;
         return -PSLR_DEVICE_ERROR;
     }
 
@@ -192,7 +207,7 @@ int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
 }
 
 int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
-        uint8_t *buf, uint32_t bufLen) {
+        uint8_t *buf, uint32_t bufLen, uint32_t timeout_ms) {
 
     sg_io_hdr_t io;
     uint8_t sense[32];
@@ -209,7 +224,7 @@ int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
     io.dxferp = buf;
     io.cmdp = cmd;
     io.sbp = sense;
-    io.timeout = 20000; /* 20000 millisecs == 20 seconds */
+    io.timeout = timeout_ms;
     /* io.flags = 0; */ /* take defaults: indirect IO, etc */
     /* io.pack_id = 0; */
     /* io.usr_ptr = NULL; */
@@ -218,6 +233,7 @@ int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
 
     if (r == -1) {
         perror("ioctl");
+        last_error = 1 << SCSI_ERROR_IOCTL;
         return PSLR_DEVICE_ERROR;
     }
 
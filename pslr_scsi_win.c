@@ -133,6 +133,12 @@ typedef struct _SCSI_PASS_THROUGH_WITH_BUFFER
     UCHAR             ucSenseBuf[32];
 } SCSI_PASS_THROUGH_WITH_BUFFER;
 
+static uint32_t last_error = 0;
+
+uint32_t scsi_last_error(void) {
+    return last_error;
+}
+
 char **get_drives(int *driveNum) {
     char **ret;
     ret = malloc( ('Z'-'C'+1) * sizeof(char *));
@@ -232,7 +238,7 @@ void close_drive(int *hDevice)
 }
 
 int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
-              uint8_t *buf, uint32_t bufLen)
+              uint8_t *buf, uint32_t bufLen, uint32_t timeout_ms)
 {
    SCSI_PASS_THROUGH_WITH_BUFFER sptdwb;
    DWORD outByte=0;
@@ -249,7 +255,7 @@ int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
    sptdwb.sptd.SenseInfoLength = sizeof(sptdwb.ucSenseBuf);
    sptdwb.sptd.DataIn = SCSI_IOCTL_DATA_IN;
    sptdwb.sptd.DataTransferLength = bufLen;
-   sptdwb.sptd.TimeOutValue = 10;
+   sptdwb.sptd.TimeOutValue = (timeout_ms + 999) / 1000; /* seconds */
    sptdwb.sptd.DataBuffer = dataIn;
    sptdwb.sptd.SenseInfoOffset = offsetof(SCSI_PASS_THROUGH_WITH_BUFFER,ucSenseBuf);
    
@@ -269,6 +275,7 @@ int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
       LastError = GetLastError();
       if(LastError != 0)
       {
+         last_error = 1 << SCSI_ERROR_IOCTL;
          CancelIo((HANDLE)sg_fd);
       }
    }
@@ -293,7 +300,7 @@ int scsi_read(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
 }
 
 int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
-               uint8_t *buf, uint32_t bufLen)
+               uint8_t *buf, uint32_t bufLen, uint32_t timeout_ms)
 {
    SCSI_PASS_THROUGH_WITH_BUFFER sptdwb;
    DWORD outByte=0;
@@ -309,7 +316,7 @@ int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
    sptdwb.sptd.SenseInfoLength = sizeof(sptdwb.ucSenseBuf);
    sptdwb.sptd.DataIn = SCSI_IOCTL_DATA_OUT;
    sptdwb.sptd.DataTransferLength = bufLen;
-   sptdwb.sptd.TimeOutValue = 10;
+   sptdwb.sptd.TimeOutValue = (timeout_ms + 999) / 1000; /* seconds */
    sptdwb.sptd.DataBuffer = buf;
    sptdwb.sptd.SenseInfoOffset = offsetof(SCSI_PASS_THROUGH_WITH_BUFFER,ucSenseBuf);
    
@@ -329,6 +336,7 @@ int scsi_write(int sg_fd, uint8_t *cmd, uint32_t cmdLen,
       LastError = GetLastError();
       if(LastError != 0)
       {
+         last_error = 1 << SCSI_ERROR_IOCTL;
          CancelIo((HANDLE)sg_fd);
       }
    }
@@ -0,0 +1,145 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pslr_sharpness.h"
+
+/* AF point centers as a fraction of the frame, in the order of the
+ * PSLR_AF_POINT_* bits (same layout as the GUI) */
+static const struct {
+    float x;
+    float y;
+} sharpness_af_points[PSLR_SHARPNESS_AF_POINTS] = {
+    { 0.348, 0.367 }, { 0.498, 0.367 }, { 0.648, 0.367 },
+    { 0.206, 0.500 }, { 0.348, 0.500 }, { 0.498, 0.500 }, { 0.648, 0.500 }, { 0.789, 0.500 },
+    { 0.348, 0.631 }, { 0.498, 0.631 }, { 0.648, 0.631 }
+};
+
+#define SHARPNESS_REGION 0.06       /* half size of an AF point region, fraction of the width */
+
+/* Squared Sobel gradient of every inner pixel of the luminance,
+ * AF point regions are summed from the same rows */
+void pslr_sharpness_rgb(pslr_sharpness_t *s, const uint8_t *pixels,
+                        uint32_t width, uint32_t height, uint32_t rowstride) {
+    double point_sum[PSLR_SHARPNESS_AF_POINTS];
+    uint32_t point_n[PSLR_SHARPNESS_AF_POINTS];
+    int x0[PSLR_SHARPNESS_AF_POINTS], x1[PSLR_SHARPNESS_AF_POINTS];
+    int y0[PSLR_SHARPNESS_AF_POINTS], y1[PSLR_SHARPNESS_AF_POINTS];
+    int16_t *luma, *l0, *l1, *l2;
+    float *energy;
+    double frame_sum = 0;
+    int r = width * SHARPNESS_REGION;
+    int x, y, i;
+
+    memset(s, 0, sizeof (*s));
+    memset(point_sum, 0, sizeof (point_sum));
+    memset(point_n, 0, sizeof (point_n));
+    if (width < 3 || height < 3) {
+        return;
+    }
+    luma = malloc(3 * width * sizeof (int16_t));
+    energy = malloc(width * sizeof (float));
+    if (!luma || !energy) {
+        free(luma);
+        free(energy);
+        return;
+    }
+    for (i = 0; i < PSLR_SHARPNESS_AF_POINTS; ++i) {
+        x0[i] = sharpness_af_points[i].x * width - r;
+        x1[i] = sharpness_af_points[i].x * width + r;
+        y0[i] = sharpness_af_points[i].y * height - r;
+        y1[i] = sharpness_af_points[i].y * height + r;
+    }
+
+    /* Three rows of luminance in a ring */
+    for (y = 0; y < height; ++y) {
+        const uint8_t *p = pixels + y * rowstride;
+        int16_t *l = luma + (y % 3) * width;
+        for (x = 0; x < width; ++x) {
+            l[x] = (54 * p[3 * x] + 183 * p[3 * x + 1] + 19 * p[3 * x + 2]) >> 8;
+        }
+        if (y < 2) {
+            continue;
+        }
+        l0 = luma + ((y - 2) % 3) * width;
+        l1 = luma + ((y - 1) % 3) * width;
+        l2 = l;
+        for (x = 1; x < width - 1; ++x) {
+            int gx = (l0[x + 1] + 2 * l1[x + 1] + l2[x + 1]) - (l0[x - 1] + 2 * l1[x - 1] + l2[x - 1]);
+            int gy = (l2[x - 1] + 2 * l2[x] + l2[x + 1]) - (l0[x - 1] + 2 * l0[x] + l0[x + 1]);
+            energy[x] = (float) (gx * gx + gy * gy);
+        }
+        // the row of the gradients is y - 1
+        for (x = 1; x < width - 1; ++x) {
+            frame_sum += energy[x];
+        }
+        for (i = 0; i < PSLR_SHARPNESS_AF_POINTS; ++i) {
+            int xa = x0[i] < 1 ? 1 : x0[i];
+            int xb = x1[i] > width - 1 ? width - 1 : x1[i];
+            if (y - 1 < y0[i] || y - 1 >= y1[i]) {
+                continue;
+            }
+            for (x = xa; x < xb; ++x) {
+                point_sum[i] += energy[x];
+            }
+            point_n[i] += xb > xa ? xb - xa : 0;
+        }
+    }
+
+    /* Sobel gradients are 4 times the pixel difference */
+    s->frame = sqrt(frame_sum / ((double) (width - 2) * (height - 2))) / 4;
+    for (i = 0; i < PSLR_SHARPNESS_AF_POINTS; ++i) {
+        s->af_point[i] = point_n[i] ? sqrt(point_sum[i] / point_n[i]) / 4 : 0;
+    }
+    free(luma);
+    free(energy);
+}
+
+float pslr_sharpness_score(const pslr_sharpness_t *s, uint32_t mask) {
+    float score = 0;
+    int i;
+
+    if (!mask) {
+        return s->frame;
+    }
+    for (i = 0; i < PSLR_SHARPNESS_AF_POINTS; ++i) {
+        if ((mask & (1 << i)) && s->af_point[i] > score) {
+            score = s->af_point[i];
+        }
+    }
+    return score;
+}
+
+bool pslr_sharpness_history_add(pslr_sharpness_history_t *h, float score) {
+    float reference = 0;
+    int n = h->count < PSLR_SHARPNESS_HISTORY ? h->count : PSLR_SHARPNESS_HISTORY;
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        if (h->scores[i] > reference) {
+            reference = h->scores[i];
+        }
+    }
+    h->scores[h->count % PSLR_SHARPNESS_HISTORY] = score;
+    ++h->count;
+    return n > 0 && score < PSLR_SHARPNESS_SOFT * reference;
+}
@@ -0,0 +1,59 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_SHARPNESS_H
+#define PSLR_SHARPNESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Sharpness of previews.
+ *
+ * The score is the Tenengrad measure, the RMS Sobel gradient of the
+ * luminance, over the whole frame and over a small region around each
+ * AF point. The regions follow the PSLR_AF_POINT_* bits of pslr.h. The
+ * scores depend on the subject, so a frame is only judged soft
+ * relative to the sharpest of the last frames. */
+
+#define PSLR_SHARPNESS_AF_POINTS 11
+#define PSLR_SHARPNESS_HISTORY 8
+#define PSLR_SHARPNESS_SOFT 0.6     /* soft below this ratio of the reference */
+
+typedef struct {
+    float frame;
+    float af_point[PSLR_SHARPNESS_AF_POINTS];
+} pslr_sharpness_t;
+
+typedef struct {
+    float scores[PSLR_SHARPNESS_HISTORY];
+    int count;
+} pslr_sharpness_history_t;
+
+/* Sharpness of packed 8 bit RGB pixels, rows are rowstride bytes apart */
+void pslr_sharpness_rgb(pslr_sharpness_t *s, const uint8_t *pixels,
+                        uint32_t width, uint32_t height, uint32_t rowstride);
+
+/* Score of the sharpest AF point in mask (e.g. the focused AF points),
+ * the frame score if mask is empty */
+float pslr_sharpness_score(const pslr_sharpness_t *s, uint32_t mask);
+
+/* Adds a score to the history and returns true if it is soft compared
+ * to the previous ones */
+bool pslr_sharpness_history_add(pslr_sharpness_history_t *h, float score);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "pslr_trace.h"
+
+static const struct {
+    const char *name;
+    const char *fmt;
+} trace_events[PSLR_EV_MAX] = {
+    { "none",           "" },
+    { "connect",        "id=0x%x fast=%u" },
+    { "disconnect",     "" },
+    { "command",        "0x%02x 0x%02x 0x%02x" },
+    { "status",         "status=0x%x polls=%u" },
+    { "result",         "length=%u polls=%u error=0x%x" },
+    { "read_result",    "requested=%u got=%u" },
+    { "scsi_error",     "cmd=0x%02x length=%u ret=%d" },
+    { "status_full",    "got=%u expected=%u bufmask=0x%x" },
+    { "x18",            "subcommand=0x%02x args=%u arg0=%d" },
+    { "shutter",        "fullpress=%u result=0x%x" },
+    { "buffer_open",    "bufno=%u type=%u resolution=%u" },
+    { "buffer_desync",  "retry=%u b=%u" },
+    { "segment",        "b=%u addr=0x%x length=%u" },
+    { "buffer_ready",   "segments=%u length=%u" },
+    { "download_block", "addr=0x%x length=%u" },
+    { "block_retry",    "addr=0x%x length=%u retry=%u" },
+    { "buffer_close",   "offset=%u" },
+    { "delete_buffer",  "bufno=%u" },
+};
+
+void pslr_trace_init(pslr_trace_t *t) {
+    struct timeval tv;
+    memset(t, 0, sizeof (*t));
+    gettimeofday(&tv, NULL);
+    t->start_sec = tv.tv_sec;
+    t->start_usec = tv.tv_usec;
+}
+
+/* Writers only share the head index, so several threads can add
+ * events without a lock. A reader racing with a writer may see a
+ * half written entry, which is acceptable for diagnostics. */
+void pslr_trace_add(pslr_trace_t *t, uint16_t level, uint16_t event,
+                    uint32_t a, uint32_t b, uint32_t c) {
+    struct timeval tv;
+    uint32_t idx = __sync_fetch_and_add(&t->head, 1);
+    pslr_trace_entry_t *e = &t->entries[idx & (PSLR_TRACE_SIZE - 1)];
+
+    gettimeofday(&tv, NULL);
+    e->time_us = (uint32_t)(tv.tv_sec - t->start_sec) * 1000000 + tv.tv_usec - t->start_usec;
+    e->event = event;
+    e->level = level;
+    e->args[0] = a;
+    e->args[1] = b;
+    e->args[2] = c;
+}
+
+const char *pslr_trace_event_name(int event) {
+    if (event < 0 || event >= PSLR_EV_MAX) {
+        return "unknown";
+    }
+    return trace_events[event].name;
+}
+
+int pslr_trace_save(pslr_trace_t *t, const char *filename) {
+    FILE *f;
+    uint32_t size = PSLR_TRACE_SIZE;
+    size_t n;
+
+    f = fopen(filename, "wb");
+    if (!f) {
+        return -1;
+    }
+    n = fwrite(PSLR_TRACE_MAGIC, 8, 1, f);
+    n += fwrite(&size, sizeof (size), 1, f);
+    n += fwrite((const void *)t, sizeof (*t), 1, f);
+    fclose(f);
+    return n == 3 ? 0 : -1;
+}
+
+int pslr_trace_load(pslr_trace_t *t, const char *filename) {
+    FILE *f;
+    char magic[8];
+    uint32_t size;
+    size_t n;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        return -1;
+    }
+    n = fread(magic, 8, 1, f);
+    n += fread(&size, sizeof (size), 1, f);
+    if (n != 2 || memcmp(magic, PSLR_TRACE_MAGIC, 8) != 0 || size != PSLR_TRACE_SIZE) {
+        fclose(f);
+        return -1;
+    }
+    n = fread((void *)t, sizeof (*t), 1, f);
+    fclose(f);
+    return n == 1 ? 0 : -1;
+}
+
+void pslr_trace_print(pslr_trace_t *t, FILE *out) {
+    uint32_t head = t->head;
+    uint32_t i = head > PSLR_TRACE_SIZE ? head - PSLR_TRACE_SIZE : 0;
+
+    if (i > 0) {
+        fprintf(out, "(%u older events dropped)\n", i);
+    }
+    for (; i != head; ++i) {
+        pslr_trace_entry_t *e = &t->entries[i & (PSLR_TRACE_SIZE - 1)];
+        fprintf(out, "%6u.%06u %-15s ", e->time_us / 1000000, e->time_us % 1000000,
+                pslr_trace_event_name(e->event));
+        if (e->event < PSLR_EV_MAX) {
+            fprintf(out, trace_events[e->event].fmt, e->args[0], e->args[1], e->args[2]);
+        } else {
+            fprintf(out, "%u %u %u", e->args[0], e->args[1], e->args[2]);
+        }
+        fprintf(out, "\n");
+    }
+}
@@ -0,0 +1,96 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_TRACE_H
+#define PSLR_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Binary event trace.
+ *
+ * Every handle owns a fixed size ring of events. An event is only an
+ * id plus three raw integer arguments, formatting happens later in
+ * pslr_trace_print() or in the pktriggercord-trace decoder. Events
+ * above PSLR_TRACE_LEVEL are removed by the compiler. */
+
+#define PSLR_TRACE_ERROR   1
+#define PSLR_TRACE_INFO    2
+#define PSLR_TRACE_VERBOSE 3
+
+#ifndef PSLR_TRACE_LEVEL
+#define PSLR_TRACE_LEVEL PSLR_TRACE_INFO
+#endif
+
+#define PSLR_TRACE_SIZE 1024 /* Number of events kept; must be a power of 2 */
+
+#define PSLR_TRACE_MAGIC "PKTRACE1"
+
+typedef enum {
+    PSLR_EV_NONE,
+    PSLR_EV_CONNECT,        // model id, fast handshake
+    PSLR_EV_DISCONNECT,
+    PSLR_EV_COMMAND,        // a, b, c
+    PSLR_EV_STATUS,         // status byte, poll iterations
+    PSLR_EV_RESULT,         // result length, poll iterations, error byte
+    PSLR_EV_READ_RESULT,    // requested bytes, received bytes
+    PSLR_EV_SCSI_ERROR,     // command byte, length, return code
+    PSLR_EV_STATUS_FULL,    // received bytes, expected bytes, parsed bufmask (0 if not parsed)
+    PSLR_EV_X18,            // subcommand, argnum, first argument
+    PSLR_EV_SHUTTER,        // fullpress, result code
+    PSLR_EV_BUFFER_OPEN,    // bufno, type, resolution
+    PSLR_EV_BUFFER_DESYNC,  // retry, segment info b
+    PSLR_EV_SEGMENT,        // b, addr, length
+    PSLR_EV_BUFFER_READY,   // segment count, total length
+    PSLR_EV_DOWNLOAD_BLOCK, // addr, length
+    PSLR_EV_BLOCK_RETRY,    // addr, length, retry
+    PSLR_EV_BUFFER_CLOSE,   // offset
+    PSLR_EV_DELETE_BUFFER,  // bufno
+    PSLR_EV_MAX
+} pslr_trace_event_t;
+
+typedef struct {
+    uint32_t time_us;       // microseconds since pslr_trace_init
+    uint16_t event;
+    uint16_t level;
+    uint32_t args[3];
+} pslr_trace_entry_t;
+
+typedef struct {
+    volatile uint32_t head; // total number of events ever added
+    uint32_t start_sec;
+    uint32_t start_usec;
+    pslr_trace_entry_t entries[PSLR_TRACE_SIZE];
+} pslr_trace_t;
+
+#define PSLR_TRACE(t, lvl, ev, a, b, c) do {                            \
+        if ((lvl) <= PSLR_TRACE_LEVEL)                                  \
+            pslr_trace_add((t), (lvl), (ev), (a), (b), (c));            \
+    } while (0)
+
+void pslr_trace_init(pslr_trace_t *t);
+void pslr_trace_add(pslr_trace_t *t, uint16_t level, uint16_t event,
+                    uint32_t a, uint32_t b, uint32_t c);
+
+const char *pslr_trace_event_name(int event);
+
+int pslr_trace_save(pslr_trace_t *t, const char *filename);
+int pslr_trace_load(pslr_trace_t *t, const char *filename);
+void pslr_trace_print(pslr_trace_t *t, FILE *out);
+
+#endif
@@ -0,0 +1,351 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pslr_watch.h"
+#include "pslr_metrics.h"
+
+typedef struct pslr_watch_sub pslr_watch_sub_t;
+
+struct pslr_watch_sub {
+    int id;
+    uint32_t fields;
+    uint64_t interval_us;
+    pslr_watch_cb_t cb;         /* NULL once unsubscribed */
+    void *user_data;
+    uint32_t pending;           /* changes not delivered yet */
+    uint64_t last_us;           /* time of the last call */
+    pslr_watch_sub_t *next;
+};
+
+struct pslr_watch {
+    pslr_handle_t h;
+    pslr_watch_sub_t *subs;
+    int next_id;
+    bool valid;                 /* status holds a status */
+    bool dispatching;
+    pslr_status status;
+    uint64_t last_poll_us;
+
+    uint32_t interval_ms;       /* adaptive poll interval */
+    uint64_t active_until_us;   /* poll fast until */
+    uint64_t kick_us;           /* time of a kick not answered by a change yet */
+    bool kicked;                /* poll now, even if busy */
+    bool busy;
+    pslr_watch_stats_t stats;
+};
+
+pslr_watch_t *pslr_get_watch(pslr_handle_t h) {
+    ipslr_handle_t *p = (ipslr_handle_t *) h;
+    pslr_watch_t *w = p->watch;
+
+    if (w) {
+        return w;
+    }
+    w = malloc(sizeof (*w));
+    if (!w) {
+        return NULL;
+    }
+    memset(w, 0, sizeof (*w));
+    w->h = h;
+    w->next_id = 1;
+    w->interval_ms = PSLR_WATCH_FAST_MS;
+    p->watch = w;
+    return w;
+}
+
+void pslr_watch_free(pslr_watch_t *w) {
+    pslr_watch_sub_t *sub;
+
+    if (!w) {
+        return;
+    }
+    while ((sub = w->subs)) {
+        w->subs = sub->next;
+        free(sub);
+    }
+    free(w);
+}
+
+int pslr_watch_subscribe(pslr_watch_t *w, uint32_t fields, uint32_t interval_ms,
+                         pslr_watch_cb_t cb, void *user_data) {
+    pslr_watch_sub_t *sub;
+    pslr_watch_sub_t **pp;
+
+    sub = malloc(sizeof (*sub));
+    if (!sub) {
+        return -1;
+    }
+    memset(sub, 0, sizeof (*sub));
+    sub->id = w->next_id++;
+    sub->fields = fields & PSLR_WATCH_ALL;
+    sub->interval_us = (uint64_t) interval_ms * 1000;
+    sub->cb = cb;
+    sub->user_data = user_data;
+    /* The first call gets everything */
+    sub->pending = sub->fields;
+
+    for (pp = &w->subs; *pp; pp = &(*pp)->next)
+        ;
+    *pp = sub;
+    return sub->id;
+}
+
+/* Free the unsubscribed entries, not while their callbacks may run */
+static void watch_purge(pslr_watch_t *w) {
+    pslr_watch_sub_t **pp = &w->subs;
+    pslr_watch_sub_t *sub;
+
+    while ((sub = *pp)) {
+        if (!sub->cb) {
+            *pp = sub->next;
+            free(sub);
+        } else {
+            pp = &sub->next;
+        }
+    }
+}
+
+void pslr_watch_unsubscribe(pslr_watch_t *w, int id) {
+    pslr_watch_sub_t *sub;
+
+    for (sub = w->subs; sub; sub = sub->next) {
+        if (sub->id == id) {
+            sub->cb = NULL;
+        }
+    }
+    if (!w->dispatching) {
+        watch_purge(w);
+    }
+}
+
+#define RATIONAL_NE(a, b) ((a).nom != (b).nom || (a).denom != (b).denom)
+
+/* Field groups which differ between two statuses */
+uint32_t pslr_watch_diff(const pslr_status *a, const pslr_status *b) {
+    uint32_t changed = 0;
+
+    if (a->bufmask != b->bufmask) {
+        changed |= PSLR_WATCH_BUFMASK;
+    }
+    if (a->current_iso != b->current_iso
+        || RATIONAL_NE(a->current_shutter_speed, b->current_shutter_speed)
+        || RATIONAL_NE(a->current_aperture, b->current_aperture)
+        || RATIONAL_NE(a->set_shutter_speed, b->set_shutter_speed)
+        || RATIONAL_NE(a->set_aperture, b->set_aperture)
+        || RATIONAL_NE(a->ec, b->ec)
+        || a->fixed_iso != b->fixed_iso
+        || a->auto_iso_min != b->auto_iso_min
+        || a->auto_iso_max != b->auto_iso_max
+        || a->exposure_mode != b->exposure_mode
+        || a->exposure_submode != b->exposure_submode
+        || a->user_mode_flag != b->user_mode_flag
+        || a->manual_mode_ev != b->manual_mode_ev
+        || a->light_meter_flags != b->light_meter_flags) {
+        changed |= PSLR_WATCH_EXPOSURE;
+    }
+    if (a->af_mode != b->af_mode
+        || a->af_point_select != b->af_point_select
+        || a->selected_af_point != b->selected_af_point
+        || a->focused_af_point != b->focused_af_point
+        || a->focus != b->focus) {
+        changed |= PSLR_WATCH_AF;
+    }
+    if (a->lens_id1 != b->lens_id1
+        || a->lens_id2 != b->lens_id2
+        || RATIONAL_NE(a->lens_max_aperture, b->lens_max_aperture)
+        || RATIONAL_NE(a->lens_min_aperture, b->lens_min_aperture)
+        || RATIONAL_NE(a->zoom, b->zoom)) {
+        changed |= PSLR_WATCH_LENS;
+    }
+    if (a->battery_1 != b->battery_1
+        || a->battery_2 != b->battery_2
+        || a->battery_3 != b->battery_3
+        || a->battery_4 != b->battery_4) {
+        changed |= PSLR_WATCH_BATTERY;
+    }
+    if (RATIONAL_NE(a->max_shutter_speed, b->max_shutter_speed)
+        || a->auto_bracket_mode != b->auto_bracket_mode
+        || RATIONAL_NE(a->auto_bracket_ev, b->auto_bracket_ev)
+        || a->auto_bracket_picture_count != b->auto_bracket_picture_count
+        || a->jpeg_resolution != b->jpeg_resolution
+        || a->jpeg_saturation != b->jpeg_saturation
+        || a->jpeg_quality != b->jpeg_quality
+        || a->jpeg_contrast != b->jpeg_contrast
+        || a->jpeg_sharpness != b->jpeg_sharpness
+        || a->jpeg_image_tone != b->jpeg_image_tone
+        || a->jpeg_hue != b->jpeg_hue
+        || a->image_format != b->image_format
+        || a->raw_format != b->raw_format
+        || a->custom_ev_steps != b->custom_ev_steps
+        || a->custom_sensitivity_steps != b->custom_sensitivity_steps
+        || a->ae_metering_mode != b->ae_metering_mode
+        || a->drive_mode != b->drive_mode
+        || a->shake_reduction != b->shake_reduction
+        || a->white_balance_mode != b->white_balance_mode
+        || a->white_balance_adjust_mg != b->white_balance_adjust_mg
+        || a->white_balance_adjust_ba != b->white_balance_adjust_ba
+        || a->flash_mode != b->flash_mode
+        || a->flash_exposure_compensation != b->flash_exposure_compensation
+        || a->color_space != b->color_space) {
+        changed |= PSLR_WATCH_SETTINGS;
+    }
+    return changed;
+}
+
+/* Poll fast for a while */
+static void watch_activity(pslr_watch_t *w, uint64_t now) {
+    w->interval_ms = PSLR_WATCH_FAST_MS;
+    w->active_until_us = now + PSLR_WATCH_ACTIVE_MS * 1000;
+}
+
+/* Something happened (shutter, focus, a setting), changes are expected */
+void pslr_watch_kick(pslr_watch_t *w) {
+    uint64_t now = pslr_metrics_now_us();
+
+    watch_activity(w, now);
+    w->kick_us = now;
+    w->kicked = true;
+}
+
+/* While busy (a download owns the bus) there are no polls, except
+ * one right after a kick */
+void pslr_watch_set_busy(pslr_watch_t *w, bool busy) {
+    w->busy = busy;
+}
+
+/* Compare a status read elsewhere with the last one and call the
+ * subscribers which have changes and whose interval elapsed */
+void pslr_watch_update(pslr_watch_t *w, const pslr_status *status) {
+    pslr_watch_sub_t *sub;
+    uint32_t changed;
+    uint32_t deliver;
+    uint64_t now = pslr_metrics_now_us();
+
+    changed = w->valid ? pslr_watch_diff(&w->status, status) : PSLR_WATCH_ALL;
+    memcpy(&w->status, status, sizeof (w->status));
+    if (w->valid && (changed & ~PSLR_WATCH_BATTERY)) {
+        ++w->stats.changed_polls;
+        if (w->kick_us) {
+            w->stats.kick_latency_us = now - w->kick_us;
+            w->kick_us = 0;
+        }
+        watch_activity(w, now);
+    }
+    w->valid = true;
+
+    w->dispatching = true;
+    for (sub = w->subs; sub; sub = sub->next) {
+        if (!sub->cb) {
+            continue;
+        }
+        sub->pending |= changed & sub->fields;
+        if (sub->pending && (sub->last_us == 0 || now - sub->last_us >= sub->interval_us)) {
+            deliver = sub->pending;
+            sub->pending = 0;
+            sub->last_us = now;
+            sub->cb(&w->status, deliver, sub->user_data);
+        }
+    }
+    w->dispatching = false;
+    watch_purge(w);
+}
+
+/* Read the status once for all subscribers */
+int pslr_watch_poll(pslr_watch_t *w) {
+    pslr_status status;
+    uint64_t us;
+    int ret;
+
+    w->kicked = false;
+    w->last_poll_us = pslr_metrics_now_us();
+    ret = pslr_get_status(w->h, &status);
+    us = pslr_metrics_now_us() - w->last_poll_us;
+    ++w->stats.polls;
+    w->stats.poll_us += us;
+    if (us > w->stats.max_poll_us) {
+        w->stats.max_poll_us = us;
+    }
+    if (ret != PSLR_OK) {
+        return ret;
+    }
+    /* Decay to slow polling after the active period */
+    if (w->last_poll_us >= w->active_until_us) {
+        w->kick_us = 0;
+        w->interval_ms *= 2;
+        if (w->interval_ms > PSLR_WATCH_SLOW_MS) {
+            w->interval_ms = PSLR_WATCH_SLOW_MS;
+        }
+    }
+    pslr_watch_update(w, &status);
+    return PSLR_OK;
+}
+
+/* The adaptive interval, not shorter than the fastest subscriber
+ * wants; 0 while busy */
+static uint64_t watch_interval_us(pslr_watch_t *w) {
+    pslr_watch_sub_t *sub;
+    uint64_t interval_us = (uint64_t) w->interval_ms * 1000;
+    uint64_t fastest_us = UINT64_MAX;
+
+    if (w->busy) {
+        return 0;
+    }
+    for (sub = w->subs; sub; sub = sub->next) {
+        if (sub->cb && sub->interval_us < fastest_us) {
+            fastest_us = sub->interval_us;
+        }
+    }
+    if (fastest_us != UINT64_MAX && fastest_us > interval_us) {
+        interval_us = fastest_us;
+    }
+    return interval_us;
+}
+
+/* Milliseconds until the next poll is due, UINT32_MAX while busy */
+uint32_t pslr_watch_next_ms(pslr_watch_t *w) {
+    uint64_t interval_us;
+    uint64_t elapsed_us;
+
+    if (w->kicked || w->last_poll_us == 0) {
+        return 0;
+    }
+    interval_us = watch_interval_us(w);
+    if (interval_us == 0) {
+        return UINT32_MAX;
+    }
+    elapsed_us = pslr_metrics_now_us() - w->last_poll_us;
+    if (elapsed_us >= interval_us) {
+        return 0;
+    }
+    return (interval_us - elapsed_us + 999) / 1000;
+}
+
+void pslr_watch_get_stats(pslr_watch_t *w, pslr_watch_stats_t *stats) {
+    memcpy(stats, &w->stats, sizeof (*stats));
+    stats->interval_ms = watch_interval_us(w) / 1000;
+}
+
+/* The last status seen, NULL before the first poll */
+const pslr_status *pslr_watch_status(pslr_watch_t *w) {
+    return w->valid ? &w->status : NULL;
+}
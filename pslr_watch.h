@@ -0,0 +1,93 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PSLR_WATCH_H
+#define PSLR_WATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pslr.h"
+
+/* Status subscriptions.
+ *
+ * Each handle has one watch, pslr_get_watch() creates it at the first
+ * call and pslr_shutdown() frees it with all of its subscriptions. The
+ * watch polls the status of the handle for all subscribers: each
+ * pslr_watch_poll() reads the status once, compares it with the previous
+ * one and hands the changed field groups to the subscribers interested
+ * in them. A subscriber is called at most once per its interval, changes
+ * arriving in between are collected and delivered together.
+ *
+ * The caller drives the polling, pslr_watch_next_ms() tells when the
+ * next one is due. The poll interval adapts: it is PSLR_WATCH_FAST_MS
+ * for PSLR_WATCH_ACTIVE_MS after pslr_watch_kick() (a user action) or a
+ * detected change, then doubles with every poll up to PSLR_WATCH_SLOW_MS.
+ * It is never shorter than the interval of the fastest subscriber.
+ * Polling stops while the bus is busy with a download, see
+ * pslr_watch_set_busy(). */
+
+#define PSLR_WATCH_FAST_MS 100
+#define PSLR_WATCH_SLOW_MS 2000
+#define PSLR_WATCH_ACTIVE_MS 3000
+
+typedef enum {
+    PSLR_WATCH_BUFMASK  = 1 << 0,   /* bufmask */
+    PSLR_WATCH_EXPOSURE = 1 << 1,   /* shutter, aperture, ISO, EC, exposure mode */
+    PSLR_WATCH_AF       = 1 << 2,   /* AF mode and points, focus */
+    PSLR_WATCH_LENS     = 1 << 3,   /* lens ids and apertures, zoom */
+    PSLR_WATCH_BATTERY  = 1 << 4,
+    PSLR_WATCH_SETTINGS = 1 << 5,   /* everything else: JPEG, drive, WB, flash, ... */
+    PSLR_WATCH_ALL      = (1 << 6) - 1
+} pslr_watch_field_t;
+
+typedef struct pslr_watch pslr_watch_t;
+
+typedef struct {
+    uint32_t interval_ms;       /* current poll interval, 0 while paused */
+    uint64_t polls;
+    uint64_t changed_polls;     /* polls which found a change */
+    uint64_t poll_us;           /* time spent reading the status */
+    uint64_t max_poll_us;
+    uint64_t kick_latency_us;   /* last kick until the change it caused was seen */
+} pslr_watch_stats_t;
+
+/* changed is the mask of the subscribed groups changed since the last
+ * call, all of them at the first call */
+typedef void (*pslr_watch_cb_t)(const pslr_status *status, uint32_t changed, void *user_data);
+
+/* The watch of the handle, NULL if out of memory */
+pslr_watch_t *pslr_get_watch(pslr_handle_t h);
+/* Called by pslr_shutdown() */
+void pslr_watch_free(pslr_watch_t *w);
+
+/* Returns the subscription id, or -1 if out of memory */
+int pslr_watch_subscribe(pslr_watch_t *w, uint32_t fields, uint32_t interval_ms,
+                         pslr_watch_cb_t cb, void *user_data);
+void pslr_watch_unsubscribe(pslr_watch_t *w, int id);
+
+int pslr_watch_poll(pslr_watch_t *w);
+void pslr_watch_update(pslr_watch_t *w, const pslr_status *status);
+uint32_t pslr_watch_next_ms(pslr_watch_t *w);
+void pslr_watch_kick(pslr_watch_t *w);
+void pslr_watch_set_busy(pslr_watch_t *w, bool busy);
+void pslr_watch_get_stats(pslr_watch_t *w, pslr_watch_stats_t *stats);
+const pslr_status *pslr_watch_status(pslr_watch_t *w);
+uint32_t pslr_watch_diff(const pslr_status *a, const pslr_status *b);
+
+#endif
@@ -0,0 +1,646 @@
+/*
+    pkTriggerCord
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+    Remote control of Pentax DSLR cameras.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Python 3 extension over the pslr handle API.
+ *
+ * Every camera call runs with the GIL released and the lock of the
+ * Camera object held, so a Camera can be shared between threads.
+ * Downloaded buffers are pooled buffers of the handle exported with
+ * the buffer protocol, get_buffer() returns a memoryview over them
+ * without copying. The library drives a single camera per process, so
+ * only one Camera can be open at a time. */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pslr.h"
+
+bool debug = false;
+
+typedef struct {
+    PyObject_HEAD
+    pslr_handle_t h;            /* NULL after close() */
+    PyThread_type_lock lock;    /* serializes the camera I/O of the object */
+} CameraObject;
+
+typedef struct {
+    PyObject_HEAD
+    uint8_t *data;              /* from pslr_get_buffer_pooled() */
+    Py_ssize_t size;
+} BufferObject;
+
+static PyObject *PslrError;
+
+/* The single library handle and the Camera owning it */
+static pslr_handle_t the_handle;
+static CameraObject *the_camera;
+
+/* Buffers freed while the camera may be busy in another thread; the
+ * pool is not thread safe, they are given back under the camera lock.
+ * Only touched with the GIL held. */
+static uint8_t **released;
+static Py_ssize_t released_count;
+static Py_ssize_t released_size;
+
+static const char *const result_names[PSLR_ERROR_MAX] = {
+    "ok", "device error", "scsi error", "command error", "read error",
+    "out of memory", "invalid parameter", "cancelled", "timeout"
+};
+
+/* Closed by another thread meanwhile: stmt is skipped, the callers
+ * preset their result to PSLR_DEVICE_ERROR */
+#define CAMERA_IO(self, stmt) do {                          \
+        Py_BEGIN_ALLOW_THREADS                              \
+        PyThread_acquire_lock((self)->lock, WAIT_LOCK);     \
+        if ((self)->h) {                                    \
+            stmt;                                           \
+        }                                                   \
+        PyThread_release_lock((self)->lock);                \
+        Py_END_ALLOW_THREADS                                \
+    } while (0)
+
+static PyObject *set_error(int ret) {
+    const char *name = ret >= 0 && ret < PSLR_ERROR_MAX ? result_names[ret] : "unknown error";
+    PyObject *args = Py_BuildValue("(is)", ret, name);
+
+    if (args) {
+        PyErr_SetObject(PslrError, args);
+        Py_DECREF(args);
+    }
+    return NULL;
+}
+
+static PyObject *result(int ret) {
+    if (ret != PSLR_OK) {
+        return set_error(ret);
+    }
+    Py_RETURN_NONE;
+}
+
+static bool check_open(CameraObject *self) {
+    if (!self->h) {
+        PyErr_SetString(PyExc_ValueError, "camera is closed");
+        return false;
+    }
+    return true;
+}
+
+/* Take the pending released buffers, to be given back with
+ * recycle() once the camera lock is held */
+static Py_ssize_t take_released(uint8_t ***list) {
+    Py_ssize_t n = released_count;
+
+    *list = released;
+    released = NULL;
+    released_count = 0;
+    released_size = 0;
+    return n;
+}
+
+static void recycle(pslr_handle_t h, uint8_t **list, Py_ssize_t n) {
+    Py_ssize_t i;
+
+    for (i = 0; i < n; ++i) {
+        pslr_buffer_release(h, list[i]);
+    }
+}
+
+/* Buffer */
+
+/* Give a downloaded buffer back to the pool, or queue it while a
+ * camera is open */
+static void release_data(uint8_t *data) {
+    uint8_t **list;
+
+    if (!the_camera) {
+        /* Nobody can use the pool without the GIL */
+        pslr_buffer_release(the_handle, data);
+        return;
+    }
+    if (released_count == released_size) {
+        list = PyMem_Realloc(released, (released_size + 16) * sizeof (*list));
+        if (!list) {
+            /* Lose it rather than racing with the camera thread */
+            return;
+        }
+        released = list;
+        released_size += 16;
+    }
+    released[released_count++] = data;
+}
+
+static void Buffer_dealloc(BufferObject *self) {
+    if (self->data) {
+        release_data(self->data);
+    }
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static int Buffer_getbuffer(BufferObject *self, Py_buffer *view, int flags) {
+    return PyBuffer_FillInfo(view, (PyObject *) self, self->data, self->size, 1, flags);
+}
+
+static PyBufferProcs Buffer_as_buffer = {
+    (getbufferproc) Buffer_getbuffer,
+    NULL
+};
+
+static PyTypeObject BufferType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pslr.Buffer",
+    .tp_basicsize = sizeof (BufferObject),
+    .tp_dealloc = (destructor) Buffer_dealloc,
+    .tp_as_buffer = &Buffer_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Downloaded camera buffer, read through a memoryview",
+};
+
+/* Camera */
+
+static int Camera_init(CameraObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "model", "device", NULL };
+    char *model = NULL;
+    char *device = NULL;
+    pslr_handle_t h = NULL;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zz", kwlist, &model, &device)) {
+        return -1;
+    }
+    if (self->h) {
+        PyErr_SetString(PyExc_ValueError, "camera is already open");
+        return -1;
+    }
+    if (the_camera) {
+        PyErr_SetString(PyExc_RuntimeError, "another camera is open");
+        return -1;
+    }
+    if (!self->lock) {
+        self->lock = PyThread_allocate_lock();
+        if (!self->lock) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+    /* Claim the handle before releasing the GIL */
+    the_camera = self;
+    Py_BEGIN_ALLOW_THREADS
+    h = pslr_init(model, device);
+    if (h) {
+        ret = pslr_connect_fast(h);
+        if (ret != PSLR_OK) {
+            pslr_shutdown(h);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    if (!h || ret != PSLR_OK) {
+        the_camera = NULL;
+        set_error(ret);
+        return -1;
+    }
+    the_handle = h;
+    self->h = h;
+    return 0;
+}
+
+static PyObject *Camera_close(CameraObject *self, PyObject *unused) {
+    uint8_t **list;
+    Py_ssize_t n;
+
+    if (!self->h) {
+        Py_RETURN_NONE;
+    }
+    n = take_released(&list);
+    CAMERA_IO(self, {
+        recycle(self->h, list, n);
+        pslr_disconnect(self->h);
+        pslr_shutdown(self->h);
+        self->h = NULL;
+    });
+    PyMem_Free(list);
+    the_camera = NULL;
+    Py_RETURN_NONE;
+}
+
+static void Camera_dealloc(CameraObject *self) {
+    PyObject *ret = Camera_close(self, NULL);
+
+    Py_XDECREF(ret);
+    if (self->lock) {
+        PyThread_free_lock(self->lock);
+    }
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *Camera_enter(CameraObject *self, PyObject *unused) {
+    if (!check_open(self)) {
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject *Camera_exit(CameraObject *self, PyObject *args) {
+    PyObject *ret = Camera_close(self, NULL);
+
+    if (!ret) {
+        return NULL;
+    }
+    Py_DECREF(ret);
+    Py_RETURN_FALSE;
+}
+
+static PyObject *Camera_name(CameraObject *self, PyObject *unused) {
+    const char *name = NULL;
+
+    if (!check_open(self)) {
+        return NULL;
+    }
+    CAMERA_IO(self, name = pslr_camera_name(self->h));
+    return PyUnicode_FromString(name ? name : "");
+}
+
+static PyObject *rational(pslr_rational_t r) {
+    return Py_BuildValue("(ii)", r.nom, r.denom);
+}
+
+#define SET_ITEM(key, value) do {                           \
+        PyObject *v = (value);                              \
+        if (!v || PyDict_SetItemString(d, key, v) < 0) {    \
+            Py_XDECREF(v);                                  \
+            Py_DECREF(d);                                   \
+            return NULL;                                    \
+        }                                                   \
+        Py_DECREF(v);                                       \
+    } while (0)
+
+static PyObject *Camera_status(CameraObject *self, PyObject *unused) {
+    pslr_status st;
+    PyObject *d;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_get_status(self->h, &st));
+    if (ret != PSLR_OK) {
+        return set_error(ret);
+    }
+    d = PyDict_New();
+    if (!d) {
+        return NULL;
+    }
+    SET_ITEM("bufmask", PyLong_FromUnsignedLong(st.bufmask));
+    SET_ITEM("current_iso", PyLong_FromUnsignedLong(st.current_iso));
+    SET_ITEM("current_shutter_speed", rational(st.current_shutter_speed));
+    SET_ITEM("current_aperture", rational(st.current_aperture));
+    SET_ITEM("lens_max_aperture", rational(st.lens_max_aperture));
+    SET_ITEM("lens_min_aperture", rational(st.lens_min_aperture));
+    SET_ITEM("set_shutter_speed", rational(st.set_shutter_speed));
+    SET_ITEM("set_aperture", rational(st.set_aperture));
+    SET_ITEM("fixed_iso", PyLong_FromUnsignedLong(st.fixed_iso));
+    SET_ITEM("auto_iso_min", PyLong_FromUnsignedLong(st.auto_iso_min));
+    SET_ITEM("auto_iso_max", PyLong_FromUnsignedLong(st.auto_iso_max));
+    SET_ITEM("ec", rational(st.ec));
+    SET_ITEM("exposure_mode", PyLong_FromUnsignedLong(st.exposure_mode));
+    SET_ITEM("user_mode_flag", PyLong_FromUnsignedLong(st.user_mode_flag));
+    SET_ITEM("custom_ev_steps", PyLong_FromUnsignedLong(st.custom_ev_steps));
+    SET_ITEM("jpeg_resolution", PyLong_FromUnsignedLong(st.jpeg_resolution));
+    SET_ITEM("jpeg_quality", PyLong_FromUnsignedLong(st.jpeg_quality));
+    SET_ITEM("image_format", PyLong_FromUnsignedLong(st.image_format));
+    SET_ITEM("raw_format", PyLong_FromUnsignedLong(st.raw_format));
+    SET_ITEM("ae_metering_mode", PyLong_FromUnsignedLong(st.ae_metering_mode));
+    SET_ITEM("af_mode", PyLong_FromUnsignedLong(st.af_mode));
+    SET_ITEM("af_point_select", PyLong_FromUnsignedLong(st.af_point_select));
+    SET_ITEM("selected_af_point", PyLong_FromUnsignedLong(st.selected_af_point));
+    SET_ITEM("focused_af_point", PyLong_FromUnsignedLong(st.focused_af_point));
+    SET_ITEM("drive_mode", PyLong_FromUnsignedLong(st.drive_mode));
+    SET_ITEM("white_balance_mode", PyLong_FromUnsignedLong(st.white_balance_mode));
+    SET_ITEM("flash_mode", PyLong_FromUnsignedLong(st.flash_mode));
+    SET_ITEM("zoom", rational(st.zoom));
+    SET_ITEM("focus", PyLong_FromLong(st.focus));
+    SET_ITEM("lens_id", Py_BuildValue("(kk)", (unsigned long) st.lens_id1, (unsigned long) st.lens_id2));
+    SET_ITEM("battery", Py_BuildValue("(kkkk)", (unsigned long) st.battery_1, (unsigned long) st.battery_2,
+                                      (unsigned long) st.battery_3, (unsigned long) st.battery_4));
+    return d;
+}
+
+static PyObject *Camera_set_shutter(CameraObject *self, PyObject *args) {
+    pslr_rational_t r;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self) || !PyArg_ParseTuple(args, "(ii)", &r.nom, &r.denom)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_set_shutter(self->h, r));
+    return result(ret);
+}
+
+static PyObject *Camera_set_aperture(CameraObject *self, PyObject *args) {
+    pslr_rational_t r;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self) || !PyArg_ParseTuple(args, "(ii)", &r.nom, &r.denom)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_set_aperture(self->h, r));
+    return result(ret);
+}
+
+static PyObject *Camera_set_ec(CameraObject *self, PyObject *args) {
+    pslr_rational_t r;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self) || !PyArg_ParseTuple(args, "(ii)", &r.nom, &r.denom)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_set_ec(self->h, r));
+    return result(ret);
+}
+
+static PyObject *Camera_set_iso(CameraObject *self, PyObject *args) {
+    unsigned int iso;
+    unsigned int auto_min = 0;
+    unsigned int auto_max = 0;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self) || !PyArg_ParseTuple(args, "I|II", &iso, &auto_min, &auto_max)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_set_iso(self->h, iso, auto_min, auto_max));
+    return result(ret);
+}
+
+static PyObject *Camera_set_exposure_mode(CameraObject *self, PyObject *args) {
+    int mode;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self) || !PyArg_ParseTuple(args, "i", &mode)) {
+        return NULL;
+    }
+    if (mode < 0 || mode >= PSLR_EXPOSURE_MODE_MAX) {
+        return set_error(PSLR_PARAM);
+    }
+    CAMERA_IO(self, ret = pslr_set_exposure_mode(self->h, mode));
+    return result(ret);
+}
+
+static PyObject *Camera_set_jpeg_quality(CameraObject *self, PyObject *args) {
+    int stars;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self) || !PyArg_ParseTuple(args, "i", &stars)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_set_jpeg_stars(self->h, stars));
+    return result(ret);
+}
+
+static PyObject *Camera_set_image_format(CameraObject *self, PyObject *args) {
+    int format;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self) || !PyArg_ParseTuple(args, "i", &format)) {
+        return NULL;
+    }
+    if (format < 0 || format >= PSLR_IMAGE_FORMAT_MAX) {
+        return set_error(PSLR_PARAM);
+    }
+    CAMERA_IO(self, ret = pslr_set_image_format(self->h, format));
+    return result(ret);
+}
+
+static PyObject *Camera_shutter(CameraObject *self, PyObject *unused) {
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_shutter(self->h));
+    return result(ret);
+}
+
+static PyObject *Camera_focus(CameraObject *self, PyObject *unused) {
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_focus(self->h));
+    return result(ret);
+}
+
+static PyObject *Camera_get_buffer(CameraObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = { "bufno", "type", "resolution", NULL };
+    int bufno;
+    int type = -1;
+    int resolution = -1;
+    pslr_status st;
+    uint8_t *data = NULL;
+    uint32_t size = 0;
+    uint8_t **list;
+    Py_ssize_t n;
+    BufferObject *buf;
+    PyObject *view;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self) || !PyArg_ParseTupleAndKeywords(args, kwds, "i|ii", kwlist, &bufno, &type, &resolution)) {
+        return NULL;
+    }
+    n = take_released(&list);
+    CAMERA_IO(self, {
+        recycle(self->h, list, n);
+        ret = PSLR_OK;
+        /* The defaults are the current JPEG quality and resolution */
+        if (type < 0 || resolution < 0) {
+            ret = pslr_get_status(self->h, &st);
+        }
+        if (ret == PSLR_OK) {
+            if (type < 0) {
+                type = pslr_get_jpeg_buffer_type(self->h, st.jpeg_quality);
+            }
+            if (resolution < 0) {
+                resolution = st.jpeg_resolution;
+            }
+            ret = pslr_get_buffer_pooled(self->h, bufno, type, resolution, &data, &size);
+        }
+    });
+    PyMem_Free(list);
+    if (ret != PSLR_OK) {
+        return set_error(ret);
+    }
+    buf = PyObject_New(BufferObject, &BufferType);
+    if (!buf) {
+        release_data(data);
+        return NULL;
+    }
+    buf->data = data;
+    buf->size = size;
+    view = PyMemoryView_FromObject((PyObject *) buf);
+    Py_DECREF(buf);
+    return view;
+}
+
+static PyObject *Camera_delete_buffer(CameraObject *self, PyObject *args) {
+    int bufno;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self) || !PyArg_ParseTuple(args, "i", &bufno)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_delete_buffer(self->h, bufno));
+    return result(ret);
+}
+
+/* Without the camera lock: pslr_buffer_cancel() is meant to be called
+ * while another thread is downloading */
+static PyObject *Camera_cancel(CameraObject *self, PyObject *unused) {
+    if (!check_open(self)) {
+        return NULL;
+    }
+    pslr_buffer_cancel(self->h);
+    Py_RETURN_NONE;
+}
+
+static PyObject *Camera_metrics(CameraObject *self, PyObject *unused) {
+    pslr_metrics_t m;
+    const pslr_latency_t *dl;
+    PyObject *d;
+    int ret = PSLR_DEVICE_ERROR;
+
+    if (!check_open(self)) {
+        return NULL;
+    }
+    CAMERA_IO(self, ret = pslr_get_metrics(self->h, &m));
+    if (ret != PSLR_OK) {
+        return set_error(ret);
+    }
+    d = PyDict_New();
+    if (!d) {
+        return NULL;
+    }
+    dl = &m.latency[PSLR_METRIC_DOWNLOAD_BLOCK];
+    SET_ITEM("status_polls", PyLong_FromUnsignedLongLong(m.status_polls));
+    SET_ITEM("scsi_read_bytes", PyLong_FromUnsignedLongLong(m.scsi_read_bytes));
+    SET_ITEM("scsi_write_bytes", PyLong_FromUnsignedLongLong(m.scsi_write_bytes));
+    SET_ITEM("block_retries", PyLong_FromUnsignedLongLong(m.block_retries));
+    SET_ITEM("download_blocks", PyLong_FromUnsignedLongLong(dl->count));
+    SET_ITEM("download_us", PyLong_FromUnsignedLongLong(dl->total_us));
+    SET_ITEM("buffer_allocations", PyLong_FromUnsignedLongLong(m.buffer_allocations));
+    SET_ITEM("buffer_reuses", PyLong_FromUnsignedLongLong(m.buffer_reuses));
+    SET_ITEM("buffers_outstanding", PyLong_FromUnsignedLongLong(m.buffers_outstanding));
+    return d;
+}
+
+static PyObject *pslr_set_debug(PyObject *module, PyObject *args) {
+    int on;
+
+    if (!PyArg_ParseTuple(args, "p", &on)) {
+        return NULL;
+    }
+    debug = on;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef Camera_methods[] = {
+    { "close", (PyCFunction) Camera_close, METH_NOARGS, "Disconnect and release the camera" },
+    { "__enter__", (PyCFunction) Camera_enter, METH_NOARGS, NULL },
+    { "__exit__", (PyCFunction) Camera_exit, METH_VARARGS, NULL },
+    { "name", (PyCFunction) Camera_name, METH_NOARGS, "Camera model name" },
+    { "status", (PyCFunction) Camera_status, METH_NOARGS, "Read the camera status as a dict" },
+    { "set_shutter", (PyCFunction) Camera_set_shutter, METH_VARARGS, "set_shutter((nom, denom))" },
+    { "set_aperture", (PyCFunction) Camera_set_aperture, METH_VARARGS, "set_aperture((nom, denom))" },
+    { "set_ec", (PyCFunction) Camera_set_ec, METH_VARARGS, "set_ec((nom, denom))" },
+    { "set_iso", (PyCFunction) Camera_set_iso, METH_VARARGS, "set_iso(iso, auto_min=0, auto_max=0)" },
+    { "set_exposure_mode", (PyCFunction) Camera_set_exposure_mode, METH_VARARGS, "set_exposure_mode(mode)" },
+    { "set_jpeg_quality", (PyCFunction) Camera_set_jpeg_quality, METH_VARARGS, "set_jpeg_quality(stars)" },
+    { "set_image_format", (PyCFunction) Camera_set_image_format, METH_VARARGS, "set_image_format(format)" },
+    { "shutter", (PyCFunction) Camera_shutter, METH_NOARGS, "Take a picture" },
+    { "focus", (PyCFunction) Camera_focus, METH_NOARGS, "Autofocus" },
+    { "get_buffer", (PyCFunction) Camera_get_buffer, METH_VARARGS | METH_KEYWORDS,
+      "get_buffer(bufno, type=JPEG of the current quality, resolution=current) -> memoryview" },
+    { "delete_buffer", (PyCFunction) Camera_delete_buffer, METH_VARARGS, "delete_buffer(bufno)" },
+    { "cancel", (PyCFunction) Camera_cancel, METH_NOARGS, "Cancel a running download from another thread" },
+    { "metrics", (PyCFunction) Camera_metrics, METH_NOARGS, "I/O counters of the handle" },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject CameraType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pslr.Camera",
+    .tp_basicsize = sizeof (CameraObject),
+    .tp_dealloc = (destructor) Camera_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Camera(model=None, device=None): connect to a Pentax camera",
+    .tp_methods = Camera_methods,
+    .tp_init = (initproc) Camera_init,
+    .tp_new = PyType_GenericNew,
+};
+
+static PyMethodDef pslr_methods[] = {
+    { "set_debug", pslr_set_debug, METH_VARARGS, "Print the camera communication to stderr" },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef pslr_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "pslr",
+    .m_doc = "Remote control of Pentax DSLR cameras",
+    .m_size = -1,
+    .m_methods = pslr_methods,
+};
+
+PyMODINIT_FUNC PyInit_pslr(void) {
+    PyObject *m;
+
+    if (PyType_Ready(&BufferType) < 0 || PyType_Ready(&CameraType) < 0) {
+        return NULL;
+    }
+    m = PyModule_Create(&pslr_module);
+    if (!m) {
+        return NULL;
+    }
+    PslrError = PyErr_NewException("pslr.Error", PyExc_OSError, NULL);
+    Py_INCREF(PslrError);
+    Py_INCREF(&CameraType);
+    Py_INCREF(&BufferType);
+    if (PyModule_AddObject(m, "Error", PslrError) < 0
+        || PyModule_AddObject(m, "Camera", (PyObject *) &CameraType) < 0
+        || PyModule_AddObject(m, "Buffer", (PyObject *) &BufferType) < 0
+        || PyModule_AddIntConstant(m, "BUF_PEF", PSLR_BUF_PEF) < 0
+        || PyModule_AddIntConstant(m, "BUF_DNG", PSLR_BUF_DNG) < 0
+        || PyModule_AddIntConstant(m, "BUF_PREVIEW", PSLR_BUF_PREVIEW) < 0
+        || PyModule_AddIntConstant(m, "BUF_THUMBNAIL", PSLR_BUF_THUMBNAIL) < 0
+        || PyModule_AddIntConstant(m, "EXPOSURE_MODE_P", PSLR_EXPOSURE_MODE_P) < 0
+        || PyModule_AddIntConstant(m, "EXPOSURE_MODE_TV", PSLR_EXPOSURE_MODE_TV) < 0
+        || PyModule_AddIntConstant(m, "EXPOSURE_MODE_AV", PSLR_EXPOSURE_MODE_AV) < 0
+        || PyModule_AddIntConstant(m, "EXPOSURE_MODE_M", PSLR_EXPOSURE_MODE_M) < 0
+        || PyModule_AddIntConstant(m, "EXPOSURE_MODE_B", PSLR_EXPOSURE_MODE_B) < 0
+        || PyModule_AddIntConstant(m, "IMAGE_FORMAT_JPEG", PSLR_IMAGE_FORMAT_JPEG) < 0
+        || PyModule_AddIntConstant(m, "IMAGE_FORMAT_RAW", PSLR_IMAGE_FORMAT_RAW) < 0
+        || PyModule_AddIntConstant(m, "IMAGE_FORMAT_RAW_PLUS", PSLR_IMAGE_FORMAT_RAW_PLUS) < 0) {
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
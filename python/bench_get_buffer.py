@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+#    pkTriggerCord
+#    Remote control of Pentax DSLR cameras.
+#
+#    This program is free software: you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License version 3 as published by
+#    the Free Software Foundation.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program.  If not, see <http://www.gnu.org/licenses/gpl.html>.
+
+"""Download time of pslr.Camera.get_buffer() against pktriggercord-cli.
+
+Both sides download buffer 0 of the attached camera in the same file
+format. pslr downloads one picture ROUNDS times without deleting it,
+and is timed around get_buffer() and with the download_us counter of
+the handle. pktriggercord-cli always takes a new picture into buffer 0
+and deletes it afterwards, so it is run ROUNDS times with --metrics and
+its download_block total is used, which leaves out the connect and the
+shutter. The byte counts of both sides are printed to check that the
+same kind of buffer was compared.
+
+Build the module first with make python-module, then run from the top
+directory:
+
+    python3 python/bench_get_buffer.py [-n ROUNDS] [--format JPEG|PEF|DNG]
+"""
+
+import argparse
+import glob
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import pslr
+
+BUFFER_TYPES = {
+    "JPEG": -1,                 # JPEG of the current quality
+    "PEF": pslr.BUF_PEF,
+    "DNG": pslr.BUF_DNG,
+}
+
+DOWNLOAD_BLOCK = re.compile(r"^download_block\s+(\d+)\s+([0-9.]+)", re.M)
+
+
+def wait_for_buffer(cam, bufno, timeout=30.0):
+    end = time.monotonic() + timeout
+    while not cam.status()["bufmask"] & (1 << bufno):
+        if time.monotonic() > end:
+            raise RuntimeError("no picture in buffer %d" % bufno)
+        time.sleep(0.1)
+
+
+def bench_pslr(rounds, fmt):
+    """Returns (wall seconds, download seconds, bytes) per round"""
+    results = []
+    with pslr.Camera() as cam:
+        image_format = cam.status()["image_format"]
+        shot = False
+        try:
+            if fmt != "JPEG":
+                cam.set_image_format(pslr.IMAGE_FORMAT_RAW)
+            cam.shutter()
+            shot = True
+            wait_for_buffer(cam, 0)
+            for _ in range(rounds):
+                before = cam.metrics()["download_us"]
+                start = time.perf_counter()
+                data = cam.get_buffer(0, BUFFER_TYPES[fmt])
+                wall = time.perf_counter() - start
+                size = len(data)
+                data.release()
+                download = (cam.metrics()["download_us"] - before) / 1e6
+                results.append((wall, download, size))
+        finally:
+            if shot:
+                cam.delete_buffer(0)
+            cam.set_image_format(image_format)
+    return results
+
+
+def bench_cli(cli, rounds, fmt):
+    """Returns (wall seconds, download seconds, bytes) per round"""
+    results = []
+    with tempfile.TemporaryDirectory() as tmp:
+        for i in range(rounds):
+            base = os.path.join(tmp, "bench%d" % i)
+            start = time.perf_counter()
+            proc = subprocess.run([cli, "--metrics", "--file_format=" + fmt, "-o", base],
+                                  stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                                  universal_newlines=True)
+            wall = time.perf_counter() - start
+            if proc.returncode != 0:
+                raise RuntimeError("%s failed:\n%s" % (cli, proc.stderr))
+            match = DOWNLOAD_BLOCK.search(proc.stderr)
+            if not match:
+                raise RuntimeError("no download_block metrics from %s" % cli)
+            files = glob.glob(base + "-*")
+            size = sum(os.path.getsize(f) for f in files)
+            results.append((wall, float(match.group(2)) / 1000, size))
+    return results
+
+
+def report(name, results):
+    wall = statistics.median(r[0] for r in results)
+    download = statistics.median(r[1] for r in results)
+    size = statistics.median(r[2] for r in results)
+    print("%-20s %10d bytes  download %8.3f s (%6.2f MiB/s)  wall %8.3f s" %
+          (name, size, download, size / download / 1048576 if download else 0.0, wall))
+    return size
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("-n", "--rounds", type=int, default=5)
+    parser.add_argument("--format", choices=sorted(BUFFER_TYPES), default="JPEG")
+    parser.add_argument("--cli", default=os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                                      os.pardir, "pktriggercord-cli"))
+    args = parser.parse_args()
+    if args.rounds <= 0:
+        parser.error("ROUNDS must be positive")
+
+    # one camera per process: pslr is closed before the CLI runs
+    pslr_results = bench_pslr(args.rounds, args.format)
+    cli_results = bench_cli(args.cli, args.rounds, args.format)
+
+    print("buffer 0, %s, median of %d rounds (wall: get_buffer() call / whole CLI run)" %
+          (args.format, args.rounds))
+    pslr_size = report("pslr.get_buffer()", pslr_results)
+    cli_size = report("pktriggercord-cli", cli_results)
+    if abs(pslr_size - cli_size) > 0.2 * max(pslr_size, cli_size):
+        print("warning: the sizes differ, check the JPEG quality and image format of the camera",
+              file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
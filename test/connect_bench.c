@@ -0,0 +1,97 @@
+/*
+    pkTriggerCord
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 3 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/gpl.html>.
+ */
+
+/*
+ * Connect time of pslr_connect() against pslr_connect_fast() on the
+ * attached camera. Each round opens the drive, connects, reads the
+ * status (the first use the fast handshake defers its read to) and
+ * disconnects again.
+ *
+ * usage: connect_bench [rounds] [device]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pslr.h"
+#include "pslr_metrics.h"
+
+bool debug = false;
+
+typedef int (*connect_func_t)(pslr_handle_t h);
+
+static int bench(const char *name, connect_func_t connect, int rounds, char *device)
+{
+    pslr_handle_t camhandle;
+    pslr_status status;
+    uint64_t start_us;
+    uint64_t us;
+    uint64_t total_us = 0;
+    uint64_t min_us = UINT64_MAX;
+    uint64_t max_us = 0;
+    int ret;
+    int i;
+
+    for (i = 0; i < rounds; i++) {
+        camhandle = pslr_init(NULL, device);
+        if (!camhandle) {
+            fprintf(stderr, "%s: no camera found\n", name);
+            return -1;
+        }
+        start_us = pslr_metrics_now_us();
+        ret = connect(camhandle);
+        if (ret == PSLR_OK) {
+            ret = pslr_get_status(camhandle, &status);
+        }
+        us = pslr_metrics_now_us() - start_us;
+        if (ret != PSLR_OK) {
+            fprintf(stderr, "%s: round %d failed: %d\n", name, i, ret);
+            pslr_shutdown(camhandle);
+            return -1;
+        }
+        pslr_disconnect(camhandle);
+        pslr_shutdown(camhandle);
+        total_us += us;
+        if (us < min_us) {
+            min_us = us;
+        }
+        if (us > max_us) {
+            max_us = us;
+        }
+    }
+    printf("%-20s %d rounds: %8llu us average, %8llu us min, %8llu us max\n", name, rounds,
+           (unsigned long long) (total_us / rounds), (unsigned long long) min_us,
+           (unsigned long long) max_us);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 10;
+    char *device = argc > 2 ? argv[2] : NULL;
+
+    if (rounds <= 0) {
+        fprintf(stderr, "usage: %s [rounds] [device]\n", argv[0]);
+        return 1;
+    }
+    if (bench("pslr_connect", pslr_connect, rounds, device) != 0
+        || bench("pslr_connect_fast", pslr_connect_fast, rounds, device) != 0) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+    pkTriggerCord
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 3 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/gpl.html>.
+ */
+
+
+/*
+ * Time of pslr_histogram_rgb() on a synthetic frame: a colour gradient
+ * with noise, rows padded like a GdkPixbuf. The GUI runs it on every
+ * 640x480 preview.
+ *
+ * usage: histogram_bench [width height [rounds]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pslr_histogram.h"
+#include "pslr_metrics.h"
+
+int main(int argc, char **argv)
+{
+    uint32_t width = 640;
+    uint32_t height = 480;
+    uint32_t rounds = 200;
+    uint32_t rowstride;
+    uint32_t seed = 1;
+    uint32_t x, y, i;
+    uint8_t *frame;
+    uint8_t *p;
+    pslr_histogram_t h;
+    uint64_t start_us;
+    uint64_t us;
+
+    if (argc >= 3) {
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+    }
+    if (argc >= 4) {
+        rounds = atoi(argv[3]);
+    }
+    if (width == 0 || height == 0 || rounds == 0) {
+        fprintf(stderr, "usage: %s [width height [rounds]]\n", argv[0]);
+        return 1;
+    }
+    rowstride = (width * 3 + 3) & ~3;
+    frame = malloc((size_t) rowstride * height);
+    if (!frame) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    for (y = 0; y < height; ++y) {
+        p = frame + (size_t) y * rowstride;
+        for (x = 0; x < width; ++x) {
+            seed = seed * 1103515245 + 12345;
+            p[3 * x] = x * 255 / width;
+            p[3 * x + 1] = y * 255 / height;
+            p[3 * x + 2] = (seed >> 16) & 0xff;
+        }
+    }
+
+    /* one untimed round warms up the caches */
+    pslr_histogram_rgb(&h, frame, width, height, rowstride);
+    start_us = pslr_metrics_now_us();
+    for (i = 0; i < rounds; ++i) {
+        pslr_histogram_rgb(&h, frame, width, height, rowstride);
+    }
+    us = pslr_metrics_now_us() - start_us;
+
+    printf("%ux%u, %u rounds: %.3f ms per frame, %.1f Mpixel/s (peak %u, %.2f%% luminance highlights)\n",
+           width, height, rounds, us / 1000.0 / rounds,
+           us ? (double) width * height * rounds / us : 0.0,
+           h.peak, h.highlights[PSLR_HISTOGRAM_LUMA]);
+    free(frame);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+    pkTriggerCord
+    Remote control of Pentax DSLR cameras.
+    Copyright (C) 2011-2013 Andras Salamon <andras.salamon@melda.info>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 3 as published by
+    the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/gpl.html>.
+ */
+
+
+/*
+ * Long emulated download session over the buffer pool: every picture
+ * takes a thumbnail, a preview, a JPEG and sometimes a RAW file of
+ * varying sizes, with the next download starting before the last one
+ * is released. After a warm-up the pool must serve everything from its
+ * free lists, and the cached blocks must stay within the per-class limit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pslr_pool.h"
+
+#define SESSIONS 5              /* trimmed in between, like a reconnect */
+#define PICTURES 2000           /* per session */
+#define WARMUP 200              /* pictures before the allocations must stop */
+
+#define CHECK(x) do {                                                   \
+        if (!(x)) {                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+            return 1;                                                   \
+        }                                                               \
+    } while (0)
+
+static uint32_t seed = 12345;
+
+static uint32_t size_between(uint32_t min, uint32_t max) {
+    seed = seed * 1103515245 + 12345;
+    return min + (seed >> 8) % (max - min);
+}
+
+static uint64_t cached_bytes(const pslr_pool_t *pool) {
+    uint64_t bytes = 0;
+    int c;
+
+    for (c = 0; c < PSLR_POOL_CLASSES; ++c) {
+        bytes += (uint64_t) pool->free_count[c] << (PSLR_POOL_MIN_SHIFT + c);
+    }
+    return bytes;
+}
+
+int main(void) {
+    pslr_pool_t pool;
+    uint8_t *last = NULL;
+    uint8_t *data;
+    uint32_t sizes[4];
+    uint64_t warm_allocations = 0;
+    uint64_t max_cached = 0;
+    int session, picture, i, n, c;
+
+    memset(&pool, 0, sizeof (pool));
+    for (session = 0; session < SESSIONS; ++session) {
+        for (picture = 0; picture < PICTURES; ++picture) {
+            if (picture == WARMUP) {
+                warm_allocations = pool.allocations;
+            }
+            n = 0;
+            sizes[n++] = size_between(8 << 10, 20 << 10);          /* thumbnail */
+            sizes[n++] = size_between(100 << 10, 400 << 10);       /* preview */
+            sizes[n++] = size_between(3 << 20, 9 << 20);           /* JPEG */
+            if (picture % 3 == 0) {
+                sizes[n++] = size_between(14 << 20, 26 << 20);     /* RAW */
+            }
+            for (i = 0; i < n; ++i) {
+                data = pslr_pool_get(&pool, sizes[i]);
+                CHECK(data != NULL);
+                /* touch both ends, a short block would show up in valgrind */
+                data[0] = data[sizes[i] - 1] = (uint8_t) i;
+                pslr_pool_put(&pool, last);
+                last = data;
+                for (c = 0; c < PSLR_POOL_CLASSES; ++c) {
+                    CHECK(pool.free_count[c] <= PSLR_POOL_KEEP);
+                }
+                CHECK(pool.outstanding == 1);
+            }
+            if (cached_bytes(&pool) > max_cached) {
+                max_cached = cached_bytes(&pool);
+            }
+        }
+        /* steady state: nothing allocated after the warm-up */
+        CHECK(pool.allocations == warm_allocations);
+        printf("session %d: %llu allocations, %llu reuses, %llu KiB cached at most\n", session,
+               (unsigned long long) pool.allocations, (unsigned long long) pool.reuses,
+               (unsigned long long) (max_cached >> 10));
+        pslr_pool_put(&pool, last);
+        last = NULL;
+        pslr_pool_trim(&pool);
+        CHECK(pool.outstanding == 0);
+        CHECK(cached_bytes(&pool) == 0);
+    }
+    /* every session warms up the same way from an empty pool */
+    CHECK(pool.allocations <= (uint64_t) SESSIONS * PSLR_POOL_CLASSES * 2);
+    printf("pool_test: OK\n");
+    return 0;
+}